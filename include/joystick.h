@@ -1,39 +1,55 @@
 #pragma once
 
+#include "snapshot.h"
+
+// Set from the analog task and read by the radio and display tasks, so the position is kept in a snapshot and every
+// read sees one whole sample
 class Joystick {
   public:
-		Joystick() : _x{}, _y{}, _z{}, _zx{}, _zy{}, _zz{}, _expo(2.0) {}
-		Joystick(float mexpo) : _x{}, _y{}, _z{}, _zx{}, _zy{}, _zz{}, _expo(mexpo) {}
+		// Corrected values from -1 to 1, all from the same sample
+		struct axes {
+			float x;
+			float y;
+			float z;
+		};
+
+		Joystick() : Joystick(2.0) {}
+		Joystick(float mexpo) : _pos{}, _expo(mexpo) {}
 		~Joystick() = default;
 
-		void set_zeros(int x, int y, int z = 0) { _zx = x; _zy = y; _zz = z; }
-		int get_zero_x() { return _zx; }
-		int get_zero_y() { return _zy; }
-		int get_zero_z() { return _zz; }
+		void set_zeros(int x, int y, int z = 0) { _pos.update([&](position &p) { p.zx = x; p.zy = y; p.zz = z; }); }
+		int get_zero_x() { return _pos.load().zx; }
+		int get_zero_y() { return _pos.load().zy; }
+		int get_zero_z() { return _pos.load().zz; }
 
-		void set_pos(int x, int y) { _x = x; _y = y; }
-		void set_pos(int x, int y, int z) { _x = x; _y = y; _z = z; }
+		void set_pos(int x, int y) { _pos.update([&](position &p) { p.x = x; p.y = y; }); }
+		void set_pos(int x, int y, int z) { _pos.update([&](position &p) { p.x = x; p.y = y; p.z = z; }); }
 		// Gets the corrected values from -1 to 1 for the joystick
 		float x();
 		float y();
 		float z();
+		axes read();
 
-		int raw_x() { return _x; }
-		int raw_y() { return _y; }
-		int raw_z() { return _z; }
+		int raw_x() { return _pos.load().x; }
+		int raw_y() { return _pos.load().y; }
+		int raw_z() { return _pos.load().z; }
 
 		float expo() { return _expo; }
 		void set_expo(float mexpo) { _expo = mexpo; }
 
 	private:
-		int _x;
-		int _y;
-		int _z;
+		struct position {
+			int x;
+			int y;
+			int z;
+
+			int zx;
+			int zy;
+			int zz;
+		};
 
-		int _zx;
-		int _zy;
-		int _zz;
+		vesc::snapshot<position> _pos;
 
 		// TODO Probably need expo for all the values?
 		float _expo;
-};
\ No newline at end of file
+};
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "vesc.h"
+#include "history.h"
 #include "joystick.h"
+#include <array>
 
 enum class BLEState {
   INIT,
@@ -16,5 +18,27 @@ enum class BLEState {
 extern BLEState bleState;
 extern vesc::controller controller;
 
+// The values kept in each vesc's history, a channel each in this order
+constexpr std::array<float vesc::mc_values::*, 6> HISTORY_FIELDS = {
+    &vesc::mc_values::v_in, &vesc::mc_values::current_in, &vesc::mc_values::current_motor,
+    &vesc::mc_values::rpm,  &vesc::mc_values::duty_now,   &vesc::mc_values::temp_mos};
+
+// With PSRAM every vesc keeps about half a minute of samples, five minutes of seconds and half an hour of ten
+// seconds. Without it only the first two keep a few seconds of each.
+#ifdef BOARD_HAS_PSRAM
+using values_history = vesc::history<HISTORY_FIELDS.size(), 512u, 300u, 180u>;
+constexpr std::size_t HISTORY_NODES = vesc::controller::MAX_NODES + 1u;
+#else
+using values_history = vesc::history<HISTORY_FIELDS.size(), 64u, 30u, 30u>;
+constexpr std::size_t HISTORY_NODES = 2u;
+#endif
+
 void radio_init();
 void radio_run(Joystick& j);
+// Switch to the next ride mode, which the vescs get on the next control tick. Returns the mode switched to.
+std::size_t radio_next_ride_mode();
+// Upload a firmware image from LittleFS to the local vesc, or every vesc on the CAN bus, and have it flashed. Happens
+// on the radio task once it's paired, and stops controlling the motors until it's done. False if one's already waiting.
+bool radio_upload_firmware(const char *path, bool all_can = false);
+// The history for the local vesc at 0 and then each CAN node in the order they were found, nullptr if it isn't kept
+const values_history *radio_history(std::size_t n);
@@ -3,11 +3,14 @@
 // Simple helper class for serializing and deserializing data
 // TODO: instead of _p being the array iterator, perhaps we should have our own iterator type
 
+#include "byte_order.h"
 #include "crc.h"
 #include <algorithm>
 #include <array>
 #include <assert.h>
+#include <cmath>
 #include <cstdint>
+#include <cstring>
 #include <math.h>
 #include <stdio.h>
 #include <string>
@@ -30,19 +33,28 @@ public:
     copy(d);
   }
 
+  // The head is an iterator into our own array, so it has to be rebased when copying
+  buffer(const buffer &other) : _data(other._data), _len(other._len) {
+    _head = _data.begin() + (other._head - other._data.cbegin());
+  }
+
+  buffer &operator=(const buffer &other) {
+    _data = other._data;
+    _head = _data.begin() + (other._head - other._data.cbegin());
+    _len = other._len;
+    return *this;
+  }
+
   ~buffer() = default;
 
   // TODO: This should return the filled capacity not the total capacity, but might work for now
   const size_t len() { return _len; }
 
   // Just throw a type in here and it will append it to the buffer
-  // This is a specialization for int types, and simply shifts the int into the
-  // stream
+  // This is a specialization for int types, and stores the int big endian in one go
   template <class T, typename = typename std::enable_if<std::is_integral<T>::value, T>::type> int append(T val) {
-    // Start by shifting MSB to LSB into buffer
-    for (int i = sizeof(T) - 1; i >= 0; i--, _len++) {
-      *(end()) = (val >> (i * 8)) & 0xFF;
-    }
+    endian::store(&*end(), val);
+    _len += sizeof(T);
     return 0;
   };
 
@@ -54,23 +66,7 @@ public:
 
   // The float32 version of this function is pulled from append_float32_auto
   // The reasoning behind this is to create a portable method for serializing floating point values
-  int append(float val) {
-    int e = 0;
-    float sig = frexpf(val, &e);
-    float sig_abs = fabsf(sig);
-    uint32_t sig_i = 0;
-
-    if (sig_abs >= 0.5f) {
-      sig_i = static_cast<uint32_t>((sig_abs - 0.5f) * 2.0f * 8388608.0f);
-      e += 126;
-    }
-
-    uint32_t res = ((e & 0xFF) << 23) | (sig_i & 0x7FFFFF);
-    if (sig < 0) { res |= 1U << 31; }
-
-    append<uint32_t>(res);
-    return 0;
-  }
+  int append(float val) { return append<uint32_t>(endian::encode_float(val)); }
 
   int append(const uint8_t *data, size_t mlen) {
     std::copy(data, data + mlen, end());
@@ -78,44 +74,28 @@ public:
     return mlen;
   }
 
-  // Shift out the value from the buffer a byte at a time
-  template <class T> T get() {
-    T val{};
+  // None of the getters check the length, use has() once for everything a message is about to read
+  bool has(size_t bytes) const { return _len >= bytes; }
 
-    for (int i = sizeof(T) - 1; i >= 0; i--, _head++) {
-      val |= (static_cast<T>(*_head) << (i * 8));
-      _len--;
-    }
+  // Read the value out of the buffer in one go
+  template <class T> T get() {
+    auto val = endian::load<T>(&*_head);
+    _head += sizeof(T);
+    _len -= sizeof(T);
     return val;
   };
 
-  // Returns a 32bit floating point
-  float getf() {
-    uint32_t res = get<uint32_t>();
-
-    int e = (res >> 23) & 0xFF;
-    uint32_t sig_i = res & 0x7FFFFF;
-    bool neg = res & (1U << 31);
-
-    float sig = 0.0f;
-    if (e != 0 || sig_i != 0) {
-      sig = static_cast<float>(sig_i) / (8388608.0f * 2.0f) + 0.5f;
-      e -= 126;
-    }
-
-    if (neg) { sig = -sig; }
+  // Read a value offset bytes past the head without consuming anything
+  template <class T> T peek(size_t offset = 0u) const { return endian::load<T>(&*(_head + offset)); };
 
-    return ldexpf(sig, e);
-  }
+  // Returns a 32bit floating point
+  float getf() { return endian::decode_float(get<uint32_t>()); }
 
-  // Get a fixed point value
+  // Get a fixed point value. Values are signed, so a two byte -1 comes back as -1 and not 65535
   float getfp(size_t bytes, float scale) {
-    int32_t val{};
-
-    for (int i = bytes - 1; i >= 0; i--, _head++) {
-      val |= (static_cast<uint32_t>(*_head) << (i * 8ul));
-      _len--;
-    }
+    auto val = endian::load_fixed(&*_head, bytes);
+    _head += bytes;
+    _len -= bytes;
     return static_cast<float>(val) / scale;
   }
 
@@ -137,6 +117,11 @@ public:
 
   uint16_t crc() { return crc16(_head, _len); }
 
+  // CRC of count bytes starting offset bytes past the head, continuing from a previous crc
+  uint16_t crc(size_t offset, size_t count, uint16_t crc = 0u) const {
+    return crc16_update(crc, &*(_head + offset), count);
+  }
+
   std::array<uint8_t, _size> data() { return _data; }
 
   void reset() {
@@ -0,0 +1,116 @@
+#pragma once
+
+// Big endian loads and stores for the wire format. A memcpy and a byte swap compile down to one load and a bswap
+// instead of a shift and an or for every byte, and memcpy keeps unaligned access legal.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <math.h>
+#include <type_traits>
+
+namespace vesc {
+namespace endian {
+
+template <std::size_t _bytes> struct uint_of_size {};
+template <> struct uint_of_size<1u> { using type = uint8_t; };
+template <> struct uint_of_size<2u> { using type = uint16_t; };
+template <> struct uint_of_size<4u> { using type = uint32_t; };
+template <> struct uint_of_size<8u> { using type = uint64_t; };
+
+inline uint8_t swap(uint8_t v) { return v; }
+inline uint16_t swap(uint16_t v) { return __builtin_bswap16(v); }
+inline uint32_t swap(uint32_t v) { return __builtin_bswap32(v); }
+inline uint64_t swap(uint64_t v) { return __builtin_bswap64(v); }
+
+template <class T> inline T from_big(T v) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return swap(v);
+#else
+  return v;
+#endif
+}
+
+// Works for any integer type, signed values come back sign extended
+template <class T> inline T load(const uint8_t *p) {
+  static_assert(std::is_integral<T>::value, "Only integers are stored big endian");
+  typename uint_of_size<sizeof(T)>::type raw;
+  memcpy(&raw, p, sizeof(raw));
+  return static_cast<T>(from_big(raw));
+}
+
+template <class T> inline void store(uint8_t *p, T val) {
+  static_assert(std::is_integral<T>::value, "Only integers are stored big endian");
+  auto raw = from_big(static_cast<typename uint_of_size<sizeof(T)>::type>(val));
+  memcpy(p, &raw, sizeof(raw));
+}
+
+// The fixed point fields on the wire are 1, 2, 3 or 4 byte signed values
+inline int32_t load_fixed(const uint8_t *p, std::size_t bytes) {
+  switch (bytes) {
+  case 1: return static_cast<int8_t>(*p);
+  case 2: return load<int16_t>(p);
+  case 4: return load<int32_t>(p);
+  default: {
+    // Shift it up to the top of the int so the sign comes along when shifting it back down
+    uint32_t val{};
+    for (auto i = 0u; i < bytes; i++) {
+      val = (val << 8) | p[i];
+    }
+    return static_cast<int32_t>(val << (32u - bytes * 8u)) >> (32u - bytes * 8u);
+  }
+  }
+}
+
+// The vesc's portable float format, from buffer_append_float32_auto in the firmware
+inline uint32_t encode_float(float val) {
+  // Normal numbers come out exactly like IEEE 754, so the bits can be sent as they are
+  if (std::fpclassify(val) == FP_NORMAL) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    return bits;
+  }
+
+  // Like the vesc, subnormal numbers go out as 0 since this encoding can't handle them
+  if (fabsf(val) < 1.5e-38f) { val = 0.0f; }
+
+  int e = 0;
+  float sig = frexpf(val, &e);
+  float sig_abs = fabsf(sig);
+  uint32_t sig_i = 0;
+
+  if (sig_abs >= 0.5f) {
+    sig_i = static_cast<uint32_t>((sig_abs - 0.5f) * 2.0f * 8388608.0f);
+    e += 126;
+  }
+
+  uint32_t res = ((e & 0xFF) << 23) | (sig_i & 0x7FFFFF);
+  if (sig < 0) { res |= 1U << 31; }
+  return res;
+}
+
+inline float decode_float(uint32_t res) {
+  int e = (res >> 23) & 0xFF;
+  // Normal numbers are plain IEEE 754
+  if (e != 0 && e != 0xFF) {
+    float f;
+    memcpy(&f, &res, sizeof(f));
+    return f;
+  }
+
+  uint32_t sig_i = res & 0x7FFFFF;
+  bool neg = res & (1U << 31);
+
+  float sig = 0.0f;
+  if (e != 0 || sig_i != 0) {
+    sig = static_cast<float>(sig_i) / (8388608.0f * 2.0f) + 0.5f;
+    e -= 126;
+  }
+
+  if (neg) { sig = -sig; }
+
+  return ldexpf(sig, e);
+}
+
+}; // namespace endian
+}; // namespace vesc
@@ -0,0 +1,214 @@
+#pragma once
+
+// The motor (mcconf) and app (appconf) configurations, on the wire and cached. The layouts follow mc_configuration
+// and app_configuration in datatypes.h field for field, the way the 3.x firmware those structs came from sends them:
+// floats as float32, enums and bools as a byte, and the limits the firmware works out at runtime (lo_*) left out. A
+// reply that isn't exactly the size of the layout is from firmware with a different one, and is refused rather than
+// read wrong.
+//
+// A config_cache keeps the last configuration read from a vesc along with the firmware version it came from, so
+// changes can be worked out against it instead of reading the whole thing again. Writing only sends what it has to:
+// nothing when the vesc already has it, a COMM_SET_MCCONF_TEMP of a few dozen bytes when only the runtime limits
+// differ (like switching ride modes), and the whole configuration otherwise.
+
+#include "datatypes.h"
+#include "schema.h"
+#include <cstdint>
+
+namespace vesc {
+
+// Tags on the configuration fields, as their schema mask bits
+namespace conf {
+constexpr const uint32_t SETUP = 1u << 0;   // Only changed by writing the whole configuration
+constexpr const uint32_t RUNTIME = 1u << 1; // The limits COMM_SET_MCCONF_TEMP can change without storing them
+constexpr const uint32_t ALL = SETUP | RUNTIME;
+
+template <auto _member, uint32_t _mask = SETUP> using f32 = schema::field<float, _member, 1, _mask>;
+template <auto _member> using u8 = schema::field<uint8_t, _member, 1, SETUP>;
+template <auto _member> using u16 = schema::field<uint16_t, _member, 1, SETUP>;
+template <auto _member> using u32 = schema::field<uint32_t, _member, 1, SETUP>;
+template <auto _member> using i32 = schema::field<int32_t, _member, 1, SETUP>;
+template <auto _member> using bytes = schema::array_field<uint8_t, _member, SETUP>;
+template <auto _member, class _message> using group = schema::group<_member, _message, SETUP>;
+}; // namespace conf
+
+// What COMM_SET_MCCONF_TEMP carries. The current limits are scales of the stored ones, the rest replace them.
+struct mcconf_temp {
+  bool store;                 // Save them as well, instead of only until the vesc restarts
+  bool forward_can;           // Have the vesc send them on to every vesc on the CAN bus
+  bool ack;                   // Reply with an empty COMM_SET_MCCONF_TEMP once they're set
+  bool divide_by_controllers; // Split the power limits between the vescs on the CAN bus
+  float current_min_scale;
+  float current_max_scale;
+  float min_erpm;
+  float max_erpm;
+  float min_duty;
+  float max_duty;
+  float watt_min;
+  float watt_max;
+  float in_current_min;
+  float in_current_max;
+};
+
+namespace messages {
+using mc = mc_configuration;
+
+// Sent with COMM_SET_MCCONF, and the same fields come back after COMM_GET_MCCONF
+using mcconf = schema::message<
+    COMM_SET_MCCONF, mc_configuration,
+    conf::u8<&mc::pwm_mode>, conf::u8<&mc::comm_mode>, conf::u8<&mc::motor_type>, conf::u8<&mc::sensor_mode>,
+    conf::f32<&mc::l_current_max, conf::RUNTIME>, conf::f32<&mc::l_current_min, conf::RUNTIME>,
+    conf::f32<&mc::l_in_current_max, conf::RUNTIME>, conf::f32<&mc::l_in_current_min, conf::RUNTIME>,
+    conf::f32<&mc::l_abs_current_max>, conf::f32<&mc::l_min_erpm, conf::RUNTIME>,
+    conf::f32<&mc::l_max_erpm, conf::RUNTIME>, conf::f32<&mc::l_erpm_start>, conf::f32<&mc::l_max_erpm_fbrake>,
+    conf::f32<&mc::l_max_erpm_fbrake_cc>, conf::f32<&mc::l_min_vin>, conf::f32<&mc::l_max_vin>,
+    conf::f32<&mc::l_battery_cut_start>, conf::f32<&mc::l_battery_cut_end>, conf::u8<&mc::l_slow_abs_current>,
+    conf::f32<&mc::l_temp_fet_start>, conf::f32<&mc::l_temp_fet_end>, conf::f32<&mc::l_temp_motor_start>,
+    conf::f32<&mc::l_temp_motor_end>, conf::f32<&mc::l_temp_accel_dec>, conf::f32<&mc::l_min_duty, conf::RUNTIME>,
+    conf::f32<&mc::l_max_duty, conf::RUNTIME>, conf::f32<&mc::l_watt_max, conf::RUNTIME>,
+    conf::f32<&mc::l_watt_min, conf::RUNTIME>,
+    // Sensorless and hall
+    conf::f32<&mc::sl_min_erpm>, conf::f32<&mc::sl_min_erpm_cycle_int_limit>,
+    conf::f32<&mc::sl_max_fullbreak_current_dir_change>, conf::f32<&mc::sl_cycle_int_limit>,
+    conf::f32<&mc::sl_phase_advance_at_br>, conf::f32<&mc::sl_cycle_int_rpm_br>, conf::f32<&mc::sl_bemf_coupling_k>,
+    conf::bytes<&mc::hall_table>, conf::f32<&mc::hall_sl_erpm>,
+    // FOC
+    conf::f32<&mc::foc_current_kp>, conf::f32<&mc::foc_current_ki>, conf::f32<&mc::foc_f_sw>,
+    conf::f32<&mc::foc_dt_us>, conf::f32<&mc::foc_encoder_offset>, conf::u8<&mc::foc_encoder_inverted>,
+    conf::f32<&mc::foc_encoder_ratio>, conf::f32<&mc::foc_motor_l>, conf::f32<&mc::foc_motor_r>,
+    conf::f32<&mc::foc_motor_flux_linkage>, conf::f32<&mc::foc_observer_gain>, conf::f32<&mc::foc_observer_gain_slow>,
+    conf::f32<&mc::foc_pll_kp>, conf::f32<&mc::foc_pll_ki>, conf::f32<&mc::foc_duty_dowmramp_kp>,
+    conf::f32<&mc::foc_duty_dowmramp_ki>, conf::f32<&mc::foc_openloop_rpm>, conf::f32<&mc::foc_sl_openloop_hyst>,
+    conf::f32<&mc::foc_sl_openloop_time>, conf::f32<&mc::foc_sl_d_current_duty>,
+    conf::f32<&mc::foc_sl_d_current_factor>, conf::u8<&mc::foc_sensor_mode>, conf::bytes<&mc::foc_hall_table>,
+    conf::f32<&mc::foc_sl_erpm>, conf::u8<&mc::foc_sample_v0_v7>, conf::u8<&mc::foc_sample_high_current>,
+    conf::f32<&mc::foc_sat_comp>, conf::u8<&mc::foc_temp_comp>, conf::f32<&mc::foc_temp_comp_base_temp>,
+    conf::f32<&mc::foc_current_filter_const>,
+    // Speed and position PID, current control
+    conf::f32<&mc::s_pid_kp>, conf::f32<&mc::s_pid_ki>, conf::f32<&mc::s_pid_kd>, conf::f32<&mc::s_pid_kd_filter>,
+    conf::f32<&mc::s_pid_min_erpm>, conf::u8<&mc::s_pid_allow_braking>, conf::f32<&mc::p_pid_kp>,
+    conf::f32<&mc::p_pid_ki>, conf::f32<&mc::p_pid_kd>, conf::f32<&mc::p_pid_kd_filter>, conf::f32<&mc::p_pid_ang_div>,
+    conf::f32<&mc::cc_startup_boost_duty>, conf::f32<&mc::cc_min_current>, conf::f32<&mc::cc_gain>,
+    conf::f32<&mc::cc_ramp_step_max>,
+    // Misc
+    conf::i32<&mc::m_fault_stop_time_ms>, conf::f32<&mc::m_duty_ramp_step>, conf::f32<&mc::m_current_backoff_gain>,
+    conf::u32<&mc::m_encoder_counts>, conf::u8<&mc::m_sensor_port_mode>, conf::u8<&mc::m_invert_direction>,
+    conf::u8<&mc::m_drv8301_oc_mode>, conf::u8<&mc::m_drv8301_oc_adj>, conf::f32<&mc::m_bldc_f_sw_min>,
+    conf::f32<&mc::m_bldc_f_sw_max>, conf::f32<&mc::m_dc_f_sw>, conf::f32<&mc::m_ntc_motor_beta>,
+    conf::u8<&mc::m_out_aux_mode>>;
+
+using mcconf_temp = schema::message<
+    COMM_SET_MCCONF_TEMP, vesc::mcconf_temp, conf::u8<&vesc::mcconf_temp::store>,
+    conf::u8<&vesc::mcconf_temp::forward_can>, conf::u8<&vesc::mcconf_temp::ack>,
+    conf::u8<&vesc::mcconf_temp::divide_by_controllers>, conf::f32<&vesc::mcconf_temp::current_min_scale>,
+    conf::f32<&vesc::mcconf_temp::current_max_scale>, conf::f32<&vesc::mcconf_temp::min_erpm>,
+    conf::f32<&vesc::mcconf_temp::max_erpm>, conf::f32<&vesc::mcconf_temp::min_duty>,
+    conf::f32<&vesc::mcconf_temp::max_duty>, conf::f32<&vesc::mcconf_temp::watt_min>,
+    conf::f32<&vesc::mcconf_temp::watt_max>, conf::f32<&vesc::mcconf_temp::in_current_min>,
+    conf::f32<&vesc::mcconf_temp::in_current_max>>;
+
+using ppm = schema::message<
+    0u, ppm_config, conf::u8<&ppm_config::ctrl_type>, conf::f32<&ppm_config::pid_max_erpm>,
+    conf::f32<&ppm_config::hyst>, conf::f32<&ppm_config::pulse_start>, conf::f32<&ppm_config::pulse_end>,
+    conf::f32<&ppm_config::pulse_center>, conf::u8<&ppm_config::median_filter>, conf::u8<&ppm_config::safe_start>,
+    conf::f32<&ppm_config::throttle_exp>, conf::f32<&ppm_config::throttle_exp_brake>,
+    conf::u8<&ppm_config::throttle_exp_mode>, conf::f32<&ppm_config::ramp_time_pos>,
+    conf::f32<&ppm_config::ramp_time_neg>, conf::u8<&ppm_config::multi_esc>, conf::u8<&ppm_config::tc>,
+    conf::f32<&ppm_config::tc_max_diff>>;
+
+using adc = schema::message<
+    0u, adc_config, conf::u8<&adc_config::ctrl_type>, conf::f32<&adc_config::hyst>,
+    conf::f32<&adc_config::voltage_start>, conf::f32<&adc_config::voltage_end>, conf::f32<&adc_config::voltage_center>,
+    conf::f32<&adc_config::voltage2_start>, conf::f32<&adc_config::voltage2_end>, conf::u8<&adc_config::use_filter>,
+    conf::u8<&adc_config::safe_start>, conf::u8<&adc_config::cc_button_inverted>,
+    conf::u8<&adc_config::rev_button_inverted>, conf::u8<&adc_config::voltage_inverted>,
+    conf::u8<&adc_config::voltage2_inverted>, conf::f32<&adc_config::throttle_exp>,
+    conf::f32<&adc_config::throttle_exp_brake>, conf::u8<&adc_config::throttle_exp_mode>,
+    conf::f32<&adc_config::ramp_time_pos>, conf::f32<&adc_config::ramp_time_neg>, conf::u8<&adc_config::multi_esc>,
+    conf::u8<&adc_config::tc>, conf::f32<&adc_config::tc_max_diff>, conf::u16<&adc_config::update_rate_hz>>;
+
+using chuk = schema::message<
+    0u, chuk_config, conf::u8<&chuk_config::ctrl_type>, conf::f32<&chuk_config::hyst>,
+    conf::f32<&chuk_config::ramp_time_pos>, conf::f32<&chuk_config::ramp_time_neg>,
+    conf::f32<&chuk_config::stick_erpm_per_s_in_cc>, conf::f32<&chuk_config::throttle_exp>,
+    conf::f32<&chuk_config::throttle_exp_brake>, conf::u8<&chuk_config::throttle_exp_mode>,
+    conf::u8<&chuk_config::multi_esc>, conf::u8<&chuk_config::tc>, conf::f32<&chuk_config::tc_max_diff>>;
+
+using nrf = schema::message<0u, nrf_config, conf::u8<&nrf_config::speed>, conf::u8<&nrf_config::power>,
+                            conf::u8<&nrf_config::crc_type>, conf::u8<&nrf_config::retry_delay>,
+                            conf::u8<&nrf_config::retries>, conf::u8<&nrf_config::channel>,
+                            conf::bytes<&nrf_config::address>, conf::u8<&nrf_config::send_crc_ack>>;
+
+// Sent with COMM_SET_APPCONF, and the same fields come back after COMM_GET_APPCONF
+using appconf = schema::message<
+    COMM_SET_APPCONF, app_configuration, conf::u8<&app_configuration::controller_id>,
+    conf::u32<&app_configuration::timeout_msec>, conf::f32<&app_configuration::timeout_brake_current>,
+    conf::u8<&app_configuration::send_can_status>, conf::u16<&app_configuration::send_can_status_rate_hz>,
+    conf::u8<&app_configuration::can_baud_rate>, conf::u8<&app_configuration::app_to_use>,
+    conf::group<&app_configuration::app_ppm_conf, ppm>, conf::group<&app_configuration::app_adc_conf, adc>,
+    conf::u32<&app_configuration::app_uart_baudrate>, conf::group<&app_configuration::app_chuk_conf, chuk>,
+    conf::group<&app_configuration::app_nrf_conf, nrf>>;
+}; // namespace messages
+
+// What a configuration write had to send
+enum class config_change : uint8_t {
+  NONE,    // The vesc already has it
+  RUNTIME, // Only runtime limits changed, sent with COMM_SET_MCCONF_TEMP
+  FULL,    // The whole configuration
+};
+
+// The last configuration read from a vesc, what it's running now and what it has stored, for the firmware version it
+// came from. Filled in from the receiving task, so read it once the request for it has completed.
+template <class _message> class config_cache {
+public:
+  using type = typename _message::type;
+
+  config_cache() : _version{0u}, _valid{false}, _stored{}, _current{} {}
+
+  // Firmware major and minor, which a cache is only good for
+  static constexpr uint16_t version(uint8_t major, uint8_t minor) { return static_cast<uint16_t>(major << 8u | minor); }
+
+  bool valid(uint16_t version) const { return _valid && version == _version; }
+  // What the vesc is running and what it will start with, nullptr when there's nothing cached for its firmware
+  const type *current(uint16_t version) const { return valid(version) ? &_current : nullptr; }
+  const type *stored(uint16_t version) const { return valid(version) ? &_stored : nullptr; }
+
+  // The payload of a COMM_GET_*CONF reply, after the command byte. False if it isn't this layout.
+  template <class R> bool read(R &r, uint16_t version) {
+    if (r.len() != _message::size) { return false; }
+    _message::decode(r, _stored);
+    _current = _stored;
+    _version = version;
+    _valid = true;
+    return true;
+  }
+
+  // What writing want has to send. Without a cached configuration that's all of it.
+  config_change diff(const type &want, uint16_t version) const {
+    if (!valid(version)) { return config_change::FULL; }
+    if (_message::equal(want, _current)) { return config_change::NONE; }
+    if (_message::equal(want, _stored, conf::SETUP)) { return config_change::RUNTIME; }
+    return config_change::FULL;
+  }
+
+  // want was sent. Runtime changes are lost when the vesc restarts, so they don't change what's stored.
+  void wrote(const type &want, config_change change, uint16_t version) {
+    if (change == config_change::FULL) {
+      _stored = want;
+      _version = version;
+      _valid = true;
+    }
+    _current = want;
+  }
+
+  // Forget it, like when a write wasn't acknowledged and what the vesc has isn't known
+  void invalidate() { _valid = false; }
+
+private:
+  uint16_t _version;
+  bool _valid;
+  type _stored;
+  type _current;
+};
+
+}; // namespace vesc
@@ -22,6 +22,7 @@
  *      Author: benjamin
  */
 #include "crc.h"
+#include "crc_tables.h"
 
 // CRC Table
 const unsigned short crc16_tab[] = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084,
@@ -54,11 +55,78 @@ const unsigned short crc16_tab[] = { 0x0000, 0x1021, 0x2042, 0x3063, 0x4084,
 		0x0cc1, 0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
 		0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0 };
 
+static constexpr auto generated_tab = vesc::crc::make_table<1>();
+static constexpr auto nibble_tab = vesc::crc::make_nibble_table();
+static constexpr auto slice4_tab = vesc::crc::make_table<4>();
+static constexpr auto slice8_tab = vesc::crc::make_table<8>();
+
 unsigned short crc16(unsigned char *buf, unsigned int len) {
+	return crc16_update(0, buf, len);
+}
+
+unsigned short crc16_update(unsigned short crc, const unsigned char *buf, unsigned int len) {
+#if VESC_CRC_STRATEGY == VESC_CRC_BYTEWISE
+	return crc16_bytewise(crc, buf, len);
+#elif VESC_CRC_STRATEGY == VESC_CRC_GENERATED
+	return crc16_generated(crc, buf, len);
+#elif VESC_CRC_STRATEGY == VESC_CRC_NIBBLE
+	return crc16_nibble(crc, buf, len);
+#elif VESC_CRC_STRATEGY == VESC_CRC_SLICE4
+	return crc16_slice4(crc, buf, len);
+#elif VESC_CRC_STRATEGY == VESC_CRC_SLICE8
+	return crc16_slice8(crc, buf, len);
+#else
+#error "Unknown VESC_CRC_STRATEGY"
+#endif
+}
+
+unsigned short crc16_bytewise(unsigned short crc, const unsigned char *buf, unsigned int len) {
 	unsigned int i;
-	unsigned short cksum = 0;
+	unsigned short cksum = crc;
 	for (i = 0; i < len; i++) {
 		cksum = crc16_tab[(((cksum >> 8) ^ *buf++) & 0xFF)] ^ (cksum << 8);
 	}
 	return cksum;
 }
+
+unsigned short crc16_generated(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	const auto &t = generated_tab.t[0];
+	for (unsigned int i = 0; i < len; i++) {
+		crc = t[((crc >> 8) ^ *buf++) & 0xFF] ^ (crc << 8);
+	}
+	return crc;
+}
+
+unsigned short crc16_nibble(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	const auto &t = nibble_tab.t;
+	for (unsigned int i = 0; i < len; i++) {
+		crc = t[((crc >> 12) ^ (*buf >> 4)) & 0x0F] ^ (crc << 4);
+		crc = t[((crc >> 12) ^ *buf++) & 0x0F] ^ (crc << 4);
+	}
+	return crc;
+}
+
+// The running CRC is folded into the first two bytes, the rest are looked up in the table for their distance from
+// the end of the block
+unsigned short crc16_slice4(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	const auto &t = slice4_tab.t;
+	for (; len >= 4; len -= 4, buf += 4) {
+		crc = t[3][(crc >> 8) ^ buf[0]] ^ t[2][(crc & 0xFF) ^ buf[1]] ^ t[1][buf[2]] ^ t[0][buf[3]];
+	}
+	for (; len > 0; len--) {
+		crc = t[0][((crc >> 8) ^ *buf++) & 0xFF] ^ (crc << 8);
+	}
+	return crc;
+}
+
+unsigned short crc16_slice8(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	const auto &t = slice8_tab.t;
+	for (; len >= 8; len -= 8, buf += 8) {
+		crc = t[7][(crc >> 8) ^ buf[0]] ^ t[6][(crc & 0xFF) ^ buf[1]] ^ t[5][buf[2]] ^ t[4][buf[3]] ^
+		      t[3][buf[4]] ^ t[2][buf[5]] ^ t[1][buf[6]] ^ t[0][buf[7]];
+	}
+	for (; len > 0; len--) {
+		crc = t[0][((crc >> 8) ^ *buf++) & 0xFF] ^ (crc << 8);
+	}
+	return crc;
+}
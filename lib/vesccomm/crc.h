@@ -25,9 +25,53 @@
 #ifndef CRC_H_
 #define CRC_H_
 
+/*
+ * Strategies, pick one at build time with -DVESC_CRC_STRATEGY=VESC_CRC_SLICE4 etc.
+ *
+ * BYTEWISE:  The original 512 byte table, one byte per iteration
+ * GENERATED: Same as BYTEWISE, but the table is generated at compile time
+ * NIBBLE:    32 byte table, half the speed of BYTEWISE. For when flash is tight
+ * SLICE4:    2 KB of tables, four bytes per iteration
+ * SLICE8:    4 KB of tables, eight bytes per iteration
+ *
+ * Run the test_bench suite on the target to see which one wins for a board.
+ */
+#define VESC_CRC_BYTEWISE 0
+#define VESC_CRC_GENERATED 1
+#define VESC_CRC_NIBBLE 2
+#define VESC_CRC_SLICE4 3
+#define VESC_CRC_SLICE8 4
+
+#ifndef VESC_CRC_STRATEGY
+#define VESC_CRC_STRATEGY VESC_CRC_BYTEWISE
+#endif
+
 /*
  * Functions
  */
 unsigned short crc16(unsigned char *buf, unsigned int len);
 
+// Continue a CRC from a previous value using the selected strategy. crc16(buf, len) == crc16_update(0, buf, len)
+unsigned short crc16_update(unsigned short crc, const unsigned char *buf, unsigned int len);
+
+// The individual strategies, always available so they can be tested and benchmarked against each other.
+// Only the selected one ends up in the firmware as long as the linker is garbage collecting sections.
+unsigned short crc16_bytewise(unsigned short crc, const unsigned char *buf, unsigned int len);
+unsigned short crc16_generated(unsigned short crc, const unsigned char *buf, unsigned int len);
+unsigned short crc16_nibble(unsigned short crc, const unsigned char *buf, unsigned int len);
+unsigned short crc16_slice4(unsigned short crc, const unsigned char *buf, unsigned int len);
+unsigned short crc16_slice8(unsigned short crc, const unsigned char *buf, unsigned int len);
+
+// The fastest implementation this CPU supports, picked at startup (see crc_accel.cpp). Meant for large buffers such as
+// captured traffic logs on a host. crc16() above stays the portable reference.
+unsigned short crc16_fast(unsigned short crc, const unsigned char *buf, unsigned int len);
+// Name of the implementation crc16_fast() picked, for logging
+const char *crc16_fast_name();
+
+#if defined(__x86_64__) || defined(__i386__)
+// Carry-less multiply folding. Only call it when crc16_pclmul_supported() returns non zero
+unsigned short crc16_pclmul(unsigned short crc, const unsigned char *buf, unsigned int len);
+int crc16_pclmul_supported();
+#endif
+
 #endif /* CRC_H_ */
@@ -0,0 +1,109 @@
+// Hardware accelerated CRC16 and the runtime dispatcher behind crc16_fast()
+//
+// On x86 the CRC is folded 16 bytes at a time with carry-less multiplies (PCLMULQDQ). This is the approach from
+// Intel's "Fast CRC Computation Using PCLMULQDQ Instruction" paper. Because CRCs are linear, a 128 bit block A
+// followed by 128 more bits B has the same CRC as (A_hi * x^192 + A_lo * x^128) mod P followed by B. Folding keeps
+// the running value at 128 bits. The last block and the tail are finished with the table code.
+//
+// The ESP32 has no carry-less multiply, not even in the S3 vector extensions. There the dispatcher falls back to the
+// compile time VESC_CRC_STRATEGY.
+
+#include "crc.h"
+#include "crc_tables.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+// x^n mod P, multiplies the folded halves forward by n bits
+static constexpr uint64_t xpow(unsigned int n) { return vesc::crc::bitwise(1u, n); }
+
+// Multiply the high and low halves of a by the constants for a fold distance and add them
+__attribute__((target("pclmul,ssse3"))) static inline __m128i fold(__m128i a, __m128i k) {
+	return _mm_xor_si128(_mm_clmulepi64_si128(a, k, 0x11), _mm_clmulepi64_si128(a, k, 0x00));
+}
+
+// Load 16 bytes so that the first byte of the message ends up as the most significant byte
+__attribute__((target("pclmul,ssse3"))) static inline __m128i load(const unsigned char *buf) {
+	const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	return _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(buf)), reverse);
+}
+
+__attribute__((target("pclmul,ssse3")))
+unsigned short crc16_pclmul(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	// Short frames are faster through the tables than setting up the fold
+	if (len < 32) {
+		return crc16_slice8(crc, buf, len);
+	}
+
+	const __m128i k128 = _mm_set_epi64x(xpow(128 + 64), xpow(128));
+	const __m128i k256 = _mm_set_epi64x(xpow(256 + 64), xpow(256));
+	const __m128i k384 = _mm_set_epi64x(xpow(384 + 64), xpow(384));
+	const __m128i k512 = _mm_set_epi64x(xpow(512 + 64), xpow(512));
+
+	// The running CRC goes into the first two bytes of the message
+	__m128i acc = _mm_xor_si128(load(buf), _mm_set_epi64x(static_cast<int64_t>(static_cast<uint64_t>(crc) << 48), 0));
+	buf += 16;
+	len -= 16;
+
+	// Four independent folds to hide the multiply latency, then merge them back into one
+	if (len >= 64) {
+		__m128i acc1 = load(buf);
+		__m128i acc2 = load(buf + 16);
+		__m128i acc3 = load(buf + 32);
+		buf += 48;
+		len -= 48;
+		for (; len >= 64; len -= 64, buf += 64) {
+			acc = _mm_xor_si128(fold(acc, k512), load(buf));
+			acc1 = _mm_xor_si128(fold(acc1, k512), load(buf + 16));
+			acc2 = _mm_xor_si128(fold(acc2, k512), load(buf + 32));
+			acc3 = _mm_xor_si128(fold(acc3, k512), load(buf + 48));
+		}
+		acc = _mm_xor_si128(_mm_xor_si128(fold(acc, k384), fold(acc1, k256)), _mm_xor_si128(fold(acc2, k128), acc3));
+	}
+
+	for (; len >= 16; len -= 16, buf += 16) {
+		acc = _mm_xor_si128(fold(acc, k128), load(buf));
+	}
+
+	// What's left in the accumulator has the same CRC as everything folded into it
+	const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+	unsigned char last[16];
+	_mm_storeu_si128(reinterpret_cast<__m128i *>(last), _mm_shuffle_epi8(acc, reverse));
+	crc = crc16_slice8(0, last, sizeof(last));
+	return crc16_slice8(crc, buf, len);
+}
+
+int crc16_pclmul_supported() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+}
+#endif
+
+typedef unsigned short (*crc16_func)(unsigned short crc, const unsigned char *buf, unsigned int len);
+
+struct crc16_impl {
+	crc16_func f;
+	const char *name;
+};
+
+static crc16_impl crc16_select() {
+#if defined(__x86_64__) || defined(__i386__)
+	if (crc16_pclmul_supported()) {
+		return {crc16_pclmul, "pclmul"};
+	}
+#endif
+	return {crc16_update, "VESC_CRC_STRATEGY"};
+}
+
+// Picked the first time it's needed, which is effectively startup
+static const crc16_impl &crc16_selected() {
+	static const crc16_impl impl = crc16_select();
+	return impl;
+}
+
+unsigned short crc16_fast(unsigned short crc, const unsigned char *buf, unsigned int len) {
+	return crc16_selected().f(crc, buf, len);
+}
+
+const char *crc16_fast_name() { return crc16_selected().name; }
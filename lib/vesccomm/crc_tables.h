@@ -0,0 +1,58 @@
+#pragma once
+
+// Compile time generation of the CRC16 lookup tables used by crc.cpp
+// The VESC uses CRC16-CCITT (XMODEM): polynomial 0x1021, no reflection, initial value 0 and no final xor
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vesc {
+namespace crc {
+
+constexpr const uint16_t POLY = 0x1021u;
+
+// Run a value through the polynomial a bit at a time. Slow, but fine for tables and compile time work.
+constexpr uint16_t bitwise(uint16_t crc, unsigned int bits) {
+  for (auto i = 0u; i < bits; i++) {
+    crc = (crc & 0x8000u) ? static_cast<uint16_t>((crc << 1) ^ POLY) : static_cast<uint16_t>(crc << 1);
+  }
+  return crc;
+}
+
+// Add one byte to a running CRC without any tables, for CRCs computed at compile time
+constexpr uint16_t update(uint16_t crc, uint8_t b) { return bitwise(static_cast<uint16_t>(crc ^ (b << 8)), 8); }
+
+// Slice k holds the CRC of a byte followed by k zero bytes, so slice 0 is the classic 256 entry table
+template <std::size_t _slices> struct table {
+  uint16_t t[_slices][256];
+};
+
+template <std::size_t _slices> constexpr table<_slices> make_table() {
+  table<_slices> tab{};
+  for (auto b = 0u; b < 256u; b++) {
+    tab.t[0][b] = bitwise(static_cast<uint16_t>(b << 8), 8);
+  }
+  for (auto k = 1u; k < _slices; k++) {
+    for (auto b = 0u; b < 256u; b++) {
+      auto prev = tab.t[k - 1][b];
+      tab.t[k][b] = static_cast<uint16_t>(prev << 8) ^ tab.t[0][prev >> 8];
+    }
+  }
+  return tab;
+}
+
+// 16 entries, processes a nibble at a time. 32 bytes of flash instead of 512.
+struct nibble_table {
+  uint16_t t[16];
+};
+
+constexpr nibble_table make_nibble_table() {
+  nibble_table tab{};
+  for (auto n = 0u; n < 16u; n++) {
+    tab.t[n] = bitwise(static_cast<uint16_t>(n << 12), 4);
+  }
+  return tab;
+}
+
+}; // namespace crc
+}; // namespace vesc
@@ -0,0 +1,130 @@
+#pragma once
+
+// Packet callbacks without std::map or std::function. A delegate holds a small callable in place instead of on the
+// heap, and the table finds the callbacks for a packet type with one array lookup.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace vesc {
+
+template <class _sig> class delegate;
+
+// Holds any callable up to two pointers in size, a lambda capturing a couple of references or a pointer to a struct.
+// Never allocates.
+template <class R, class... Args> class delegate<R(Args...)> {
+public:
+  static constexpr const std::size_t CAPACITY = 2u * sizeof(void *);
+
+  constexpr delegate() : _storage{}, _call{nullptr} {}
+  constexpr delegate(std::nullptr_t) : delegate() {}
+
+  template <class F,
+            typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, delegate>::value>::type>
+  delegate(F f) : _storage{}, _call{&call<F>} {
+    static_assert(sizeof(F) <= CAPACITY, "callable is too big for a delegate, capture a pointer to a struct instead");
+    static_assert(alignof(F) <= alignof(void *), "callable is over aligned for a delegate");
+    static_assert(std::is_trivially_copyable<F>::value && std::is_trivially_destructible<F>::value,
+                  "delegates copy callables byte for byte, so they can't own anything");
+    new (_storage) F(f);
+  }
+
+  // A member function on an object that outlives the delegate
+  template <class T, R (T::*_method)(Args...)> static delegate bind(T *obj) {
+    return delegate([obj](Args... args) -> R { return (obj->*_method)(args...); });
+  }
+
+  // Like a lambda, a mutable callable can change its captures from a const delegate
+  R operator()(Args... args) const { return _call(_storage, args...); }
+  explicit operator bool() const { return _call != nullptr; }
+
+private:
+  alignas(void *) mutable unsigned char _storage[CAPACITY];
+  R (*_call)(void *, Args...);
+
+  template <class F> static R call(void *storage, Args... args) { return (*static_cast<F *>(storage))(args...); }
+};
+
+// Subscribers for each packet type. Every type has the index of its first subscriber, and subscribers are chained
+// through a fixed pool of _slots nodes. Dispatch is one lookup into the 256 entry head table and a walk of what's
+// subscribed to that type, usually one or none.
+//
+// There's no lock, so subscribe before the receiving task starts dispatching. clear() unlinks a type before freeing its
+// slots and dispatch() skips empty ones, so a reader caught part way through never calls a cleared callback.
+template <class _view_t, std::size_t _slots> class dispatch_table {
+  static_assert(_slots < 0xFFu, "slot indexes are a byte, with 0xFF meaning none");
+
+public:
+  using callback = delegate<void(_view_t &)>;
+
+  dispatch_table() {
+    _head.fill(NONE);
+    for (auto i = 0u; i < _slots; i++) {
+      _nodes[i].next = i + 1u < _slots ? i + 1u : NONE;
+    }
+    _free = 0u;
+  }
+  ~dispatch_table() = default;
+
+  // Returns false when every slot is taken
+  bool subscribe(uint8_t type, callback cb) {
+    if (_free == NONE || !cb) { return false; }
+    auto i = _free;
+    _free = _nodes[i].next;
+    _nodes[i].cb = cb;
+    _nodes[i].next = NONE;
+
+    // Added at the end so subscribers are called in the order they subscribed
+    auto *link = &_head[type];
+    while (*link != NONE) {
+      link = &_nodes[*link].next;
+    }
+    *link = i;
+    return true;
+  }
+
+  // Remove everything subscribed to a type
+  void clear(uint8_t type) {
+    auto i = _head[type];
+    _head[type] = NONE;
+    while (i != NONE) {
+      auto next = _nodes[i].next;
+      _nodes[i].cb = nullptr;
+      _nodes[i].next = _free;
+      _free = i;
+      i = next;
+    }
+  }
+
+  bool has(uint8_t type) const { return _head[type] != NONE; }
+
+  // Each subscriber gets its own copy of the view, so what one reads doesn't move the others. Returns how many ran.
+  std::size_t dispatch(uint8_t type, const _view_t &view) const {
+    std::size_t count = 0u;
+    for (auto i = _head[type]; i != NONE; i = _nodes[i].next) {
+      const auto cb = _nodes[i].cb;
+      if (!cb) { continue; }
+      auto v = view;
+      cb(v);
+      count++;
+    }
+    return count;
+  }
+
+private:
+  static constexpr const uint8_t NONE = 0xFFu;
+
+  struct node {
+    callback cb;
+    uint8_t next;
+  };
+
+  std::array<uint8_t, 256> _head;
+  std::array<node, _slots> _nodes;
+  uint8_t _free;
+};
+
+}; // namespace vesc
@@ -0,0 +1,52 @@
+#pragma once
+
+// Frames built at compile time. Requests that never change, like asking for the firmware version, can be stored as a
+// finished frame with the CRC already in it and handed straight to the transport.
+//
+// static constexpr auto FW_VERSION = vesc::make_frame(COMM_FW_VERSION);
+// tx(FW_VERSION.data(), FW_VERSION.size());
+//
+// The same functions work at runtime for frames that depend on a value only known at startup, like a CAN id.
+
+#include "crc_tables.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace vesc {
+
+// Start byte and length, then the CRC and the end byte. Payloads over 255 bytes need a two byte length.
+template <std::size_t _len> constexpr std::size_t frame_size() { return _len + (_len > 255u ? 6u : 5u); }
+
+template <std::size_t _len> using frame = std::array<uint8_t, frame_size<_len>()>;
+
+template <std::size_t _len> constexpr frame<_len> make_frame(const std::array<uint8_t, _len> &payload) {
+  static_assert(_len <= 0xFFFFu, "Payload is too long for a frame");
+  frame<_len> f{};
+  std::size_t i = 0u;
+  if (_len > 255u) {
+    f[i++] = 0x03;
+    f[i++] = static_cast<uint8_t>(_len >> 8);
+  } else {
+    f[i++] = 0x02;
+  }
+  f[i++] = static_cast<uint8_t>(_len);
+
+  uint16_t crc = 0u;
+  for (auto b : payload) {
+    crc = crc::update(crc, b);
+    f[i++] = b;
+  }
+
+  f[i++] = static_cast<uint8_t>(crc >> 8);
+  f[i++] = static_cast<uint8_t>(crc);
+  f[i++] = 0x03;
+  return f;
+}
+
+// Takes the payload bytes as arguments: make_frame(COMM_FORWARD_CAN, id, COMM_GET_VALUES)
+template <class... T> constexpr frame<sizeof...(T)> make_frame(T... bytes) {
+  return make_frame(std::array<uint8_t, sizeof...(T)>{{static_cast<uint8_t>(bytes)...}});
+}
+
+}; // namespace vesc
@@ -0,0 +1,178 @@
+#pragma once
+
+// Pulls frames out of a byte stream that can have garbage in it. A frame that arrives broken (bad start byte, bad CRC,
+// no end byte) costs only its own bytes: the framer skips ahead to the next possible start byte and keeps going,
+// instead of throwing away everything that was buffered behind it.
+//
+// Frames over PACKET_MAX_PL_LEN, like COMM_GET_MCCONF replies, don't fit in the receive ring. Their payload is moved
+// into a separate buffer as the notifications come in, hashing it on the way, so the ring only ever holds one
+// notification's worth of it. That buffer is allocated the first time it's needed, at LARGE_FRAME_MAX_PL_LEN so it's
+// never reallocated, and comes from PSRAM on boards that have it.
+//
+// Once a large frame's bytes are out of the ring they can't be scanned again, so a start byte in garbage that happened
+// to claim a big length would take up to 16 KB of good frames with it. Large frames are only accepted while
+// allow_large() is on, which should be while a configuration has been asked for, and only for configuration replies.
+//
+// Has the same validate()/payload()/consume() as basic_packet, so controller::parse_command() takes either.
+
+#include "crc.h"
+#include "datatypes.h"
+#include "packet.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(ARDUINO) && defined(BOARD_HAS_PSRAM)
+#include <esp_heap_caps.h>
+#endif
+
+namespace vesc {
+
+struct framer_stats {
+  uint32_t frames;        // Valid frames found
+  uint32_t large_frames;  // How many of those were over PACKET_MAX_PL_LEN
+  uint32_t bad_start;     // Frames with a bad start byte, an impossible length or a large frame that wasn't allowed
+  uint32_t invalid_crc;   // Frames with a CRC that didn't match
+  uint32_t bad_end;       // Frames without the end byte
+  uint32_t resyncs;       // Times the framer had to skip ahead to find a frame
+  uint32_t bytes_dropped; // Bytes skipped doing that
+  uint32_t bytes_lost;    // Bytes that didn't fit in the receive buffer
+  uint32_t no_memory;     // Large frames skipped because their buffer couldn't be allocated
+};
+
+class framer : public packet_base {
+public:
+  framer() : _stats{}, _allow_large{false}, _large{nullptr}, _large_len{}, _large_have{}, _large_crc{} {}
+  ~framer() { free(_large); }
+  framer(const framer &) = delete;
+  framer &operator=(const framer &) = delete;
+
+  // Add newly received bytes. Returns how many fit.
+  size_t append(const uint8_t *data, size_t len) {
+    size_t added = _packet.data().append(data, len);
+    _stats.bytes_lost += len - added;
+    return added;
+  }
+
+  // Like basic_packet::validate(), but never stops at a bad frame. Returns VALID when payload() has the next good
+  // frame, or INCOMPLETE once there isn't a whole frame left.
+  VALIDATE_RESULT validate() {
+    while (true) {
+      auto res = _large_len ? validate_large() : _packet.validate();
+      switch (res) {
+      case VALIDATE_RESULT::VALID: _stats.frames++; return res;
+      case VALIDATE_RESULT::INCOMPLETE: _packet.clean(); return res;
+      case VALIDATE_RESULT::TOO_LARGE: {
+        // Need the command byte after the header to tell if it's really a large frame
+        const size_t header = _packet.data().peek<uint8_t>();
+        if (_packet.len() <= header) { return VALIDATE_RESULT::INCOMPLETE; }
+        if (!_allow_large || !is_large_command(_packet.data().peek<uint8_t>(header))) {
+          _stats.bad_start++;
+          break;
+        }
+        if (start_large()) { continue; }
+        _stats.no_memory++;
+        break;
+      }
+      case VALIDATE_RESULT::BAD_START: _stats.bad_start++; break;
+      case VALIDATE_RESULT::INVALID_CRC: _stats.invalid_crc++; break;
+      case VALIDATE_RESULT::BAD_END: _stats.bad_end++; break;
+      }
+      // A large frame's payload has already left the ring, so there's nothing in it to scan
+      if (_large_len) {
+        _large_len = 0u;
+        continue;
+      }
+      _stats.resyncs++;
+      _stats.bytes_dropped += _packet.resync();
+    }
+  }
+
+  packet_view payload() { return _large_len ? packet_view(_large, _large_len) : _packet.payload(); }
+
+  void consume() {
+    if (_large_len) {
+      // Only the CRC and end byte are left in the ring
+      _packet.skip(3u);
+      _large_len = 0u;
+    } else {
+      _packet.consume();
+    }
+  }
+
+  ring_buffer<RX_RING_LEN> &data() { return _packet.data(); }
+  const size_t len() { return _packet.len(); }
+  const size_t valid_len() { return _large_len ? _large_len : _packet.valid_len(); }
+
+  void reset() {
+    _packet.reset();
+    _large_len = 0u;
+  }
+
+  // Whether frames over PACKET_MAX_PL_LEN are accepted, see the top of the file
+  void allow_large(bool allow) { _allow_large = allow; }
+
+  const framer_stats &stats() const { return _stats; }
+  void clear_stats() { _stats = framer_stats{}; }
+
+private:
+  rx_packet _packet;
+  framer_stats _stats;
+  bool _allow_large;
+
+  // The large frame being put back together, _large_have of its _large_len byte payload are here
+  uint8_t *_large;
+  size_t _large_len;
+  size_t _large_have;
+  uint16_t _large_crc;
+
+  static bool is_large_command(uint8_t command) {
+    switch (command) {
+    case COMM_GET_MCCONF:
+    case COMM_GET_MCCONF_DEFAULT:
+    case COMM_GET_APPCONF:
+    case COMM_GET_APPCONF_DEFAULT: return true;
+    default: return false;
+    }
+  }
+
+  static uint8_t *allocate_large() {
+#if defined(ARDUINO) && defined(BOARD_HAS_PSRAM)
+    auto p = heap_caps_malloc(LARGE_FRAME_MAX_PL_LEN, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (p) { return static_cast<uint8_t *>(p); }
+#endif
+    return static_cast<uint8_t *>(malloc(LARGE_FRAME_MAX_PL_LEN));
+  }
+
+  // Take over the frame at the head of the ring, which validate() said is too large for it
+  bool start_large() {
+    if (!_large) { _large = allocate_large(); }
+    if (!_large) { return false; }
+    _large_len = _packet.header_len();
+    _large_have = 0u;
+    _large_crc = 0u;
+    _packet.skip(_packet.data().peek<uint8_t>());
+    _stats.large_frames++;
+    return true;
+  }
+
+  // Move whatever has arrived of the payload out of the ring, then check the CRC and end byte once they're in
+  VALIDATE_RESULT validate_large() {
+    auto &ring = _packet.data();
+    const auto count = std::min(ring.len(), _large_len - _large_have);
+    if (count) {
+      std::memcpy(_large + _large_have, ring.begin(), count);
+      _large_crc = crc16_update(_large_crc, ring.begin(), count);
+      _large_have += count;
+      _packet.skip(count);
+    }
+
+    constexpr auto crc_end_bytes = 3u;
+    if (_large_have < _large_len || ring.len() < crc_end_bytes) { return VALIDATE_RESULT::INCOMPLETE; }
+    if (ring.peek<uint16_t>() != _large_crc) { return VALIDATE_RESULT::INVALID_CRC; }
+    if (ring.peek<uint8_t>(2u) != 3u) { return VALIDATE_RESULT::BAD_END; }
+    return VALIDATE_RESULT::VALID;
+  }
+};
+
+}; // namespace vesc
@@ -0,0 +1,239 @@
+#pragma once
+
+// Recent history for one vesc, a few chosen values over time, so graphs, loggers and anything watching for trouble
+// can all read the same samples instead of each keeping their own. Raw samples are kept for as long as _raw of them
+// cover, and the min, max and mean of each channel over every second and every ten seconds for longer.
+//
+// Everything is allocated once, in PSRAM when the board has it. Each level is a ring with one array per channel, so a
+// graph of one channel reads one run of floats. Like ring_buffer every sample is written twice, once at its index and
+// once a capacity later, so any window of samples is a single pointer per channel even when it wraps.
+//
+// Samples are added from the receiving task while others read windows straight out of the rings without copying. Only
+// the oldest sample is ever overwritten, so a window stays good as long as the writer doesn't lap it. intact() says
+// whether it did, checked after the window's been used like a snapshot's sequence.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(ARDUINO) && defined(BOARD_HAS_PSRAM)
+#include <esp_heap_caps.h>
+#endif
+
+namespace vesc {
+
+enum class resolution : uint8_t {
+  RAW,
+  SECOND,      // Rollups of every second
+  TEN_SECONDS, // Rollups of every ten seconds
+};
+
+// A run of consecutive samples or rollups, oldest first, pointing straight into a history
+class history_window {
+public:
+  history_window() : _time{nullptr}, _values{nullptr}, _pitch{0u}, _stat{0u}, _len{0u}, _level{0u}, _first{0u} {}
+
+  std::size_t size() const { return _len; }
+  bool empty() const { return !_len; }
+
+  // When each sample was taken, or when each rollup's first sample was
+  const uint32_t *time() const { return _time; }
+  // A raw sample is its own min, max and mean, so the same code can draw any resolution
+  const float *min(std::size_t channel) const { return _values + channel * _pitch; }
+  const float *max(std::size_t channel) const { return _values + (channel + _stat) * _pitch; }
+  const float *mean(std::size_t channel) const { return _values + (channel + 2u * _stat) * _pitch; }
+
+private:
+  template <std::size_t, std::size_t, std::size_t, std::size_t> friend class history;
+
+  const uint32_t *_time;
+  const float *_values;
+  std::size_t _pitch; // Floats from one column to the next
+  std::size_t _stat;  // Columns from min to max to mean, 0 for raw samples
+  std::size_t _len;
+  uint8_t _level;
+  uint32_t _first; // Count of the first sample, to tell if it's been overwritten
+};
+
+// _channels values per sample. _raw samples, _seconds one second rollups and _tens ten second rollups are kept.
+template <std::size_t _channels, std::size_t _raw, std::size_t _seconds = 60u, std::size_t _tens = 60u> class history {
+  static_assert(_channels && _raw > 1u && _seconds > 1u && _tens > 1u, "every level needs room for a window");
+
+public:
+  using sample = std::array<float, _channels>;
+  using window = history_window;
+
+  static constexpr const uint32_t SECOND_US = 1000000u;
+
+  // Memory it needs, every level's times and columns twice over
+  static constexpr std::size_t bytes() {
+    return 2u * sizeof(float) * (_raw * (1u + _channels) + (_seconds + _tens) * (1u + 3u * _channels));
+  }
+
+  history() : _memory{allocate(bytes())}, _second{}, _ten{} {
+    auto *p = static_cast<uint32_t *>(_memory);
+    p = _levels[0].init(p, _raw, _channels);
+    p = _levels[1].init(p, _seconds, 3u * _channels);
+    _levels[2].init(p, _tens, 3u * _channels);
+  }
+  ~history() { std::free(_memory); }
+  history(const history &) = delete;
+  history &operator=(const history &) = delete;
+
+  // False if there wasn't the memory for it
+  explicit operator bool() const { return _memory != nullptr; }
+
+  // From the one task that writes it, with times that only go forward
+  void add(uint32_t time_us, const sample &s) {
+    if (!_memory) { return; }
+    _levels[0].push(time_us, s.data());
+    if (_second.count && time_us - _second.start >= SECOND_US) {
+      // A second is never split across ten second rollups
+      if (_ten.count && _second.start - _ten.start >= 10u * SECOND_US) { close(_ten, _levels[2]); }
+      _ten.merge(_second);
+      close(_second, _levels[1]);
+    }
+    _second.add(time_us, s);
+  }
+
+  // Everything from from_us to to_us, as far back as the level goes
+  window range(resolution r, uint32_t from_us, uint32_t to_us) const {
+    const auto &l = _levels[static_cast<uint8_t>(r)];
+    const auto count = l.count.load(std::memory_order_acquire);
+    const auto n = std::min<uint32_t>(count, l.capacity - 1u);
+    const auto *start = l.time + (count - n) % l.capacity;
+    // Times wrap, so they're compared by how far apart they are
+    const auto *begin =
+        std::partition_point(start, start + n, [&](uint32_t t) { return static_cast<int32_t>(t - from_us) < 0; });
+    const auto *end =
+        std::partition_point(begin, start + n, [&](uint32_t t) { return static_cast<int32_t>(t - to_us) <= 0; });
+    return make_window(r, count - n + (begin - start), end - begin);
+  }
+
+  // The newest n samples or rollups, or as many as there are
+  window last(resolution r, std::size_t n) const {
+    const auto &l = _levels[static_cast<uint8_t>(r)];
+    const auto count = l.count.load(std::memory_order_acquire);
+    n = std::min<std::size_t>(n, std::min<std::size_t>(count, l.capacity - 1u));
+    return make_window(r, count - n, n);
+  }
+
+  // False if samples were added over the window while it was being read
+  bool intact(const window &w) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _levels[w._level].count.load(std::memory_order_relaxed) - w._first < _levels[w._level].capacity;
+  }
+
+  // How many samples or rollups there have been at a resolution
+  uint32_t count(resolution r) const { return _levels[static_cast<uint8_t>(r)].count.load(std::memory_order_acquire); }
+
+  // Start over, only when nothing's reading
+  void clear() {
+    for (auto &l : _levels) {
+      l.count.store(0u, std::memory_order_release);
+    }
+    _second = bucket{};
+    _ten = bucket{};
+  }
+
+private:
+  // One level's ring, times first then each column, each twice its capacity long
+  struct level {
+    uint32_t *time;
+    float *values;
+    std::size_t capacity;
+    std::size_t columns;
+    std::atomic<uint32_t> count;
+
+    uint32_t *init(uint32_t *p, std::size_t cap, std::size_t cols) {
+      capacity = cap;
+      columns = cols;
+      count.store(0u, std::memory_order_relaxed);
+      time = p;
+      values = reinterpret_cast<float *>(p + 2u * cap);
+      return p + 2u * cap * (1u + cols);
+    }
+
+    void push(uint32_t t, const float *v) {
+      const auto c = count.load(std::memory_order_relaxed);
+      const auto i = c % capacity;
+      time[i] = time[i + capacity] = t;
+      for (auto col = 0u; col < columns; col++) {
+        auto *column = values + col * 2u * capacity;
+        column[i] = column[i + capacity] = v[col];
+      }
+      count.store(c + 1u, std::memory_order_release);
+    }
+  };
+
+  // A rollup being added up
+  struct bucket {
+    uint32_t start;
+    uint32_t count;
+    sample min;
+    sample max;
+    sample sum;
+
+    void add(uint32_t t, const sample &s) {
+      if (!count) { start = t; }
+      for (auto i = 0u; i < _channels; i++) {
+        min[i] = count ? std::min(min[i], s[i]) : s[i];
+        max[i] = count ? std::max(max[i], s[i]) : s[i];
+        sum[i] = count ? sum[i] + s[i] : s[i];
+      }
+      count++;
+    }
+
+    void merge(const bucket &b) {
+      if (!count) { start = b.start; }
+      for (auto i = 0u; i < _channels; i++) {
+        min[i] = count ? std::min(min[i], b.min[i]) : b.min[i];
+        max[i] = count ? std::max(max[i], b.max[i]) : b.max[i];
+        sum[i] = count ? sum[i] + b.sum[i] : b.sum[i];
+      }
+      count += b.count;
+    }
+  };
+
+  void *_memory;
+  std::array<level, 3u> _levels;
+  bucket _second;
+  bucket _ten;
+
+  static void *allocate(std::size_t size) {
+#if defined(ARDUINO) && defined(BOARD_HAS_PSRAM)
+    if (auto *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)) { return p; }
+#endif
+    return std::malloc(size);
+  }
+
+  static void close(bucket &b, level &l) {
+    std::array<float, 3u * _channels> columns;
+    for (auto i = 0u; i < _channels; i++) {
+      columns[i] = b.min[i];
+      columns[_channels + i] = b.max[i];
+      columns[2u * _channels + i] = b.sum[i] / b.count;
+    }
+    l.push(b.start, columns.data());
+    b = bucket{};
+  }
+
+  window make_window(resolution r, uint32_t first, std::size_t n) const {
+    const auto &l = _levels[static_cast<uint8_t>(r)];
+    const auto i = first % l.capacity;
+    window w;
+    w._time = l.time + i;
+    w._values = l.values + i;
+    w._pitch = 2u * l.capacity;
+    w._stat = r == resolution::RAW ? 0u : _channels;
+    w._len = n;
+    w._level = static_cast<uint8_t>(r);
+    w._first = first;
+    return w;
+  }
+};
+
+}; // namespace vesc
@@ -0,0 +1,11 @@
+#pragma once
+
+// Logging for the library. Goes out the serial port on the board and nowhere on native builds, so the controller can
+// be tested without the Arduino core.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define VESC_LOG(...) Serial.printf(__VA_ARGS__)
+#else
+#define VESC_LOG(...) ((void)0)
+#endif
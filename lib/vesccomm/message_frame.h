@@ -0,0 +1,62 @@
+#pragma once
+
+// A finished frame for a fixed size message that gets sent over and over with new values, like the setpoints on the
+// control path. The start byte, length, any prefix (COMM_FORWARD_CAN and an id) and the end byte never change, and
+// the CRC of the prefix is worked out once. Changing the value only rewrites the message bytes and hashes those,
+// instead of building a packet and hashing the whole payload every time.
+
+#include "byte_order.h"
+#include "crc.h"
+#include "frame.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace vesc {
+
+// M is a schema::message with fixed size fields. _prefix bytes go in front of it in the payload.
+template <class M, std::size_t _prefix = 0u> class message_frame {
+public:
+  static constexpr const std::size_t PAYLOAD_LEN = _prefix + 1u + M::size;
+  static_assert(PAYLOAD_LEN <= 255u, "only short frames can be patched in place");
+
+  explicit message_frame(const std::array<uint8_t, _prefix> &prefix = {}) : _frame{}, _prefix_crc{} {
+    std::array<uint8_t, PAYLOAD_LEN> payload{};
+    std::copy(prefix.begin(), prefix.end(), payload.begin());
+    _frame = make_frame(payload);
+    _prefix_crc = crc16_update(0u, prefix.data(), _prefix);
+    set(typename M::type{});
+  }
+  ~message_frame() = default;
+
+  // Write new values into the frame and fix up the CRC
+  void set(const typename M::type &msg) {
+    writer w{&_frame[HEADER + _prefix]};
+    M::encode(w, msg);
+    endian::store<uint16_t>(&_frame[HEADER + PAYLOAD_LEN],
+                            crc16_update(_prefix_crc, &_frame[HEADER + _prefix], 1u + M::size));
+  }
+
+  const uint8_t *data() const { return _frame.data(); }
+  constexpr std::size_t size() const { return _frame.size(); }
+  const frame<PAYLOAD_LEN> &get() const { return _frame; }
+
+private:
+  // Start byte and one byte of length
+  static constexpr const std::size_t HEADER = 2u;
+
+  // Just enough of a buffer for the schema to write into
+  struct writer {
+    uint8_t *p;
+    template <class T> void append(T val) {
+      endian::store(p, val);
+      p += sizeof(T);
+    }
+  };
+
+  frame<PAYLOAD_LEN> _frame;
+  uint16_t _prefix_crc;
+};
+
+}; // namespace vesc
@@ -0,0 +1,79 @@
+#pragma once
+
+// The vescs on the CAN bus behind the one the remote talks to, found by COMM_PING_CAN or by asking one of them for
+// something. Looked up by CAN id with one index into a 256 entry table, like dispatch_table, and kept in the order
+// they were found so pollers can take turns across them.
+//
+// Nodes are only ever added, from either task: the receiving task as replies come in and the sending task when it asks
+// one for something. Adding takes a lock so two tasks can't fill the same entry, and an entry is filled in before its
+// index and the count that make it visible are published, so lookups and walks don't need the lock and never see one
+// half made.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace vesc {
+
+// T is constructed from its CAN id and has an id member
+template <class T, std::size_t _max> class node_table {
+  static_assert(_max < 0xFFu, "node indexes are a byte, with 0xFF meaning none");
+
+public:
+  node_table() : _nodes{}, _count{0u} { clear(); }
+  ~node_table() = default;
+  node_table(const node_table &) = delete;
+  node_table &operator=(const node_table &) = delete;
+
+  T *find(int id) {
+    if (id < 0 || id > 0xFF) { return nullptr; }
+    const auto i = _index[id].load(std::memory_order_acquire);
+    return i == NONE ? nullptr : &_nodes[i];
+  }
+  const T *find(int id) const { return const_cast<node_table *>(this)->find(id); }
+
+  // The node for id, added if it's new. nullptr when the table is full.
+  T *add(int id) {
+    if (id < 0 || id > 0xFF) { return nullptr; }
+    if (auto *n = find(id)) { return n; }
+    std::lock_guard<std::mutex> lock(_mutex);
+    // Someone else may have added it while this waited for the lock
+    if (auto *n = find(id)) { return n; }
+    const auto count = _count.load(std::memory_order_relaxed);
+    if (count == _max) { return nullptr; }
+    _nodes[count] = T(id);
+    _index[id].store(count, std::memory_order_release);
+    _count.store(count + 1u, std::memory_order_release);
+    return &_nodes[count];
+  }
+
+  // Forget every node, only when nothing else is looking at them
+  void clear() {
+    for (auto &i : _index) {
+      i.store(NONE, std::memory_order_relaxed);
+    }
+    _count.store(0u, std::memory_order_release);
+  }
+
+  std::size_t size() const { return _count.load(std::memory_order_acquire); }
+  static constexpr std::size_t capacity() { return _max; }
+
+  T &operator[](std::size_t i) { return _nodes[i]; }
+  const T &operator[](std::size_t i) const { return _nodes[i]; }
+  T *begin() { return _nodes.data(); }
+  T *end() { return _nodes.data() + size(); }
+  const T *begin() const { return _nodes.data(); }
+  const T *end() const { return _nodes.data() + size(); }
+
+private:
+  static constexpr const uint8_t NONE = 0xFFu;
+
+  std::array<T, _max> _nodes;
+  std::array<std::atomic<uint8_t>, 256> _index;
+  std::atomic<uint8_t> _count;
+  std::mutex _mutex;
+};
+
+}; // namespace vesc
@@ -1,53 +1,71 @@
 #pragma once
 
 #include "buffer.h"
+#include "packet_view.h"
+#include "pool.h"
+#include "ring_buffer.h"
 #include <functional>
 #include <map>
 
 namespace vesc {
 
+// Receive storage for a byte stream. Big enough for a full packet plus the start of the next one.
+constexpr const auto RX_RING_LEN = 1024u;
+
+// Longest payload accepted at all. Anything over PACKET_MAX_PL_LEN, like a motor configuration, is too big for a
+// packet and is put back together by the framer instead.
+constexpr const auto LARGE_FRAME_MAX_PL_LEN = 16u * 1024u;
+
+// Shared by every kind of packet so the results compare across storage types
+struct packet_base {
+  // TOO_LARGE is a good header for a frame over PACKET_MAX_PL_LEN, left at the head of the buffer
+  enum class VALIDATE_RESULT { VALID, INCOMPLETE, BAD_START, INVALID_CRC, BAD_END, TOO_LARGE };
+
+  // Frames start with 2, 3 or 4, followed by that many bytes of length minus one
+  static constexpr bool is_start(uint8_t b) { return b >= 2u && b <= 4u; }
+};
+
 // This ended up really ugly. Not how I usually like to parse packets from a stream.
 
 // Warning, this will put 520ish bytes onto the stack. Make sure any thread using this function has plenty of stack
-// space
+// space, or borrow one from a packet_pool
 // TODO could use stream operators to make it simple to inject these values
-class packet {
+// _buffer_t is where the bytes live, a linear buffer for building packets or a ring_buffer for receiving them
+template <class _buffer_t> class basic_packet : public packet_base {
 public:
-  enum class VALIDATE_RESULT { VALID, INCOMPLETE, BAD_START, INVALID_CRC, BAD_END };
-
   // Default constructor
-  packet() = default;
+  basic_packet() = default;
 
   // Constructor that takes in a buffer, or anything that has begin and end and a len() function
-  template <class T> packet(T buffer) { construct(buffer); }
-  packet(uint8_t *mdata, size_t mlen) { _buffer.append(mdata, mlen); }
-  ~packet() = default;
+  template <class T> basic_packet(T buffer) { construct(buffer); }
+  basic_packet(uint8_t *mdata, size_t mlen) { _buffer.append(mdata, mlen); }
+  ~basic_packet() = default;
 
   // Take in a buffer and insert it. Assumes that input has begin() and end(), should work with most stl containers
   // using a uint8_t type element
   template <class T> void construct(T buffer) {
     // Not SFINAE?
 
-    // Set up the first byte to tell if this buffer is greater than 256
+    // Set up the first byte to tell if this buffer is too long for a one byte length
     auto mlen = std::distance(buffer.begin(), buffer.end());
-    if (mlen > 256) {
-      _buffer.append<uint8_t>(0x03);
-      _buffer.append<uint16_t>(mlen);
+    if (mlen > 255) {
+      _buffer.template append<uint8_t>(0x03);
+      _buffer.template append<uint16_t>(mlen);
     } else {
-      _buffer.append<uint8_t>(0x02);
-      _buffer.append<uint8_t>(mlen);
+      _buffer.template append<uint8_t>(0x02);
+      _buffer.template append<uint8_t>(mlen);
     }
 
     // Copy the buffer
     _buffer.copy(buffer);
     // Insert the CRC
-    _buffer.append<uint16_t>(buffer.crc());
+    _buffer.template append<uint16_t>(buffer.crc());
     // Add the final byte
-    _buffer.append<uint8_t>(0x03);
+    _buffer.template append<uint8_t>(0x03);
   }
 
   // Used for reading out the data
-  buffer<PACKET_MAX_LEN> &data() { return _buffer; }
+  _buffer_t &data() { return _buffer; }
 
   // Returns how much data is in 
   const size_t len() { return _buffer.len(); }
@@ -59,40 +77,76 @@ public:
 
   // If validate returns true, it is ready to parse
   // If validate returns false, it is missing data or not valid
-  // After validating the packet, we'll trim out everything except the payload
+  // After validating the packet, the head is left at the start of the payload
+  // A frame that arrives in pieces is hashed as it comes in, so calling this after every notification only runs the
+  // CRC over the new bytes
   VALIDATE_RESULT validate() {
-    auto start = _buffer.get<uint8_t>();
-    auto mlen = 0u;
-    if (start == 2u) {
-      mlen = _buffer.get<uint8_t>();
-    } else if (start == 3u) {
-      mlen = _buffer.get<uint16_t>();
-    } else {
-      return VALIDATE_RESULT::BAD_START;
+    if (_buffer.len() < 1u) { return VALIDATE_RESULT::INCOMPLETE; }
+
+    auto start = _buffer.template peek<uint8_t>();
+    if (!is_start(start)) { return VALIDATE_RESULT::BAD_START; }
+
+    // Start byte plus one, two or three bytes of length
+    const size_t header = start;
+    if (_buffer.len() < header) { return VALIDATE_RESULT::INCOMPLETE; }
+    const size_t mlen = header_len();
+    // The vesc never sends an empty payload or more than it can buffer, so this isn't really a start byte. Without
+    // this a bad length could have us waiting on bytes that are never coming.
+    if (mlen == 0u || mlen > LARGE_FRAME_MAX_PL_LEN) { return VALIDATE_RESULT::BAD_START; }
+    if (mlen > PACKET_MAX_PL_LEN) { return VALIDATE_RESULT::TOO_LARGE; }
+
+    // Pick up the CRC where the last call left off. Start over if this isn't the frame we were hashing.
+    const auto available = std::min<size_t>(_buffer.len() - header, mlen);
+    if (mlen != _crc_mlen || available < _crc_len) {
+      reset_crc();
+      _crc_mlen = mlen;
     }
+    if (available > _crc_len) {
+      _crc = _buffer.crc(header + _crc_len, available - _crc_len, _crc);
+      _crc_len = available;
+    }
+
+    constexpr auto crc_end_bytes = 3u;
+    if (_buffer.len() < header + mlen + crc_end_bytes) {
+      // Not good! Something didn't add up
+      return VALIDATE_RESULT::INCOMPLETE;
+    }
+
+    // This frame is finished one way or another
+    const auto calc_crc = _crc;
+    reset_crc();
+
+    if (_buffer.template peek<uint16_t>(header + mlen) != calc_crc) { return VALIDATE_RESULT::INVALID_CRC; }
+    if (_buffer.template peek<uint8_t>(header + mlen + 2u) != 3u) { return VALIDATE_RESULT::BAD_END; }
+
+    _buffer.advance(header);
+    _mlen = mlen;
+    return VALIDATE_RESULT::VALID;
+  }
+
+  // The payload of the frame validate() just passed
+  packet_view payload() { return packet_view(&*_buffer.begin(), _mlen); }
 
+  // Done with the frame validate() just passed, drop its payload, CRC and end byte
+  void consume() {
     constexpr auto crc_end_bytes = 3u;
-    if (_buffer.len() >= mlen + crc_end_bytes) {
-      auto calc_crc = crc16(_buffer + start, mlen);
-      _buffer.advance(mlen);
-      auto crc = _buffer.get<uint16_t>();
-      if (crc == calc_crc) {
-        if (_buffer.get<uint8_t>() == 3u) {
-          _buffer.reload();
-          _buffer.advance(start);
-          _mlen = mlen;
-          return VALIDATE_RESULT::VALID;
-        } else {
-          return VALIDATE_RESULT::BAD_END;
-        }
-      } else {
-        return VALIDATE_RESULT::INVALID_CRC;
-      }
+    _buffer.advance(_mlen + crc_end_bytes);
+    _buffer.clean();
+  }
+
+  // Payload length from the header at the head of the buffer, once all of the header is there
+  size_t header_len() const {
+    switch (_buffer.template peek<uint8_t>()) {
+    case 2u: return _buffer.template peek<uint8_t>(1u);
+    case 3u: return _buffer.template peek<uint16_t>(1u);
+    default: return (static_cast<size_t>(_buffer.template peek<uint16_t>(1u)) << 8) | _buffer.template peek<uint8_t>(3u);
     }
+  }
 
-    _buffer.reload();
-    // Not good! Something didn't add up
-    return VALIDATE_RESULT::INCOMPLETE;
+  // Drop bytes off the front that someone else is handling, like the header of a large frame
+  void skip(size_t count) {
+    reset_crc();
+    _buffer.advance(count);
   }
 
   void clear_crc() {
@@ -105,9 +159,47 @@ public:
     _buffer.clean();
   }
 
+  // After a bad frame, drop its start byte and skip ahead to the next byte that could start a frame. Returns how many
+  // bytes were thrown away. Any good frames behind the bad one are kept.
+  size_t resync() {
+    reset_crc();
+    if (_buffer.len() == 0u) { return 0u; }
+    auto next = std::find_if(_buffer.begin() + 1, _buffer.end(), is_start);
+    const size_t dropped = std::distance(_buffer.begin(), next);
+    _buffer.advance(dropped);
+    return dropped;
+  }
+
+  // Throw away everything received so far, including a partially hashed frame
+  void reset() {
+    _buffer.reset();
+    reset_crc();
+  }
+
 private:
-  buffer<PACKET_MAX_LEN> _buffer;
-  uint16_t _mlen;
+  _buffer_t _buffer;
+  uint16_t _mlen{};
+
+  // Running CRC of the frame at the head of the buffer, _crc_len bytes of its _crc_mlen byte payload are hashed
+  uint16_t _crc{};
+  size_t _crc_len{};
+  size_t _crc_mlen{};
+
+  void reset_crc() {
+    _crc = 0u;
+    _crc_len = 0u;
+    _crc_mlen = 0u;
+  }
 };
 
+// For building packets to send, and the copies handed to the packet handlers
+using packet = basic_packet<buffer<PACKET_MAX_LEN>>;
+
+// Packets for building frames to send, so they don't go on the stack of every task that sends something
+constexpr const auto PACKET_POOL_LEN = 4u;
+using packet_pool = pool<packet, PACKET_POOL_LEN>;
+
+// For receiving. Consuming a packet only moves the head of the ring, nothing gets copied.
+using rx_packet = basic_packet<ring_buffer<RX_RING_LEN>>;
+
 }; // namespace vesc
\ No newline at end of file
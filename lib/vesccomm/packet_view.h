@@ -0,0 +1,70 @@
+#pragma once
+
+// A read only window onto a payload that lives somewhere else, normally the receive buffer. Has the same read
+// functions as buffer, so handlers can decode straight out of the received bytes instead of copying the packet first.
+// The view is only good until the bytes it points at are consumed.
+
+#include "byte_order.h"
+#include "crc.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace vesc {
+
+class packet_view {
+public:
+  packet_view() : _head{nullptr}, _len{} {}
+  packet_view(const uint8_t *data, size_t len) : _head{data}, _len{len} {}
+  ~packet_view() = default;
+
+  const size_t len() const { return _len; }
+
+  // None of the getters check the length, use has() once for everything a message is about to read
+  bool has(size_t bytes) const { return _len >= bytes; }
+
+  template <class T> T get() {
+    auto val = endian::load<T>(_head);
+    _head += sizeof(T);
+    _len -= sizeof(T);
+    return val;
+  };
+
+  template <class T> T peek(size_t offset = 0u) const { return endian::load<T>(_head + offset); };
+
+  float getf() { return endian::decode_float(get<uint32_t>()); }
+
+  // Get a fixed point value
+  float getfp(size_t bytes, float scale) {
+    auto val = endian::load_fixed(_head, bytes);
+    _head += bytes;
+    _len -= bytes;
+    return static_cast<float>(val) / scale;
+  }
+
+  std::string get_string() {
+    auto res = std::find(_head, _head + _len, '\0');
+    if (res == _head + _len) { return "(Unknown)"; }
+    std::string ret(_head, res);
+    advance(ret.size() + 1u);
+    return ret;
+  }
+
+  uint16_t crc() const { return crc16_update(0u, _head, _len); }
+
+  void advance(size_t count) {
+    count = std::min(count, _len);
+    _head += count;
+    _len -= count;
+  }
+
+  const uint8_t *begin() const { return _head; }
+  const uint8_t *end() const { return _head + _len; }
+
+private:
+  const uint8_t *_head;
+  size_t _len;
+};
+
+}; // namespace vesc
@@ -0,0 +1,113 @@
+#pragma once
+
+// A fixed number of objects handed out and given back without locks or the heap. Meant for packets, which are too
+// big to keep creating on task stacks. Free slots are bits in one atomic word, so taking or returning one is a single
+// compare and swap, from any task.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace vesc {
+
+struct pool_stats {
+  uint32_t in_use;     // Slots handed out right now
+  uint32_t high_water; // Most slots ever handed out at once
+  uint32_t exhausted;  // Times acquire() came back empty
+};
+
+// T needs a reset() that puts it back the way it was constructed
+template <class T, std::size_t _count> class pool {
+  static_assert(_count > 0u && _count <= 32u, "pool slots are tracked in a 32 bit mask");
+
+public:
+  // Gives the slot back when it goes out of scope. Can be moved, not copied.
+  class handle {
+  public:
+    handle() : _pool{nullptr}, _item{nullptr} {}
+    handle(handle &&other) : _pool{other._pool}, _item{other._item} { other._item = nullptr; }
+    handle &operator=(handle &&other) {
+      if (this != &other) {
+        release();
+        _pool = other._pool;
+        _item = other._item;
+        other._item = nullptr;
+      }
+      return *this;
+    }
+    handle(const handle &) = delete;
+    handle &operator=(const handle &) = delete;
+    ~handle() { release(); }
+
+    explicit operator bool() const { return _item != nullptr; }
+    T &operator*() const { return *_item; }
+    T *operator->() const { return _item; }
+
+    void release() {
+      if (_item) {
+        _pool->release(_item);
+        _item = nullptr;
+      }
+    }
+
+  private:
+    friend class pool;
+    handle(pool *p, T *item) : _pool{p}, _item{item} {}
+
+    pool *_pool;
+    T *_item;
+  };
+
+  pool() : _free{ALL}, _high_water{0u}, _exhausted{0u} {}
+  ~pool() = default;
+  pool(const pool &) = delete;
+  pool &operator=(const pool &) = delete;
+
+  constexpr std::size_t capacity() const { return _count; }
+
+  // An empty handle when every slot is taken
+  handle acquire() {
+    auto free = _free.load(std::memory_order_relaxed);
+    uint32_t taken;
+    do {
+      if (!free) {
+        _exhausted.fetch_add(1u, std::memory_order_relaxed);
+        return handle{};
+      }
+      taken = free & (~free + 1u);
+    } while (!_free.compare_exchange_weak(free, free & ~taken, std::memory_order_acquire, std::memory_order_relaxed));
+
+    note_in_use(_count - __builtin_popcount(free & ~taken));
+    auto &item = _slots[__builtin_ctz(taken)];
+    item.reset();
+    return handle{this, &item};
+  }
+
+  pool_stats stats() const {
+    return {static_cast<uint32_t>(_count - __builtin_popcount(_free.load(std::memory_order_relaxed))),
+            _high_water.load(std::memory_order_relaxed), _exhausted.load(std::memory_order_relaxed)};
+  }
+
+private:
+  static constexpr const uint32_t ALL = _count == 32u ? 0xFFFFFFFFu : (1u << _count) - 1u;
+
+  std::array<T, _count> _slots;
+  std::atomic<uint32_t> _free;
+  std::atomic<uint32_t> _high_water;
+  std::atomic<uint32_t> _exhausted;
+
+  void release(T *item) {
+    const auto index = static_cast<uint32_t>(item - _slots.data());
+    _free.fetch_or(1u << index, std::memory_order_release);
+  }
+
+  void note_in_use(uint32_t in_use) {
+    auto high = _high_water.load(std::memory_order_relaxed);
+    while (in_use > high && !_high_water.compare_exchange_weak(high, in_use, std::memory_order_relaxed)) {
+    }
+  }
+};
+
+}; // namespace vesc
@@ -0,0 +1,318 @@
+#pragma once
+
+// Keeps track of requests that are waiting on a reply from a vesc, so the sender knows when an answer came and how
+// long it took instead of sleeping for a guessed time. Requests are keyed by the command the reply will carry and the
+// CAN id they went to, and several can be in flight at once, even for the same command. Each one can have a
+// completion called when it's answered, times out or is cancelled, or the sender can wait() for it.
+//
+// Requests are tracked from the task that sends them and answered from the one that receives, so everything here is
+// behind a mutex. Completions are called without it held, so they can send the next request.
+
+#include "dispatch.h"
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+namespace vesc {
+
+// Microseconds from some point in the past. Wraps after about 71 minutes, so times are only compared by subtracting.
+inline uint32_t micros_now() {
+#ifdef ARDUINO
+  return micros();
+#else
+  return static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+#endif
+}
+
+enum class request_status : uint8_t {
+  UNKNOWN,   // Never tracked, or so old its slot has been used again
+  PENDING,   // Still waiting on the reply
+  DONE,      // Answered
+  TIMED_OUT, // Not answered in time
+  CANCELLED, // Given up on by the sender, or dropped with the link. Nothing is known about the vesc from it.
+};
+
+struct request_result {
+  request_status status;
+  uint32_t rtt_us; // Time from sending to the reply, when it's DONE
+};
+
+// Round trip times for one command
+struct rtt_stats {
+  uint32_t count;    // Replies
+  uint32_t timeouts; // Requests that weren't answered in time
+  uint32_t last_us;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint32_t avg_us; // Moving average over roughly the last 8 replies
+};
+
+// Handed back for a request that was sent. Converts to false when it couldn't be sent or tracked.
+class request {
+public:
+  constexpr request() : _slot{NONE}, _gen{0u} {}
+
+  explicit operator bool() const { return _slot != NONE; }
+
+private:
+  template <std::size_t, std::size_t> friend class request_tracker;
+  constexpr request(uint8_t slot, uint8_t gen) : _slot{slot}, _gen{gen} {}
+
+  static constexpr const uint8_t NONE = 0xFFu;
+  uint8_t _slot;
+  uint8_t _gen;
+};
+
+// _slots requests in flight at once, RTT kept for up to _commands different commands
+template <std::size_t _slots, std::size_t _commands = 8u> class request_tracker {
+  static_assert(_slots < 0xFFu && _commands < 0xFFu, "slot indexes are a byte, with 0xFF meaning none");
+
+public:
+  static constexpr const int LOCAL = -1; // The vesc at the other end of the link, not forwarded over CAN
+  static constexpr const int ANY = -2;   // For a reply that doesn't say which vesc it came from
+  static constexpr const int UNASKED = -3; // What target() says when nothing was waiting for a reply
+
+  using completion = delegate<void(request_result)>;
+  // Told about every request that finishes, with the command and id it was for
+  using observer = delegate<void(uint8_t, int, request_result)>;
+
+  request_tracker() : _requests{}, _stats{}, _stats_used{0u}, _observer{} { _stat_index.fill(NONE); }
+  ~request_tracker() = default;
+  request_tracker(const request_tracker &) = delete;
+  request_tracker &operator=(const request_tracker &) = delete;
+
+  // Start waiting for a reply to command from id. Comes back false when every slot is waiting already, which is the
+  // sender's cue that the link is behind.
+  request track(uint8_t command, int id, uint32_t timeout_us, completion done = nullptr, uint32_t now = micros_now()) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto i = 0u; i < _slots; i++) {
+      auto &s = _requests[i];
+      if (s.status == request_status::PENDING) { continue; }
+      s = slot{command, static_cast<int16_t>(id), request_status::PENDING, static_cast<uint8_t>(s.gen + 1u), now,
+               timeout_us, 0u, done};
+      stats_for(command);
+      return request(i, s.gen);
+    }
+    return request();
+  }
+
+  // A reply to command came in from id. Answers the oldest request to that id, or the oldest one to the local vesc if
+  // none went to that id, since the local vesc replies with its own id. ANY answers the oldest for the command.
+  // An exact reply is from a vesc known to be on the CAN bus, so it never answers one to the local vesc.
+  // Returns false if nothing was waiting for it.
+  bool complete(uint8_t command, int id = ANY, uint32_t now = micros_now(), bool exact = false) {
+    finished f;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto i = match(command, id, now, exact);
+      if (i == NONE) { return false; }
+      f = finish(i, request_status::DONE, now);
+      record(command, f.res.rtt_us);
+    }
+    notify(f);
+    return true;
+  }
+
+  // The id of the request complete() would answer, without answering it. UNASKED if there isn't one.
+  int target(uint8_t command, int id = ANY, uint32_t now = micros_now(), bool exact = false) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto i = match(command, id, now, exact);
+    return i == NONE ? UNASKED : _requests[i].id;
+  }
+
+  // Set before any requests are sent
+  void observe(observer o) { _observer = o; }
+
+  // Time out everything past its deadline. Returns how many were.
+  std::size_t expire(uint32_t now = micros_now()) {
+    std::size_t count = 0u;
+    while (finish_one(now, true)) {
+      count++;
+    }
+    return count;
+  }
+
+  // Give up on a request. It finishes as CANCELLED, which isn't counted as a timeout.
+  void cancel(request r) {
+    finished f;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto *s = find(r);
+      if (!s || s->status != request_status::PENDING) { return; }
+      f = finish(r._slot, request_status::CANCELLED, 0u);
+    }
+    notify(f);
+  }
+
+  // Drop everything in flight, for when the link goes away. They all finish as CANCELLED.
+  void clear() {
+    while (finish_one(0u, false)) {
+    }
+  }
+
+  request_result result(request r) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto *s = find(r);
+    if (!s) { return {request_status::UNKNOWN, 0u}; }
+    return {s->status, s->rtt_us};
+  }
+
+  // Block until the request is answered or its deadline passes, timing it out then
+  request_result wait(request r) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      auto *s = find(r);
+      if (!s) { return {request_status::UNKNOWN, 0u}; }
+      if (s->status == request_status::PENDING) {
+        const auto left = s->timeout_us - std::min(s->timeout_us, micros_now() - s->sent);
+        // The slot can be reused for another request once this one's finished
+        _done.wait_for(lock, std::chrono::microseconds(left),
+                       [&]() { return s->gen != r._gen || s->status != request_status::PENDING; });
+      }
+    }
+    expire();
+    return result(r);
+  }
+
+  std::size_t in_flight() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::size_t count = 0u;
+    for (const auto &s : _requests) {
+      count += s.status == request_status::PENDING;
+    }
+    return count;
+  }
+
+  // Zeros for a command that's never been sent, or didn't fit in the _commands kept
+  rtt_stats stats(uint8_t command) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto i = _stat_index[command];
+    return i == NONE ? rtt_stats{} : _stats[i];
+  }
+
+private:
+  static constexpr const uint8_t NONE = 0xFFu;
+
+  struct slot {
+    uint8_t command;
+    int16_t id;
+    request_status status;
+    uint8_t gen;
+    uint32_t sent;
+    uint32_t timeout_us;
+    uint32_t rtt_us;
+    completion done;
+  };
+
+  mutable std::mutex _mutex;
+  std::condition_variable _done;
+  std::array<slot, _slots> _requests;
+  // Which of _stats each command's RTT is in, like the head table in dispatch_table
+  std::array<uint8_t, 256> _stat_index;
+  std::array<rtt_stats, _commands> _stats;
+  uint8_t _stats_used;
+  observer _observer;
+
+  const slot *find(request r) const {
+    if (!r || r._slot >= _slots || _requests[r._slot].gen != r._gen) { return nullptr; }
+    return &_requests[r._slot];
+  }
+  slot *find(request r) { return const_cast<slot *>(static_cast<const request_tracker *>(this)->find(r)); }
+
+  // The pending request for command and id that's been waiting longest, the one a reply in order would be for
+  uint8_t oldest(uint8_t command, int id, uint32_t now) const {
+    uint8_t best = NONE;
+    uint32_t age = 0u;
+    for (auto i = 0u; i < _slots; i++) {
+      const auto &s = _requests[i];
+      if (s.status != request_status::PENDING || s.command != command || (id != ANY && s.id != id)) { continue; }
+      if (best == NONE || now - s.sent > age) {
+        best = i;
+        age = now - s.sent;
+      }
+    }
+    return best;
+  }
+
+  // Time out one pending request, only if it's past its deadline when deadline is set, otherwise cancel it. False when
+  // there was none.
+  bool finish_one(uint32_t now, bool deadline) {
+    finished f;
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      auto i = 0u;
+      for (; i < _slots; i++) {
+        const auto &s = _requests[i];
+        if (s.status == request_status::PENDING && (!deadline || now - s.sent >= s.timeout_us)) { break; }
+      }
+      if (i == _slots) { return false; }
+
+      f = finish(i, deadline ? request_status::TIMED_OUT : request_status::CANCELLED, now);
+      if (deadline) {
+        auto *st = stats_for(f.command);
+        if (st) { st->timeouts++; }
+      }
+    }
+    notify(f);
+    return true;
+  }
+
+  // What's needed to tell everyone about a finished request once the lock is let go
+  struct finished {
+    completion done;
+    uint8_t command;
+    int id;
+    request_result res;
+  };
+
+  finished finish(uint8_t i, request_status status, uint32_t now) {
+    auto &s = _requests[i];
+    s.status = status;
+    s.rtt_us = status == request_status::DONE ? now - s.sent : 0u;
+    return finished{s.done, s.command, s.id, {status, s.rtt_us}};
+  }
+
+  void notify(const finished &f) {
+    _done.notify_all();
+    if (_observer) { _observer(f.command, f.id, f.res); }
+    if (f.done) { f.done(f.res); }
+  }
+
+  // The request a reply to command from id answers, see complete()
+  uint8_t match(uint8_t command, int id, uint32_t now, bool exact) const {
+    auto i = oldest(command, id, now);
+    if (i == NONE && id != ANY && !exact) { i = oldest(command, LOCAL, now); }
+    return i;
+  }
+
+  rtt_stats *stats_for(uint8_t command) {
+    auto &i = _stat_index[command];
+    if (i == NONE) {
+      if (_stats_used == _commands) { return nullptr; }
+      i = _stats_used++;
+    }
+    return &_stats[i];
+  }
+
+  void record(uint8_t command, uint32_t rtt) {
+    auto *st = stats_for(command);
+    if (!st) { return; }
+    st->last_us = rtt;
+    if (!st->count || rtt < st->min_us) { st->min_us = rtt; }
+    if (rtt > st->max_us) { st->max_us = rtt; }
+    // Integer moving average, 1/8th of the way to each new reply
+    st->avg_us = st->count ? st->avg_us + (static_cast<int32_t>(rtt - st->avg_us) >> 3) : rtt;
+    st->count++;
+  }
+};
+
+}; // namespace vesc
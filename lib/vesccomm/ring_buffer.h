@@ -0,0 +1,139 @@
+#pragma once
+
+// Receive storage that never has to move data around. buffer::clean() copies whatever is left to the front of the
+// array after every packet, this just moves the head forward.
+//
+// Every byte is written twice, once at its index and once _size bytes later. Any run of up to _size bytes can then be
+// read from a single pointer even when it wraps past the end, so get<T>(), getfp(), the CRC and begin()/end() don't
+// need to know about the wrap at all. The cost is twice the memory and a second memcpy on write.
+
+#include "byte_order.h"
+#include "crc.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <type_traits>
+
+namespace vesc {
+
+template <std::size_t _size> class ring_buffer {
+  static_assert(_size && !(_size & (_size - 1u)), "ring_buffer size must be a power of two");
+
+public:
+  ring_buffer() : _head{}, _len{} {}
+  ~ring_buffer() = default;
+
+  const size_t len() const { return _len; }
+  constexpr size_t capacity() const { return _size; }
+  size_t space() const { return _size - _len; }
+
+  // Same big endian encoding as buffer
+  template <class T, typename = typename std::enable_if<std::is_integral<T>::value, T>::type> int append(T val) {
+    std::array<uint8_t, sizeof(T)> bytes;
+    endian::store(bytes.data(), val);
+    append(bytes.data(), bytes.size());
+    return 0;
+  };
+
+  template <class T> void copy(T t) {
+    for (auto v : t) {
+      append<uint8_t>(v);
+    }
+  }
+
+  int append(float val) { return append<uint32_t>(endian::encode_float(val)); }
+
+  // Returns how many bytes fit. Anything past the capacity is dropped.
+  int append(const uint8_t *data, size_t mlen) {
+    mlen = std::min(mlen, space());
+    auto tail = (_head + _len) & MASK;
+    auto first = std::min(mlen, _size - tail);
+    write(tail, data, first);
+    write(0u, data + first, mlen - first);
+    _len += mlen;
+    return mlen;
+  }
+
+  // None of the getters check the length, use has() once for everything a message is about to read
+  bool has(size_t bytes) const { return _len >= bytes; }
+
+  template <class T> T get() {
+    auto val = peek<T>();
+    advance(sizeof(T));
+    return val;
+  };
+
+  template <class T> T peek(size_t offset = 0u) const { return endian::load<T>(ptr(offset)); };
+
+  float getf() { return endian::decode_float(get<uint32_t>()); }
+
+  // Get a fixed point value
+  float getfp(size_t bytes, float scale) {
+    auto val = endian::load_fixed(ptr(0u), bytes);
+    advance(bytes);
+    return static_cast<float>(val) / scale;
+  }
+
+  std::string get_string() {
+    auto start = ptr(0u);
+    auto res = std::find(start, start + _len, '\0');
+    if (res == start + _len) {
+      std::array<char, 20> num;
+      sprintf(num.data(), "%u", static_cast<unsigned int>(_head));
+      return "(Unknown)" + std::string(num.data());
+    }
+    std::string ret(start, res);
+    advance(ret.size() + 1u);
+    return ret;
+  }
+
+  uint16_t crc() const { return crc16_update(0u, ptr(0u), _len); }
+
+  uint16_t crc(size_t offset, size_t count, uint16_t crc = 0u) const {
+    return crc16_update(crc, ptr(offset), count);
+  }
+
+  void reset() {
+    _head = 0u;
+    _len = 0u;
+  }
+
+  // Skip forward without returning data. This is all it takes to consume a packet.
+  void advance(size_t count) {
+    count = std::min(count, _len);
+    _head = (_head + count) & MASK;
+    _len -= count;
+  }
+
+  // Remove some data off the end of the buffer
+  void truncate(size_t count) { _len = _len > count ? _len - count : 0u; }
+
+  // Nothing to move, kept so ring_buffer can stand in for buffer
+  void clean() {}
+
+  // Contiguous thanks to the mirror, for all _len bytes
+  uint8_t *begin() { return &_data[_head]; }
+  uint8_t *end() { return begin() + _len; }
+
+  operator uint8_t *() { return begin(); }
+
+private:
+  static constexpr const size_t MASK = _size - 1u;
+
+  std::array<uint8_t, _size * 2u> _data;
+  size_t _head;
+  size_t _len;
+
+  const uint8_t *ptr(size_t offset) const { return &_data[(_head + offset) & MASK]; }
+
+  void write(size_t index, const uint8_t *data, size_t count) {
+    std::copy(data, data + count, &_data[index]);
+    std::copy(data, data + count, &_data[index + _size]);
+  }
+};
+
+}; // namespace vesc
@@ -0,0 +1,196 @@
+#pragma once
+
+// Messages described as a list of fields instead of hand written append()/getfp() chains. Each field knows its wire
+// type, the struct member it maps to, its scale and the values:: mask bit it's sent under, all as template
+// parameters, so the encoder and decoder for a message are generated at compile time.
+//
+// Scales are integers, which covers everything the VESC uses (1, 10, 100, 1000, 10000, 1000000). Decoding multiplies
+// by a constexpr reciprocal instead of dividing. The result can differ from the division in the last bit. A float wire
+// type is the vesc's portable float32 instead, see endian::encode_float.
+//
+// Configurations add fixed size arrays (array_field) and structs inside structs (group).
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+
+namespace vesc {
+namespace schema {
+
+template <class T> struct member_traits;
+template <class S, class M> struct member_traits<M S::*> {
+  using owner = S;
+  using type = M;
+};
+
+// _mask of 0 is a field that is always sent
+template <class _wire, auto _member, int32_t _scale = 1, uint32_t _mask = 0u> struct field {
+  static_assert(std::is_integral<_wire>::value || std::is_same<_wire, float>::value,
+                "fields are sent as integers or float32");
+  static_assert(_scale > 0, "scale must be positive");
+
+  using owner = typename member_traits<decltype(_member)>::owner;
+  using type = typename member_traits<decltype(_member)>::type;
+
+  static constexpr const size_t size = sizeof(_wire);
+  static constexpr const uint32_t mask = _mask;
+
+  static constexpr bool selected(uint32_t m) { return !_mask || (m & _mask); }
+
+  template <class R> static void decode(R &r, owner &s) {
+    if constexpr (std::is_same<_wire, float>::value) {
+      s.*_member = static_cast<type>(r.getf());
+    } else if constexpr (std::is_floating_point<type>::value) {
+      constexpr const type inv = type(1) / _scale;
+      s.*_member = static_cast<type>(r.template get<_wire>()) * inv;
+    } else {
+      s.*_member = static_cast<type>(r.template get<_wire>());
+    }
+  }
+
+  template <class W> static void encode(W &w, const owner &s) {
+    if constexpr (std::is_same<_wire, float>::value) {
+      w.append(static_cast<float>(s.*_member));
+    } else if constexpr (std::is_floating_point<type>::value) {
+      w.template append<_wire>(static_cast<_wire>(s.*_member * _scale));
+    } else {
+      w.template append<_wire>(static_cast<_wire>(s.*_member));
+    }
+  }
+
+  static void copy(owner &dst, const owner &src) { dst.*_member = src.*_member; }
+  static bool equal(const owner &a, const owner &b) { return a.*_member == b.*_member; }
+};
+
+// A fixed size array member, every element sent as _wire
+template <class _wire, auto _member, uint32_t _mask = 0u> struct array_field {
+  static_assert(std::is_integral<_wire>::value, "array elements are sent as integers");
+
+  using owner = typename member_traits<decltype(_member)>::owner;
+  using type = typename member_traits<decltype(_member)>::type;
+  using element = typename std::remove_extent<type>::type;
+
+  static constexpr const size_t count = std::extent<type>::value;
+  static constexpr const size_t size = sizeof(_wire) * count;
+  static constexpr const uint32_t mask = _mask;
+
+  static constexpr bool selected(uint32_t m) { return !_mask || (m & _mask); }
+
+  template <class R> static void decode(R &r, owner &s) {
+    for (auto &e : s.*_member) {
+      e = static_cast<element>(r.template get<_wire>());
+    }
+  }
+
+  template <class W> static void encode(W &w, const owner &s) {
+    for (const auto &e : s.*_member) {
+      w.template append<_wire>(static_cast<_wire>(e));
+    }
+  }
+
+  static void copy(owner &dst, const owner &src) {
+    std::copy(std::begin(src.*_member), std::end(src.*_member), std::begin(dst.*_member));
+  }
+  static bool equal(const owner &a, const owner &b) {
+    return std::equal(std::begin(a.*_member), std::end(a.*_member), std::begin(b.*_member));
+  }
+};
+
+// A struct member sent as the fields of its own message, in place
+template <auto _member, class _message, uint32_t _mask = 0u> struct group {
+  using owner = typename member_traits<decltype(_member)>::owner;
+  using type = typename member_traits<decltype(_member)>::type;
+  static_assert(std::is_same<type, typename _message::type>::value, "group's message is for another struct");
+
+  static constexpr const size_t size = _message::size;
+  static constexpr const uint32_t mask = _mask;
+
+  static constexpr bool selected(uint32_t m) { return !_mask || (m & _mask); }
+
+  template <class R> static void decode(R &r, owner &s) { _message::decode(r, s.*_member); }
+  template <class W> static void encode(W &w, const owner &s) { _message::encode_fields(w, s.*_member); }
+  static void copy(owner &dst, const owner &src) { dst.*_member = src.*_member; }
+  static bool equal(const owner &a, const owner &b) { return _message::equal(a.*_member, b.*_member); }
+};
+
+template <uint8_t _id, class _struct, class... _fields> struct message {
+  static_assert((std::is_same<typename _fields::owner, _struct>::value && ...), "field belongs to another struct");
+
+  using type = _struct;
+  static constexpr const uint8_t id = _id;
+
+  // Payload size without the command byte, for every field or only the ones a mask selects
+  static constexpr const size_t size = (_fields::size + ... + 0u);
+  static constexpr size_t size_of(uint32_t mask) { return ((_fields::selected(mask) ? _fields::size : 0u) + ... + 0u); }
+  // Every mask bit some field is sent under
+  static constexpr const uint32_t mask = (_fields::mask | ... | 0u);
+
+  template <class W> static void encode(W &w, const _struct &s) {
+    w.template append<uint8_t>(_id);
+    encode_fields(w, s);
+  }
+
+  // Just the fields a mask selects, without the command byte, like a selective reply carries
+  template <class W> static void encode_fields(W &w, const _struct &s, uint32_t mask = 0xFFFFFFFF) {
+    (encode_field<_fields>(w, s, mask), ...);
+  }
+
+  // Copy the fields a mask selects from one struct to another, leaving the rest alone
+  static void copy(_struct &dst, const _struct &src, uint32_t mask) {
+    (copy_field<_fields>(dst, src, mask), ...);
+  }
+
+  // Whether the fields a mask selects are the same in both, a field at a time so padding doesn't count
+  static bool equal(const _struct &a, const _struct &b, uint32_t mask = 0xFFFFFFFF) {
+    return ((!_fields::selected(mask) || _fields::equal(a, b)) && ...);
+  }
+
+  // Reads the fields the mask selects, in order, and stops at the first one that isn't there. Fields that aren't
+  // read keep whatever value they had. Returns false if it stopped early.
+  template <class R> static bool decode(R &r, _struct &s, uint32_t mask = 0xFFFFFFFF) {
+    uint32_t read;
+    return decode(r, s, mask, read);
+  }
+
+  // Same again, also setting read to the mask bits of the fields that were there
+  template <class R> static bool decode(R &r, _struct &s, uint32_t mask, uint32_t &read) {
+    // The usual case, everything is there so one length check covers it
+    if (r.has(size_of(mask))) {
+      (read_field<_fields>(r, s, mask), ...);
+      read = mask & message::mask;
+      return true;
+    }
+    read = 0u;
+    return (decode_field<_fields>(r, s, mask, read) && ...);
+  }
+
+private:
+  template <class F, class W> static void encode_field(W &w, const _struct &s, uint32_t mask) {
+    if (F::selected(mask)) { F::encode(w, s); }
+  }
+
+  template <class F> static void copy_field(_struct &dst, const _struct &src, uint32_t mask) {
+    if (F::selected(mask)) { F::copy(dst, src); }
+  }
+
+  template <class F, class R> static void read_field(R &r, _struct &s, uint32_t mask) {
+    if (F::selected(mask)) { F::decode(r, s); }
+  }
+
+  template <class F, class R> static bool decode_field(R &r, _struct &s, uint32_t mask, uint32_t &read) {
+    if (!F::selected(mask)) { return true; }
+    // A bit shared by several fields only counts when all of them were there
+    if (!r.has(F::size)) {
+      read &= ~F::mask;
+      return false;
+    }
+    F::decode(r, s);
+    read |= F::mask;
+    return true;
+  }
+};
+
+}; // namespace schema
+}; // namespace vesc
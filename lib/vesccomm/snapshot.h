@@ -0,0 +1,91 @@
+#pragma once
+
+// A value written by one task and read by others, like the values the receiving task decodes while the display task
+// draws them. Readers get a whole copy from a single store, never half of one and half of the next, without taking a
+// lock, and the writer never waits on them.
+//
+// It's a seqlock over two copies. The writer fills in the copy readers aren't being pointed at and then bumps the
+// count to point them at it, so a reader only has to try again when a whole store and the start of another happened
+// while it was copying. A reader that interrupts the writer part way through a store reads the other copy and is never
+// stuck waiting for it to finish.
+//
+// Copies are made a word at a time through relaxed atomics, so a reader racing the writer reads garbage it throws
+// away rather than undefined behaviour.
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace vesc {
+
+// Only one task may store() or update()
+template <class T> class snapshot {
+  static_assert(std::is_trivially_copyable<T>::value, "snapshots are copied a word at a time");
+
+public:
+  snapshot() : snapshot(T{}) {}
+  explicit snapshot(const T &value) : _seq{0u}, _copies{} { put(0u, value); }
+  ~snapshot() = default;
+  // Copying is a load and a store, so the copy is safe to read but it isn't one when it's written
+  snapshot(const snapshot &other) : snapshot(other.load()) {}
+  snapshot &operator=(const snapshot &other) {
+    store(other.load());
+    return *this;
+  }
+
+  T load() const {
+    for (;;) {
+      const auto seq = _seq.load(std::memory_order_acquire);
+      const auto value = get((seq >> 1u) & 1u);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // The copy just read is the one the writer starts on when the count gets to the odd number after next
+      if (_seq.load(std::memory_order_relaxed) - seq < 3u - (seq & 1u)) { return value; }
+    }
+  }
+
+  void store(const T &value) {
+    const auto seq = _seq.load(std::memory_order_relaxed);
+    // Odd while the other copy is being written
+    _seq.store(seq + 1u, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    put(((seq >> 1u) + 1u) & 1u, value);
+    _seq.store(seq + 2u, std::memory_order_release);
+  }
+
+  // Change some of it, called as f(T &) on a copy of what's there now
+  template <class F> void update(F &&f) {
+    auto value = load();
+    f(value);
+    store(value);
+  }
+
+private:
+  static constexpr const std::size_t WORDS = (sizeof(T) + sizeof(uint32_t) - 1u) / sizeof(uint32_t);
+  using words = std::array<uint32_t, WORDS>;
+
+  std::atomic<uint32_t> _seq;
+  std::array<std::array<std::atomic<uint32_t>, WORDS>, 2u> _copies;
+
+  T get(uint32_t i) const {
+    words w;
+    for (auto j = 0u; j < WORDS; j++) {
+      w[j] = _copies[i][j].load(std::memory_order_relaxed);
+    }
+    T value;
+    std::memcpy(&value, w.data(), sizeof(T));
+    return value;
+  }
+
+  void put(uint32_t i, const T &value) {
+    words w{};
+    std::memcpy(w.data(), &value, sizeof(T));
+    for (auto j = 0u; j < WORDS; j++) {
+      _copies[i][j].store(w[j], std::memory_order_relaxed);
+    }
+  }
+};
+
+}; // namespace vesc
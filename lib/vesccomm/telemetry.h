@@ -0,0 +1,159 @@
+#pragma once
+
+// Decides which values to poll a vesc for and when. Every values:: field gets its own period, how often it's wanted,
+// and a staleness budget, the longest it can go without being refreshed. Each tick due() gives the mask for one
+// COMM_GET_VALUES_SELECTIVE covering what's due, plus anything that's close enough to due to ride along in the same
+// reply, since every request costs a frame header and a round trip.
+//
+// When the link is struggling, requests timing out or replies taking longer than a field's period, the periods are
+// stretched by a backoff factor so the bandwidth goes to the fast fields. No field is stretched past its staleness
+// budget. The backoff halves back toward nothing as replies come in on time.
+//
+// Replies come in on the receiving task while due() is called from the sending one, so this is behind a mutex.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace vesc {
+
+struct link_stats {
+  uint32_t replies;
+  uint32_t timeouts;
+  uint32_t rtt_us;  // Moving average
+  uint32_t backoff; // How much periods are stretched, in 1/BACKOFF_ONE
+};
+
+// _fields is the number of values:: bits
+template <std::size_t _fields = 21u> class telemetry_scheduler {
+  static_assert(_fields <= 32u, "fields are bits in a 32 bit mask");
+
+public:
+  static constexpr const uint32_t BACKOFF_ONE = 256u;
+  static constexpr const uint32_t BACKOFF_MAX = 16u * BACKOFF_ONE;
+
+  telemetry_scheduler()
+      : _rates{}, _asked{}, _received{}, _asked_once{0u}, _in_flight{0u}, _link{0u, 0u, 0u, BACKOFF_ONE} {}
+  ~telemetry_scheduler() = default;
+  telemetry_scheduler(const telemetry_scheduler &) = delete;
+  telemetry_scheduler &operator=(const telemetry_scheduler &) = delete;
+
+  // Poll the fields in mask every period_us, and never leave them longer than stale_us. A period of 0 stops polling.
+  void set_rate(uint32_t mask, uint32_t period_us, uint32_t stale_us) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto i = 0u; i < _fields; i++) {
+      if (mask & (1u << i)) { _rates[i] = rate{period_us, stale_us < period_us ? period_us : stale_us}; }
+    }
+  }
+
+  // The fields to ask for now, or 0 if nothing's due. They count as asked for until reply(), timeout() or unsent().
+  uint32_t due(uint32_t now) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t due = 0u, soon = 0u;
+    for (auto i = 0u; i < _fields; i++) {
+      const auto bit = 1u << i;
+      if (!_rates[i].period_us || (_in_flight & bit)) { continue; }
+      const auto period = effective_period(i);
+      const auto age = now - _asked[i];
+      if (!(_asked_once & bit) || age >= period) {
+        due |= bit;
+      } else if (age >= period / 2u) {
+        soon |= bit;
+      }
+    }
+    if (!due) { return 0u; }
+    due |= soon;
+    for (auto i = 0u; i < _fields; i++) {
+      if (due & (1u << i)) { _asked[i] = now; }
+    }
+    _in_flight |= due;
+    _asked_once |= due;
+    return due;
+  }
+
+  // The reply to a due() mask came in after rtt_us
+  void reply(uint32_t mask, uint32_t rtt_us, uint32_t now) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_flight &= ~mask;
+    for (auto i = 0u; i < _fields; i++) {
+      if (mask & (1u << i)) { _received[i] = now; }
+    }
+    _link.replies++;
+    _link.rtt_us = _link.replies == 1u ? rtt_us : _link.rtt_us + (static_cast<int32_t>(rtt_us - _link.rtt_us) >> 3);
+    // Back off less each time a reply makes it
+    _link.backoff -= (_link.backoff - BACKOFF_ONE + 1u) / 2u;
+  }
+
+  // The request for a due() mask was never answered. Those fields are due again straight away.
+  void timeout(uint32_t mask) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_flight &= ~mask;
+    _asked_once &= ~mask;
+    _link.timeouts++;
+    _link.backoff = _link.backoff * 2u > BACKOFF_MAX ? BACKOFF_MAX : _link.backoff * 2u;
+  }
+
+  // The request for a due() mask couldn't be sent, so nothing was lost on the link. Those fields are due again
+  // straight away, and the backoff and link stats are left alone.
+  void unsent(uint32_t mask) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_flight &= ~mask;
+    _asked_once &= ~mask;
+  }
+
+  // Fields that have gone longer than their staleness budget without a reply
+  uint32_t stale(uint32_t now) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    uint32_t mask = 0u;
+    for (auto i = 0u; i < _fields; i++) {
+      if (_rates[i].period_us && now - _received[i] > _rates[i].stale_us) { mask |= 1u << i; }
+    }
+    return mask;
+  }
+
+  // How long a field is left between requests right now
+  uint32_t period(std::size_t field) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return effective_period(field);
+  }
+
+  link_stats link() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _link;
+  }
+
+  // Start over, like after reconnecting
+  void reset() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _in_flight = 0u;
+    _asked_once = 0u;
+    _link = link_stats{0u, 0u, 0u, BACKOFF_ONE};
+  }
+
+private:
+  struct rate {
+    uint32_t period_us;
+    uint32_t stale_us;
+  };
+
+  mutable std::mutex _mutex;
+  std::array<rate, _fields> _rates;
+  std::array<uint32_t, _fields> _asked;
+  std::array<uint32_t, _fields> _received;
+  uint32_t _asked_once; // Fields asked for since the start or their last timeout, the rest are due whatever the time
+  uint32_t _in_flight;
+  link_stats _link;
+
+  // Stretched by the backoff, but never past the staleness budget, and never shorter than a round trip since a field
+  // can't be refreshed faster than its reply comes back
+  uint32_t effective_period(std::size_t i) const {
+    const auto &r = _rates[i];
+    auto p = static_cast<uint32_t>(static_cast<uint64_t>(r.period_us) * _link.backoff / BACKOFF_ONE);
+    if (p > r.stale_us) { p = r.stale_us; }
+    if (p < _link.rtt_us) { p = _link.rtt_us; }
+    return p;
+  }
+};
+
+}; // namespace vesc
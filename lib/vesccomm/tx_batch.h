@@ -0,0 +1,74 @@
+#pragma once
+
+// Collects frames and sends them together, as few writes of up to the link's MTU as they fit in. Over BLE every write
+// is its own GATT operation, so the setpoints for two motors in one write go out in the same connection event instead
+// of one after the other.
+//
+// Frames are never split across writes. One bigger than the MTU goes out on its own, like it did before batching.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace vesc {
+
+struct tx_stats {
+  uint32_t frames; // Frames added
+  uint32_t writes; // Writes they went out in
+};
+
+// _capacity is the largest MTU it can batch up to
+template <std::size_t _capacity> class tx_batch {
+public:
+  // What a BLE link starts with, 23 bytes less the 3 byte ATT header
+  static constexpr const std::size_t DEFAULT_MTU = 20u;
+
+  tx_batch() : _data{}, _len{0u}, _response{false}, _mtu{DEFAULT_MTU}, _stats{} {}
+  ~tx_batch() = default;
+
+  // The most a single write can carry
+  void set_mtu(std::size_t mtu) { _mtu = mtu < _capacity ? mtu : _capacity; }
+  std::size_t mtu() const { return _mtu; }
+
+  // write is called as write(data, len, response) for anything that has to go out now to make room
+  template <class F> void add(const uint8_t *data, std::size_t len, bool response, F &&write) {
+    _stats.frames++;
+    if (_len + len > _mtu) { flush(write); }
+    if (len > _mtu) {
+      _stats.writes++;
+      write(data, len, response);
+      return;
+    }
+    std::memcpy(&_data[_len], data, len);
+    _len += len;
+    // One frame that wants a response gets it for the whole write
+    _response = _response || response;
+  }
+
+  template <class F> void flush(F &&write) {
+    if (!_len) { return; }
+    _stats.writes++;
+    write(_data.data(), _len, _response);
+    _len = 0u;
+    _response = false;
+  }
+
+  std::size_t len() const { return _len; }
+  // Throw away anything waiting, like when the link goes away
+  void clear() {
+    _len = 0u;
+    _response = false;
+  }
+
+  const tx_stats &stats() const { return _stats; }
+
+private:
+  std::array<uint8_t, _capacity> _data;
+  std::size_t _len;
+  bool _response;
+  std::size_t _mtu;
+  tx_stats _stats;
+};
+
+}; // namespace vesc
@@ -0,0 +1,352 @@
+#pragma once
+
+// Uploads a new firmware image to a vesc the way VESC Tool does: COMM_ERASE_NEW_APP makes room, the image goes in
+// COMM_WRITE_NEW_APP_DATA chunks behind a 6 byte header with its size and CRC, and COMM_JUMP_TO_BOOTLOADER has the
+// bootloader check it and flash it. The _ALL_CAN versions do every vesc on the CAN bus at once.
+//
+// Waiting for every chunk's reply before sending the next leaves the link idle for most of each round trip, so chunks
+// are sent ahead, up to a window of them in flight. The window is sized from what's measured, the round trip of a
+// chunk on an idle link over the time between replies on a busy one, which is how many chunks it takes to keep the
+// link busy, plus one waiting. A timeout halves it and it's measured again. Each chunk says where it goes, so firmware
+// that echoes the offset in its reply gets replies matched by it and older firmware gets them matched in order.
+//
+// Chunks are sized to go in one write at the MTU. The header is written last, once the image's CRC has been worked out
+// from the chunks as they were read, so the image is read through once and can be streamed from flash. A chunk that's
+// sent again is read again, and has to have the CRC it had the first time or the upload fails, rather than leave an
+// image that doesn't match its header.
+
+#include "byte_order.h"
+#include "crc.h"
+#include "datatypes.h"
+#include "requests.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace vesc {
+
+enum class upload_state : uint8_t {
+  IDLE,
+  ERASING,
+  WRITING, // The image, then the header
+  DONE,    // Written, send jump_command() to have it flashed
+  FAILED,
+};
+
+struct upload_stats {
+  uint32_t size;       // Image bytes, not counting the header
+  uint32_t written;    // Image bytes the vesc has acknowledged
+  uint32_t chunks;     // Writes acknowledged, the header too
+  uint32_t resent;     // Chunks sent again after a timeout or a failed write
+  uint32_t timeouts;   // How many times chunks timed out
+  uint32_t elapsed_us; // From the first chunk to the last reply, or until now
+  uint32_t rtt_us;     // Shortest round trip of a chunk
+  uint32_t gap_us;     // Shortest time between replies with more in flight, what the link takes per chunk
+  uint16_t chunk;      // Image bytes per write
+  uint8_t window;      // Chunks allowed in flight
+
+  // Image bytes a second
+  uint32_t throughput() const {
+    return elapsed_us ? static_cast<uint32_t>(static_cast<uint64_t>(written) * 1000000u / elapsed_us) : 0u;
+  }
+};
+
+// _window chunks in flight at most. At the default MTU a few cover a round trip, at 23 bytes it takes a couple dozen.
+template <std::size_t _window = 32u> class firmware_upload {
+  static_assert(_window > 0u && _window < 0x100u, "the window is kept in a byte");
+
+public:
+  // What VESC Tool sends, well inside what the vesc can take in one packet
+  static constexpr const std::size_t MAX_CHUNK = 384u;
+  static constexpr const std::size_t HEADER_LEN = 6u;
+  // Start byte, length, command, offset, CRC and end byte around each chunk
+  static constexpr const std::size_t CHUNK_OVERHEAD = 10u;
+  // Erasing the space for a whole image takes seconds, the _ALL_CAN version waits 1.5s more first
+  static constexpr const uint32_t ERASE_TIMEOUT_US = 20000000u;
+  // Until there's a round trip to go on
+  static constexpr const uint32_t WRITE_TIMEOUT_US = 1000000u;
+  static constexpr const uint32_t MIN_TIMEOUT_US = 100000u;
+  static constexpr const uint8_t MAX_TRIES = 4u;
+  static constexpr const std::size_t MAX_WINDOW = _window;
+
+  // Image bytes per chunk for writes of up to mtu bytes, two fewer when forwarded over CAN
+  static constexpr std::size_t chunk_for(std::size_t mtu, bool forwarded = false) {
+    const auto overhead = CHUNK_OVERHEAD + (forwarded ? 2u : 0u);
+    return mtu <= overhead ? 1u : std::min(MAX_CHUNK, mtu - overhead);
+  }
+
+  // What has the vesc check the image it was sent and flash it
+  static constexpr uint8_t jump_command(bool all_can = false) {
+    return all_can ? COMM_JUMP_TO_BOOTLOADER_ALL_CAN : COMM_JUMP_TO_BOOTLOADER;
+  }
+
+  firmware_upload() : _state{upload_state::IDLE}, _slots{}, _stats{} {}
+  ~firmware_upload() = default;
+  firmware_upload(const firmware_upload &) = delete;
+  firmware_upload &operator=(const firmware_upload &) = delete;
+
+  // Start uploading a size byte image in chunks of chunk_for() the link's MTU. A max_window of 1 is stop and wait.
+  bool start(uint32_t size, std::size_t chunk, bool all_can = false, std::size_t max_window = _window,
+             uint32_t now = micros_now()) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (busy() || !size || !chunk) { return false; }
+    _state = upload_state::ERASING;
+    _all_can = all_can;
+    _max_window = static_cast<uint8_t>(std::min(std::max<std::size_t>(max_window, 1u), _window));
+    _slots.fill(slot{});
+    _next = 0u;
+    _crc = 0u;
+    _header = false;
+    _seq = 0u;
+    _sent_us = now;
+    _erase_sent = false;
+    _last_reply_us = 0u;
+    _srtt_us = 0u;
+    _stats = upload_stats{};
+    _stats.size = size;
+    _stats.chunk = static_cast<uint16_t>(std::min(chunk, MAX_CHUNK));
+    _stats.window = std::min<uint8_t>(2u, _max_window);
+    return true;
+  }
+
+  // Send whatever's due, from the task that sends. read(offset, data, len) reads image bytes and returns how many it
+  // read. send(payload, len) sends a payload and returns false if it couldn't.
+  template <class R, class S> upload_state poll(R &&read, S &&send, uint32_t now = micros_now()) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_state == upload_state::ERASING) {
+      if (!_erase_sent) {
+        std::array<uint8_t, 5u> p{_all_can ? uint8_t(COMM_ERASE_NEW_APP_ALL_CAN) : uint8_t(COMM_ERASE_NEW_APP)};
+        endian::store<uint32_t>(&p[1], _stats.size + HEADER_LEN);
+        _erase_sent = send(p.data(), p.size());
+        _sent_us = now;
+      } else if (now - _sent_us > ERASE_TIMEOUT_US) {
+        _state = upload_state::FAILED;
+      }
+    }
+    if (_state != upload_state::WRITING) { return _state; }
+
+    // Chunks that weren't answered in time go again, and the window shrinks in case it's what overflowed the link
+    auto timed_out = false;
+    for (auto &s : _slots) {
+      if (s.state == slot_state::IN_FLIGHT && now - s.sent_us > timeout()) {
+        s.state = slot_state::PENDING;
+        timed_out = true;
+      }
+    }
+    if (timed_out) {
+      _stats.timeouts++;
+      _stats.window = std::max<uint8_t>(std::min<uint8_t>(2u, _max_window), _stats.window / 2u);
+      _stats.gap_us = 0u;
+    }
+
+    // Then anything waiting to go again, oldest first
+    while (auto *s = oldest(slot_state::PENDING)) {
+      if (in_flight() >= _stats.window) { return _state; }
+      if (s->tries >= MAX_TRIES) { _state = upload_state::FAILED; }
+      if (_state != upload_state::WRITING || !resend(*s, read, send, now)) { return _state; }
+    }
+
+    // Then new chunks, then the header once the whole image has been read
+    while (in_flight() < _stats.window) {
+      auto *s = free_slot();
+      if (!s) { break; }
+      if (_next < _stats.size) {
+        const auto len = std::min<uint32_t>(_stats.chunk, _stats.size - _next);
+        if (read(_next, _data.data(), len) != len) {
+          _state = upload_state::FAILED;
+          break;
+        }
+        const auto offset = static_cast<uint32_t>(HEADER_LEN + _next);
+        *s = pending(offset, static_cast<uint16_t>(len), crc16_update(0u, _data.data(), len));
+        _crc = crc16_update(_crc, _data.data(), len);
+        _next += len;
+      } else if (!_header) {
+        endian::store<uint32_t>(&_data[0], _stats.size);
+        endian::store<uint16_t>(&_data[4], _crc);
+        *s = pending(0u, static_cast<uint16_t>(HEADER_LEN), 0u);
+        _header = true;
+      } else {
+        break;
+      }
+      // One that can't be sent now is sent again later, and read again then
+      if (!transmit(*s, send, now)) { break; }
+    }
+    return _state;
+  }
+
+  // A COMM_ERASE_NEW_APP or COMM_WRITE_NEW_APP_DATA reply, the payload after the command byte, from the task that
+  // receives. Anything else is ignored.
+  template <class V> void reply(uint8_t command, V &p, uint32_t now = micros_now()) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (!p.has(1u)) { return; }
+    const auto ok = p.template get<uint8_t>() != 0u;
+    if (command == COMM_ERASE_NEW_APP && _state == upload_state::ERASING && _erase_sent) {
+      _state = ok ? upload_state::WRITING : upload_state::FAILED;
+      _start_us = now;
+      return;
+    }
+    if (command != COMM_WRITE_NEW_APP_DATA || _state != upload_state::WRITING) { return; }
+
+    // Newer firmware says which chunk it's answering, older firmware answers them in order
+    slot *s = nullptr;
+    if (p.has(sizeof(uint32_t))) {
+      const auto offset = p.template get<uint32_t>();
+      for (auto &c : _slots) {
+        if (c.state != slot_state::FREE && c.offset == offset) { s = &c; }
+      }
+    } else {
+      s = oldest(slot_state::IN_FLIGHT);
+    }
+    // A late reply to a chunk that was sent again and has been answered already
+    if (!s) { return; }
+
+    const auto busy = in_flight() > 1u;
+    if (!ok) {
+      s->state = slot_state::PENDING;
+      return;
+    }
+    // Only full chunks sent once are timed. A reply to one sent twice could be to either, and the short ones at the end
+    // would make the link look faster than it is.
+    if (s->tries == 1u && s->state == slot_state::IN_FLIGHT && s->len == _stats.chunk) {
+      measured(now - s->sent_us, now, busy);
+    }
+    _last_reply_us = now;
+    if (s->offset) { _stats.written += s->len; }
+    _stats.chunks++;
+    s->state = slot_state::FREE;
+
+    if (_header && !in_flight() && !oldest(slot_state::PENDING)) {
+      _state = upload_state::DONE;
+      _stats.elapsed_us = now - _start_us;
+    }
+  }
+
+  // Give up, nothing more is sent
+  void cancel() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (busy()) { _state = upload_state::FAILED; }
+  }
+
+  // Without the lock, for a task waiting on an upload that the other task's replies move along
+  upload_state state() const { return _state.load(std::memory_order_acquire); }
+  bool busy() const {
+    const auto s = state();
+    return s == upload_state::ERASING || s == upload_state::WRITING;
+  }
+
+  upload_stats stats(uint32_t now = micros_now()) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto s = _stats;
+    if (_state == upload_state::WRITING) { s.elapsed_us = now - _start_us; }
+    return s;
+  }
+
+private:
+  enum class slot_state : uint8_t {
+    FREE,
+    PENDING, // Waiting to be sent, again or for the first time
+    IN_FLIGHT,
+  };
+
+  // A chunk the vesc hasn't acknowledged yet
+  struct slot {
+    uint32_t offset; // Where it goes in the vesc's new app space, 0 for the header
+    uint16_t len;
+    uint16_t crc;
+    uint32_t sent_us;
+    uint32_t seq; // Order it was last sent in
+    uint8_t tries;
+    slot_state state;
+  };
+
+  // A chunk that's never been sent
+  static slot pending(uint32_t offset, uint16_t len, uint16_t crc) {
+    return slot{offset, len, crc, 0u, 0u, 0u, slot_state::PENDING};
+  }
+
+  // Only changed with the lock held
+  std::atomic<upload_state> _state;
+  bool _all_can{};
+  bool _erase_sent{};
+  bool _header{};
+  uint8_t _max_window{};
+  std::array<slot, _window> _slots;
+  std::array<uint8_t, MAX_CHUNK> _data{};
+  uint32_t _next{};  // Image bytes read so far
+  uint16_t _crc{};   // Of those bytes
+  uint32_t _seq{};
+  uint32_t _sent_us{};
+  uint32_t _start_us{};
+  uint32_t _last_reply_us{};
+  uint32_t _srtt_us{};
+  upload_stats _stats;
+  mutable std::mutex _mutex;
+
+  uint32_t timeout() const { return _srtt_us ? std::max(MIN_TIMEOUT_US, 3u * _srtt_us) : WRITE_TIMEOUT_US; }
+
+  std::size_t in_flight() const {
+    return std::count_if(_slots.begin(), _slots.end(), [](const slot &s) { return s.state == slot_state::IN_FLIGHT; });
+  }
+
+  slot *free_slot() {
+    auto it = std::find_if(_slots.begin(), _slots.end(), [](const slot &s) { return s.state == slot_state::FREE; });
+    return it == _slots.end() ? nullptr : &*it;
+  }
+
+  slot *oldest(slot_state state) {
+    slot *o = nullptr;
+    for (auto &s : _slots) {
+      if (s.state == state && (!o || static_cast<int32_t>(s.seq - o->seq) < 0)) { o = &s; }
+    }
+    return o;
+  }
+
+  // Read a chunk again and send it, as long as it's what was read the first time
+  template <class R, class S> bool resend(slot &s, R &&read, S &&send, uint32_t now) {
+    if (s.offset) {
+      if (read(s.offset - HEADER_LEN, _data.data(), s.len) != s.len || crc16_update(0u, _data.data(), s.len) != s.crc) {
+        _state = upload_state::FAILED;
+        return false;
+      }
+    } else {
+      endian::store<uint32_t>(&_data[0], _stats.size);
+      endian::store<uint16_t>(&_data[4], _crc);
+    }
+    if (s.tries) { _stats.resent++; }
+    return transmit(s, send, now);
+  }
+
+  // Send the chunk in _data
+  template <class S> bool transmit(slot &s, S &&send, uint32_t now) {
+    std::array<uint8_t, 5u + MAX_CHUNK> p;
+    p[0] = _all_can ? COMM_WRITE_NEW_APP_DATA_ALL_CAN : COMM_WRITE_NEW_APP_DATA;
+    endian::store<uint32_t>(&p[1], s.offset);
+    std::copy(_data.begin(), _data.begin() + s.len, p.begin() + 5);
+    if (!send(p.data(), 5u + s.len)) { return false; }
+    s.state = slot_state::IN_FLIGHT;
+    s.sent_us = now;
+    s.seq = _seq++;
+    s.tries++;
+    return true;
+  }
+
+  // A round trip, and whether other chunks were in flight behind it so the time since the last reply is how long the
+  // link takes per chunk
+  void measured(uint32_t rtt, uint32_t now, bool busy) {
+    _srtt_us = _srtt_us ? _srtt_us + (static_cast<int32_t>(rtt - _srtt_us) >> 3) : rtt;
+    if (!_stats.rtt_us || rtt < _stats.rtt_us) { _stats.rtt_us = rtt; }
+    if (busy && _last_reply_us) {
+      const auto gap = std::max(now - _last_reply_us, 1u);
+      if (!_stats.gap_us || gap < _stats.gap_us) { _stats.gap_us = gap; }
+    }
+    if (!_stats.gap_us) { return; }
+    // Enough to cover a round trip at the rate the link takes them, and one more waiting
+    const auto bdp = (_stats.rtt_us + _stats.gap_us - 1u) / _stats.gap_us + 1u;
+    _stats.window = static_cast<uint8_t>(std::min<uint32_t>(std::max<uint32_t>(bdp, 1u), _max_window));
+  }
+};
+
+}; // namespace vesc
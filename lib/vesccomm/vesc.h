@@ -1,11 +1,22 @@
 #pragma once
 
 #include "buffer.h"
+#include "config.h"
 #include "datatypes.h"
+#include "dispatch.h"
+#include "frame.h"
+#include "log.h"
+#include "message_frame.h"
+#include "nodes.h"
 #include "packet.h"
+#include "packet_view.h"
+#include "requests.h"
+#include "schema.h"
+#include "snapshot.h"
+#include "tx_batch.h"
 
-#include <Arduino.h>
 #include <bitset>
+#include <functional>
 #include <stdint.h>
 
 namespace vesc {
@@ -84,170 +95,636 @@ struct mc_values {
   uint8_t vesc_id;
 };
 
+// A single value sent to the vesc, like a current or rpm
+struct setpoint {
+  float value;
+};
+
+// Which values:: fields a COMM_GET_VALUES_SELECTIVE asks for
+struct values_request {
+  uint32_t mask;
+};
+
+// Named sets of values to poll for, instead of the whole COMM_GET_VALUES reply. The vesc id is always asked for so the
+// controller can tell which vesc replied.
+namespace profiles {
+constexpr const uint32_t DRIVE = values::RPM | values::CURRENT_IN | values::DUTY_NOW | values::VESC_ID;
+constexpr const uint32_t HEALTH =
+    values::TEMP_MOS | values::TEMP_MOTOR | values::V_IN | values::FAULT_CODE | values::VESC_ID;
+constexpr const uint32_t ALL = 0xFFFFFFFF;
+}; // namespace profiles
+
+// The wire format of each message, see schema.h
+namespace messages {
+using schema::field;
+
+using get_values = schema::message<
+    COMM_GET_VALUES, mc_values,
+    field<int16_t, &mc_values::temp_mos, 10, values::TEMP_MOS>,
+    field<int16_t, &mc_values::temp_motor, 10, values::TEMP_MOTOR>,
+    field<int32_t, &mc_values::current_motor, 100, values::CURRENT_MOTOR>,
+    field<int32_t, &mc_values::current_in, 100, values::CURRENT_IN>,
+    field<int32_t, &mc_values::id, 100, values::ID>,
+    field<int32_t, &mc_values::iq, 100, values::IQ>,
+    field<int16_t, &mc_values::duty_now, 1000, values::DUTY_NOW>,
+    field<int32_t, &mc_values::rpm, 1, values::RPM>,
+    field<int16_t, &mc_values::v_in, 10, values::V_IN>,
+    field<int32_t, &mc_values::amp_hours, 10000, values::AMP_HOURS>,
+    field<int32_t, &mc_values::amp_hours_charged, 10000, values::AMP_HOURS_CHARGED>,
+    field<int32_t, &mc_values::watt_hours, 10000, values::WATT_HOURS>,
+    field<int32_t, &mc_values::watt_hours_charged, 10000, values::WATT_HOURS_CHARGED>,
+    field<int32_t, &mc_values::tachometer, 1, values::TACHOMETER>,
+    field<int32_t, &mc_values::tachometer_abs, 1, values::TACHOMETER_ABS>,
+    field<uint8_t, &mc_values::fault_code, 1, values::FAULT_CODE>,
+    // Older firmware stops somewhere in the fields below
+    field<int32_t, &mc_values::position, 1000000, values::POSITION>,
+    field<uint8_t, &mc_values::vesc_id, 1, values::VESC_ID>,
+    field<int16_t, &mc_values::temp_mos1, 10, values::TEMP_MOSX>,
+    field<int16_t, &mc_values::temp_mos2, 10, values::TEMP_MOSX>,
+    field<int16_t, &mc_values::temp_mos3, 10, values::TEMP_MOSX>,
+    field<int32_t, &mc_values::vd, 1000, values::VD>,
+    field<int32_t, &mc_values::vq, 1000, values::VQ>>;
+
+// Every firmware sends these, TEMP_MOS through FAULT_CODE
+constexpr const uint32_t GET_VALUES_REQUIRED = 0xFFFFu;
+
+// The request carries the mask, and so does the reply, in front of the get_values fields it selects
+using get_values_selective =
+    schema::message<COMM_GET_VALUES_SELECTIVE, values_request, field<uint32_t, &values_request::mask>>;
+
+using set_current = schema::message<COMM_SET_CURRENT, setpoint, field<int32_t, &setpoint::value, 1000>>;
+using set_rpm = schema::message<COMM_SET_RPM, setpoint, field<int32_t, &setpoint::value>>;
+using set_duty = schema::message<COMM_SET_DUTY, setpoint, field<int32_t, &setpoint::value>>;
+}; // namespace messages
+
+// What controller::parse_all() got through
+struct parse_result {
+  size_t frames;                  // Frames handled
+  packet::VALIDATE_RESULT status; // Why it stopped, INCOMPLETE when it ran out of whole frames
+};
+
+// How one vesc has been answering
+struct node_health {
+  uint32_t replies;      // Requests it answered
+  uint32_t timeouts;     // Requests it didn't
+  uint32_t rtt_us;       // Moving average round trip
+  uint32_t last_seen_us; // When anything last came from it, see micros_now()
+};
+
+// A vesc's values as they've come in, a field at a time with selective replies. Fields that were never sent are
+// zero, and aren't in valid.
+struct values_record {
+  mc_values values;
+  uint32_t valid;       // values:: fields that have come in at least once
+  uint32_t updated;     // values:: fields the last reply carried
+  uint32_t received_us; // When the last reply came in, see micros_now()
+};
+
+// Everything known about one vesc
+struct vesc_node {
+  vesc_node() : vesc_node(-1) {}
+  explicit vesc_node(int id) : id{id}, fw{}, record{}, health{}, mcconf{}, appconf{} {}
+
+  int id; // CAN id, -1 until the local vesc has said what its is
+  fw_params fw;
+  // Written by the receiving task and read by anything, see snapshot
+  snapshot<values_record> record;
+  node_health health;
+  // The last configurations read from it or written to it, see config_cache
+  config_cache<messages::mcconf> mcconf;
+  config_cache<messages::appconf> appconf;
+
+  uint16_t version() const { return config_cache<messages::mcconf>::version(fw.major, fw.minor); }
+};
+
+// Frames for one vesc patched with each new value, instead of being built every time. _prefix is 2 for the ones
+// forwarded over CAN.
+template <std::size_t _prefix> struct node_frames {
+  explicit node_frames(const std::array<uint8_t, _prefix> &prefix = {})
+      : current{prefix}, rpm{prefix}, duty{prefix}, selective{prefix} {}
+
+  message_frame<messages::set_current, _prefix> current;
+  message_frame<messages::set_rpm, _prefix> rpm;
+  message_frame<messages::set_duty, _prefix> duty;
+  message_frame<messages::get_values_selective, _prefix> selective;
+};
+
+// A vesc on the CAN bus, reached through the local one
+struct can_node : vesc_node {
+  can_node() : can_node(0) {}
+  explicit can_node(int id)
+      : vesc_node(id), frames{{static_cast<uint8_t>(COMM_FORWARD_CAN), static_cast<uint8_t>(id)}},
+        get_values{make_frame(COMM_FORWARD_CAN, id, COMM_GET_VALUES)} {}
+
+  node_frames<2u> frames;
+  frame<3u> get_values;
+};
+
 class controller {
 
 public:
-  // TODO change the second vesc id in order to read it
-  controller() : _fw{}, _mc_values{}, _mc_values2{}, _secondVescId{73} {}
+  // Called with the payload after the type byte. Holds up to two pointers worth of captures, see delegate.
+  using callback = delegate<void(packet_view &)>;
+  static constexpr const std::size_t CALLBACK_SLOTS = 16u;
+
+  // Requests that can be waiting on a reply at once. Sending another fails until one is answered or times out.
+  static constexpr const std::size_t REQUEST_SLOTS = 8u;
+  using requests = request_tracker<REQUEST_SLOTS>;
+  // Called when a request is answered or times out, from whichever task that happens on
+  using completion = requests::completion;
+  static constexpr const uint32_t DEFAULT_REQUEST_TIMEOUT_US = 200000u;
+  // The local vesc pings every CAN id one after another before it replies
+  static constexpr const uint32_t PING_CAN_TIMEOUT_US = 3000000u;
+  // Configurations are a few hundred bytes, and writing one waits on the vesc's flash
+  static constexpr const uint32_t CONFIG_TIMEOUT_US = 1000000u;
+
+  // Vescs on the CAN bus that can be kept track of, not counting the local one
+  static constexpr const std::size_t MAX_NODES = 8u;
+  using node_list = node_table<can_node, MAX_NODES>;
+
+  // The biggest write frames are batched up to, a BLE 5 MTU less the ATT header
+  static constexpr const std::size_t TX_BATCH_LEN = 244u;
+
+  controller() : _local{}, _localFrames{}, _requestTimeout{DEFAULT_REQUEST_TIMEOUT_US}, _batching{0u} {
+    _requests.observe(requests::observer::bind<controller, &controller::requestFinished>(this));
+  }
   ~controller() = default;
   // TODO return comm result
-  packet::VALIDATE_RESULT parse_command(vesc::packet &p) {
+  // Works on any basic_packet or a framer, the framer being the one meant for receiving
+  template <class T> packet::VALIDATE_RESULT parse_command(T &p) {
     auto res = p.validate();
     if (res == packet::VALIDATE_RESULT::VALID) {
-      // Should create a copy of the packet, and clear out the buffer for receive
-      vesc::packet vp(p.data().begin(), p.valid_len());
-      // At this point we should make sure the buffer is cleaned of this packet. Trim off the CRC?
-      // 5u is the length of the overhead?
-      static const auto crc_bytes = 3u;
-      //Serial.printf("Cleaning %i bytes, buffer size %i\n", crc_bytes + p.valid_len(), p.len());
-      p.data().advance(crc_bytes + p.valid_len());
-      p.clean();
-      // Serial.println("Clean");
+      // Handlers read straight out of the receive buffer, so the packet is only consumed after they've run
+      packet_view vp = p.payload();
 
       // Get the type of packet that is in this data
-      auto type = vp.data().get<uint8_t>();
-      
-
-      switch (type) {
-      case COMM_FW_VERSION: Serial.println("Handle Packet FW"); handleFw(vp, _fw); break;
-      case COMM_GET_VALUES: Serial.println("Handle Packet Get Values"); handleGetValues(vp); break;
-      case COMM_GET_VALUES_SELECTIVE: Serial.println("Handle Packet Get Values Selective"); handleGetValuesSelective(vp, vp.data().get<uint8_t>()); break;
-      default: Serial.printf("Unhandled packet type: %i\n", type);
+      auto type = vp.get<uint8_t>();
+      // Callbacks get the payload after the type byte, whatever the handler below reads
+      packet_view cv = vp;
+
+      // The built in handler for this type, if there is one, then anything subscribed to it
+      static constexpr auto handlers = builtins();
+      int from = requests::ANY;
+      if (handlers[type]) {
+        from = handlers[type](*this, vp);
+      } else if (!_callbacks.has(type)) {
+        VESC_LOG("Unhandled packet type: %i\n", type);
       }
+      _callbacks.dispatch(type, cv);
+      // Then whoever asked for it
+      _requests.complete(type, from, micros_now(), isNode(from));
 
-      // Call any custom callbacks for this packet type
-      auto callback = _callbacks.find(type);
-      if (callback != _callbacks.end()) {
-        Serial.printf("Handling custom packet type %i\n", type);
-        // Call the callback that was assigned to this packet type
-        // Maybe shouldn't be a map, could want multiple callbacks?
-        // Could possibly just make an array of 256 values since we know that will be the max.
-        callback->second(vp);
-      }
+      // Now the packet can go, the payload plus the CRC and end byte
+      p.consume();
     }
     return res;
   }
 
-  std::string getHW() const { return _fw.hw; }
-  std::string getUUID() const { return _fw.uuid; }
-  bool isPaired() const { return _fw.isPaired; }
-  bool isTestFW() const { return _fw.isTestFW; }
-  int type() const { return _fw.hwType; }
+  // Handle every whole frame in the buffer, not just the first. A notification can carry the end of one frame and
+  // all of the next, and the second one shouldn't have to wait for another notification.
+  template <class T> parse_result parse_all(T &p) {
+    parse_result r{0u, packet::VALIDATE_RESULT::INCOMPLETE};
+    while ((r.status = parse_command(p)) == packet::VALIDATE_RESULT::VALID) {
+      r.frames++;
+    }
+    return r;
+  }
 
-  float getVoltage() const { return _mc_values.v_in; }
+  std::string getHW() const { return _local.fw.hw; }
+  std::string getUUID() const { return _local.fw.uuid; }
+  bool isPaired() const { return _local.fw.isPaired; }
+  bool isTestFW() const { return _local.fw.isTestFW; }
+  int type() const { return _local.fw.hwType; }
+
+  float getVoltage() const { return values().v_in; }
+
+  // The local vesc, and the first one found on the CAN bus, for two motor builds. Copies, safe to take from any task.
+  mc_values values() const { return record().values; }
+  mc_values values2() const { return record2().values; }
+  // The same with which fields have come in and when
+  values_record record() const { return _local.record.load(); }
+  values_record record2() const { return _nodes.size() ? _nodes[0].record.load() : values_record{}; }
+
+  // Every vesc on the CAN bus found so far. Nodes are added by scanCAN(), addNode() and asking one for anything.
+  const vesc_node &local() const { return _local; }
+  const node_list &nodes() const { return _nodes; }
+  const vesc_node *node(int id) const { return id == _local.id ? &_local : _nodes.find(id); }
+  bool addNode(int id) { return id != _local.id && _nodes.add(id); }
+  // Forget every vesc, for connecting to a different one. Not while the receiving task can be using them.
+  void clearNodes() {
+    _nodes.clear();
+    _local = vesc_node();
+  }
 
-  const mc_values &values() const { return _mc_values; }
-  const mc_values &values2() const { return _mc_values2; }
+  // How many of the packets used for sending are in use, to size the pool and the task stacks
+  pool_stats packetStats() const { return _packets.stats(); }
 
-  bool setCallback(uint8_t packet_type, std::function<void(packet &p)> f) {
-    _callbacks[packet_type] = f;
-    return true;
+  // Replaces anything already subscribed to the type
+  bool setCallback(uint8_t packet_type, callback f) {
+    _callbacks.clear(packet_type);
+    return _callbacks.subscribe(packet_type, f);
   }
 
-  void clearCallback(uint8_t packet_type) { _callbacks.erase(packet_type); }
+  // Adds to what's already subscribed. False when all CALLBACK_SLOTS are taken.
+  bool subscribe(uint8_t packet_type, callback f) { return _callbacks.subscribe(packet_type, f); }
 
-  void setTX(std::function<void(uint8_t *data, std::size_t len, bool response)> tx) { _tx = tx; }
+  void clearCallback(uint8_t packet_type) { _callbacks.clear(packet_type); }
 
-  // Get information from the controller
-  bool getValues(uint32_t mask = 0xFFFFFFFF, int id = -1) {
-    if (_tx) {
-      vesc::buffer<7u> payload;
-      if (id > 0) {
-        payload.append<uint8_t>(COMM_FORWARD_CAN);
-        payload.append<uint8_t>(id);
-      }
-      payload.append<uint8_t>(COMM_GET_VALUES);
-      vesc::packet p(payload);
-      _tx(p, p.len(), true);
-    } else {
-      return false;
-    }
-    return true;
+  void setTX(std::function<void(const uint8_t *data, std::size_t len, bool response)> tx) {
+    _tx = tx;
+    _batch.clear();
   }
 
-  bool getSecondValues(uint32_t mask = 0xFFFFFFFF) {
-    return getValues(mask, _secondVescId);
+  // How much one write to the transport can carry, the negotiated MTU less the ATT header over BLE
+  void setMTU(std::size_t mtu) { _batch.set_mtu(mtu); }
+  std::size_t mtu() const { return _batch.mtu(); }
+
+  // Frames sent between beginBatch() and flush() go out together, in as few writes as fit in the MTU. Calls nest, the
+  // outermost flush() sends. The two motor setters batch on their own.
+  void beginBatch() { _batching++; }
+  void flush() {
+    if (_batching && --_batching) { return; }
+    _batch.flush(_tx);
+  }
+  const tx_stats &txStats() const { return _batch.stats(); }
+
+  // Ask for the firmware version and hardware info
+  request getFW(completion done = nullptr) { return getFW(-1, done); }
+  request getFW(int id, completion done = nullptr) {
+    static constexpr auto frame = make_frame(COMM_FW_VERSION);
+    if (id <= 0 || id == _local.id) { return sendRequest(frame, COMM_FW_VERSION, requests::LOCAL, done); }
+    if (!_nodes.add(id)) { return request(); }
+    return sendRequest(make_frame(COMM_FORWARD_CAN, id, COMM_FW_VERSION), COMM_FW_VERSION, id, done);
+  }
+
+  // Get information from the controller. All of it is a plain COMM_GET_VALUES, anything less is a
+  // COMM_GET_VALUES_SELECTIVE for just the values:: fields in the mask, see profiles.
+  // Like the setters, asking for less than everything patches a prebuilt frame.
+  request getValues(uint32_t mask = profiles::ALL, int id = -1, completion done = nullptr) {
+    if (mask != profiles::ALL) { return getValuesSelective(mask | values::VESC_ID, id, done); }
+    static constexpr auto frame = make_frame(COMM_GET_VALUES);
+    if (id <= 0 || id == _local.id) { return sendRequest(frame, COMM_GET_VALUES, requests::LOCAL, done); }
+    auto *n = _nodes.add(id);
+    if (!n) { return request(); }
+    return sendRequest(n->get_values, COMM_GET_VALUES, id, done);
   }
 
+  // The first vesc on the CAN bus, see values2()
+  request getSecondValues(uint32_t mask = profiles::ALL, completion done = nullptr) {
+    if (!_nodes.size()) { return request(); }
+    return getValues(mask, _nodes[0].id, done);
+  }
+
+  // Block until a request is answered or times out
+  request_result wait(request r) { return _requests.wait(r); }
+  request_result result(request r) const { return _requests.result(r); }
+
+  // Time out requests past their deadline, calling their completions. Sending a request does this too.
+  std::size_t expireRequests(uint32_t now = micros_now()) { return _requests.expire(now); }
+  // Forget everything in flight, like when the link is reset
+  void clearRequests() { _requests.clear(); }
+  std::size_t inFlight() const { return _requests.in_flight(); }
+  rtt_stats rtt(uint8_t command) const { return _requests.stats(command); }
+  void setRequestTimeout(uint32_t timeout_us) { _requestTimeout = timeout_us; }
+
   // Set the current for a motor
+  // The setters patch a prebuilt frame, so they aren't safe to call from two tasks at once
   bool setCurrent(float current, int id = -1) {
-    if (_tx) {
-      constexpr const auto scale = 1000.0f;
-      vesc::buffer<7u> payload;
-      if (id > 0) {
-        payload.append<uint8_t>(COMM_FORWARD_CAN);
-        payload.append<uint8_t>(id);
-      }
+    return sendSetpoint(&node_frames<0u>::current, &node_frames<2u>::current, {current}, id);
+  }
+  // The local vesc and the first one on the CAN bus, in one write when they fit
+  bool setCurrents(float c1, float c2) {
+    beginBatch();
+    const auto sent = setCurrent(c1) && setCurrent(c2, secondId());
+    flush();
+    return sent;
+  }
 
-      payload.append<uint8_t>(COMM_SET_CURRENT);
-      payload.append<int32_t>(current * scale);
-      vesc::packet p(payload);
+  bool setRPM(float rpm, int id = -1) {
+    return sendSetpoint(&node_frames<0u>::rpm, &node_frames<2u>::rpm, {rpm}, id);
+  }
 
-      _tx(p, p.len(), false);
-    } else {
-      return false;
+  bool setRPMs(float rpm1, float rpm2) {
+    beginBatch();
+    const auto sent = setRPM(rpm1) && setRPM(rpm2, secondId());
+    flush();
+    return sent;
+  }
+
+  bool setDuty(float duty, int id = -1) {
+    return sendSetpoint(&node_frames<0u>::duty, &node_frames<2u>::duty, {duty}, id);
+  }
+
+  bool setDuties(float duty1, float duty2) {
+    beginBatch();
+    const auto sent = setDuty(duty1) && setDuty(duty2, secondId());
+    flush();
+    return sent;
+  }
+
+  // Send a payload that isn't one of the messages, like a firmware_upload chunk, forwarded over CAN when there's an id.
+  // Replies come to the callbacks.
+  bool sendPayload(const uint8_t *data, std::size_t len, int id = -1) {
+    const auto forwarded = id > 0 && id != _local.id;
+    if (!_tx || len + (forwarded ? 2u : 0u) > PACKET_MAX_PL_LEN) { return false; }
+    auto p = _packets.acquire();
+    if (!p) { return false; }
+    vesc::buffer<PACKET_MAX_PL_LEN> payload;
+    if (forwarded) {
+      payload.append<uint8_t>(COMM_FORWARD_CAN);
+      payload.append<uint8_t>(id);
     }
+    payload.append(data, len);
+    p->construct(payload);
+    transmit(*p, p->len(), false);
     return true;
   }
-  bool setCurrents(float c1, float c2) { return setCurrent(c1) && setCurrent(c2, _secondVescId); }
 
-  bool setRPM(float rpm, int id = -1) {
-    if (_tx) {
-      constexpr const auto scale = 1.0f;
-      vesc::buffer<7u> payload;
-      if (id > 0) {
-        payload.append<uint8_t>(COMM_FORWARD_CAN);
-        payload.append<uint8_t>(id);
-      }
+  // Have the local vesc ping every CAN id. The ones that answer are added to nodes().
+  request scanCAN(completion done = nullptr) {
+    static constexpr auto frame = make_frame(COMM_PING_CAN);
+    return sendRequest(frame, COMM_PING_CAN, requests::LOCAL, done, PING_CAN_TIMEOUT_US);
+  }
 
-      payload.append<uint8_t>(COMM_SET_RPM);
-      payload.append<int32_t>(rpm * scale);
-      vesc::packet p(payload);
+  // Read a vesc's motor or app configuration into its cache. Replies are bigger than a normal frame, so the framer
+  // receiving them should allow_large() while awaitingConfig().
+  request getMcconf(int id = -1, completion done = nullptr) { return getConfig(COMM_GET_MCCONF, id, done); }
+  request getAppconf(int id = -1, completion done = nullptr) { return getConfig(COMM_GET_APPCONF, id, done); }
+  bool awaitingConfig() const {
+    return _requests.target(COMM_GET_MCCONF, requests::ANY) != requests::UNASKED ||
+           _requests.target(COMM_GET_APPCONF, requests::ANY) != requests::UNASKED;
+  }
 
-      _tx(p, p.len(), false);
-    } else {
-      return false;
+  // The configuration a vesc is running, and the one it starts with, nullptr until one's been read for its firmware.
+  // Written by the receiving task, so only read them once the request for them has completed.
+  const mc_configuration *mcconf(int id = -1) const {
+    auto *n = node(id <= 0 ? _local.id : id);
+    return n ? n->mcconf.current(n->version()) : nullptr;
+  }
+  const mc_configuration *savedMcconf(int id = -1) const {
+    auto *n = node(id <= 0 ? _local.id : id);
+    return n ? n->mcconf.stored(n->version()) : nullptr;
+  }
+  const app_configuration *appconf(int id = -1) const {
+    auto *n = node(id <= 0 ? _local.id : id);
+    return n ? n->appconf.current(n->version()) : nullptr;
+  }
+
+  // What a configuration write needed to send, and the request for the vesc's acknowledgement. The request is empty
+  // when nothing needed sending, or when it couldn't be sent and nothing was cached.
+  struct config_write {
+    config_change change;
+    request req;
+  };
+
+  // Write a motor configuration, only as much of it as differs from what's cached. Changing only the runtime limits,
+  // see conf::RUNTIME, sends them with COMM_SET_MCCONF_TEMP and they last until the vesc restarts. Anything else, or
+  // no cached configuration, sends the whole thing and the vesc stores it.
+  config_write setMcconf(const mc_configuration &want, int id = -1, completion done = nullptr) {
+    auto *n = findNode(id);
+    if (!n) { return {config_change::NONE, request()}; }
+    const auto version = n->version();
+    const auto change = n->mcconf.diff(want, version);
+    request r;
+    if (change == config_change::RUNTIME) {
+      r = sendRequest<messages::mcconf_temp>(runtimeLimits(want, *n->mcconf.stored(version)), COMM_SET_MCCONF_TEMP,
+                                             n->id, done, CONFIG_TIMEOUT_US);
+    } else if (change == config_change::FULL) {
+      r = sendRequest<messages::mcconf>(want, COMM_SET_MCCONF, n->id, done, CONFIG_TIMEOUT_US);
     }
-    return true;
+    // Cached as sent, and forgotten again if the vesc never acknowledges it
+    if (r) { n->mcconf.wrote(want, change, version); }
+    return {change, r};
   }
 
-  bool setRPMs(float rpm1, float rpm2) { return setRPM(rpm1) && setRPM(rpm2, _secondVescId); }
+  // The same for the app configuration, which is always written whole
+  config_write setAppconf(const app_configuration &want, int id = -1, completion done = nullptr) {
+    auto *n = findNode(id);
+    if (!n) { return {config_change::NONE, request()}; }
+    const auto version = n->version();
+    if (n->appconf.diff(want, version) == config_change::NONE) { return {config_change::NONE, request()}; }
+    auto r = sendRequest<messages::appconf>(want, COMM_SET_APPCONF, n->id, done, CONFIG_TIMEOUT_US);
+    if (r) { n->appconf.wrote(want, config_change::FULL, version); }
+    return {config_change::FULL, r};
+  }
 
-  bool setDuty(float duty, int id = -1) {
-    if (_tx) {
-      constexpr const auto scale = 1.0f;
-      vesc::buffer<7u> payload;
-      if (id > 0) {
-        payload.append<uint8_t>(COMM_FORWARD_CAN);
-        payload.append<uint8_t>(id);
-      }
+private:
+  vesc_node _local;
+  node_frames<0u> _localFrames;
+  node_list _nodes;
+  dispatch_table<packet_view, CALLBACK_SLOTS> _callbacks;
+  requests _requests;
+  uint32_t _requestTimeout;
+  packet_pool _packets;
+  std::function<void(const uint8_t *data, std::size_t len, bool response)> _tx;
+  tx_batch<TX_BATCH_LEN> _batch;
+  uint8_t _batching;
+  std::function<void(const uint8_t *data, std::size_t len)> _rx;
 
-      payload.append<uint8_t>(COMM_SET_DUTY);
-      payload.append<int32_t>(duty * scale);
-      vesc::packet p(payload);
+  // Hand a finished frame to the transport
+  template <std::size_t _len> bool send(const std::array<uint8_t, _len> &f, bool response) {
+    if (!_tx) { return false; }
+    transmit(f.data(), f.size(), response);
+    return true;
+  }
 
-      _tx(p, p.len(), false);
+  void transmit(const uint8_t *data, std::size_t len, bool response) {
+    if (_batching) {
+      _batch.add(data, len, response, _tx);
     } else {
-      return false;
+      _tx(data, len, response);
+    }
+  }
+
+  // Send a frame that gets a reply, tracking it first in case the reply beats _tx back
+  template <std::size_t _len>
+  request sendRequest(const std::array<uint8_t, _len> &f, uint8_t command, int id, completion done,
+                      uint32_t timeout_us = 0u) {
+    if (!_tx) { return request(); }
+    _requests.expire();
+    auto r = _requests.track(command, id, timeout_us ? timeout_us : _requestTimeout, done);
+    if (r) { send(f, true); }
+    return r;
+  }
+
+  // Encode a message and send it, forwarded over CAN when there's an id
+  template <class M> bool send(const typename M::type &msg, int id = -1, bool response = false) {
+    static_assert(M::size + 3u <= PACKET_MAX_PL_LEN, "the message doesn't fit in a packet");
+    if (!_tx) { return false; }
+    vesc::buffer<M::size + 3u> payload;
+    if (id > 0) {
+      payload.template append<uint8_t>(COMM_FORWARD_CAN);
+      payload.template append<uint8_t>(id);
     }
+    M::encode(payload, msg);
+    auto p = _packets.acquire();
+    if (!p) { return false; }
+    p->construct(payload);
+    transmit(*p, p->len(), response);
     return true;
   }
 
-  bool setDuties(float duty1, float duty2) { return setDuty(duty1) && setDuty(duty2, _secondVescId); }
+  // Encode a message that gets a reply and send it, tracked like the prebuilt frames are
+  template <class M>
+  request sendRequest(const typename M::type &msg, uint8_t reply, int id, completion done, uint32_t timeout_us = 0u) {
+    if (!_tx) { return request(); }
+    _requests.expire();
+    const auto local = id <= 0 || id == _local.id;
+    auto r = _requests.track(reply, local ? requests::LOCAL : id, timeout_us ? timeout_us : _requestTimeout, done);
+    if (r && !send<M>(msg, local ? -1 : id, true)) {
+      _requests.cancel(r);
+      return request();
+    }
+    return r;
+  }
 
-  // Ping all address to see which devices are connected
-  void scanCAN() {}
+  vesc_node *findNode(int id) { return id <= 0 || id == _local.id ? &_local : _nodes.add(id); }
 
-private:
-  fw_params _fw;
-  mc_values _mc_values, _mc_values2;
-  uint8_t _secondVescId;
-  std::map<uint8_t, std::function<void(packet &p)>> _callbacks;
-  std::function<void(uint8_t *data, std::size_t len, bool response)> _tx;
-  std::function<void(const uint8_t *data, std::size_t len)> _rx;
+  request getConfig(uint8_t command, int id, completion done) {
+    if (id <= 0 || id == _local.id) {
+      return sendRequest(make_frame(command), command, requests::LOCAL, done, CONFIG_TIMEOUT_US);
+    }
+    if (!_nodes.add(id)) { return request(); }
+    return sendRequest(make_frame(COMM_FORWARD_CAN, id, command), command, id, done, CONFIG_TIMEOUT_US);
+  }
 
-  void handleFw(packet &p, fw_params &out) {
-    auto &buf = p.data();
+  // The COMM_SET_MCCONF_TEMP that takes a vesc from its stored limits to want's. Current limits are sent as scales of
+  // the stored ones, the rest as they are.
+  static mcconf_temp runtimeLimits(const mc_configuration &want, const mc_configuration &stored) {
+    auto scale = [](float w, float s) { return s != 0.0f ? w / s : 1.0f; };
+    mcconf_temp t{};
+    t.ack = true;
+    t.current_min_scale = scale(want.l_current_min, stored.l_current_min);
+    t.current_max_scale = scale(want.l_current_max, stored.l_current_max);
+    t.min_erpm = want.l_min_erpm;
+    t.max_erpm = want.l_max_erpm;
+    t.min_duty = want.l_min_duty;
+    t.max_duty = want.l_max_duty;
+    t.watt_min = want.l_watt_min;
+    t.watt_max = want.l_watt_max;
+    t.in_current_min = want.l_in_current_min;
+    t.in_current_max = want.l_in_current_max;
+    return t;
+  }
+
+  int secondId() const { return _nodes.size() ? _nodes[0].id : INVALID_ID; }
+  static constexpr const int INVALID_ID = 0x100;
+
+  // Patch and send the setpoint frame for id, which is the same member of the local or a node's frames. Vescs that
+  // aren't nodes get one built in a pool packet.
+  template <class M>
+  bool sendSetpoint(message_frame<M, 0u> node_frames<0u>::*local, message_frame<M, 2u> node_frames<2u>::*forwarded,
+                    const setpoint &s, int id) {
+    if (!_tx) { return false; }
+    if (id <= 0 || id == _local.id) {
+      auto &f = _localFrames.*local;
+      f.set(s);
+      return send(f.get(), false);
+    }
+    if (id == INVALID_ID) { return false; }
+    if (auto *n = _nodes.find(id)) {
+      auto &f = n->frames.*forwarded;
+      f.set(s);
+      return send(f.get(), false);
+    }
+    return send<M>(s, id);
+  }
+
+  request getValuesSelective(uint32_t mask, int id, completion done) {
+    constexpr auto command = COMM_GET_VALUES_SELECTIVE;
+    if (id <= 0 || id == _local.id) {
+      _localFrames.selective.set({mask});
+      return sendRequest(_localFrames.selective.get(), command, requests::LOCAL, done);
+    }
+    auto *n = _nodes.add(id);
+    if (!n) { return request(); }
+    n->frames.selective.set({mask});
+    return sendRequest(n->frames.selective.get(), command, id, done);
+  }
+
+  // Whether a reply from id is from a vesc on the CAN bus, so it can't be the local vesc answering with its own id
+  bool isNode(int id) const { return id >= 0 && id != _local.id && _nodes.find(id); }
+
+  // Which vesc a reply is about. A reply to a request is for whoever it was sent to, and the local vesc's id is
+  // learned from the first reply to a request sent to it. Anything nobody asked for comes from the local vesc, unless
+  // it says it's from a node, since the vescs on the CAN bus only ever answer what's forwarded to them. A late reply
+  // from a node is never taken for the local vesc's.
+  vesc_node *route(uint8_t command, int from) {
+    const auto to = _requests.target(command, from, micros_now(), isNode(from));
+    vesc_node *n = nullptr;
+    if (to == requests::LOCAL || (to == requests::UNASKED && !_nodes.find(from))) {
+      if (from >= 0 && to == requests::LOCAL && _local.id < 0) { _local.id = from; }
+      n = &_local;
+    } else {
+      n = _nodes.add(to == requests::UNASKED ? from : to);
+    }
+    if (n) { n->health.last_seen_us = micros_now(); }
+    return n;
+  }
+
+  // Keeps each node's health up to date, from the request tracker
+  void requestFinished(uint8_t command, int id, request_result res) {
+    vesc_node *n = id == requests::LOCAL ? &_local : _nodes.find(id);
+    if (!n) { return; }
+    // Cancelled when the send failed or the link went, which says nothing about the vesc
+    if (res.status == request_status::CANCELLED) { return; }
+    auto &h = n->health;
+    if (res.status == request_status::DONE) {
+      h.rtt_us = h.replies ? h.rtt_us + (static_cast<int32_t>(res.rtt_us - h.rtt_us) >> 3) : res.rtt_us;
+      h.replies++;
+    } else {
+      h.timeouts++;
+      // A write that was never acknowledged may or may not have happened
+      if (command == COMM_SET_MCCONF || command == COMM_SET_MCCONF_TEMP) { n->mcconf.invalidate(); }
+      if (command == COMM_SET_APPCONF) { n->appconf.invalidate(); }
+    }
+  }
+
+  // The handlers for the packets the controller understands itself, indexed by packet type
+  // Each returns the CAN id the reply came from, or requests::ANY if it doesn't say
+  using handler = int (*)(controller &, packet_view &);
+  static constexpr std::array<handler, 256> builtins() {
+    std::array<handler, 256> h{};
+    h[COMM_FW_VERSION] = [](controller &c, packet_view &p) {
+      // Doesn't say who it's from, so it's for whoever was asked first
+      auto *n = c.route(COMM_FW_VERSION, requests::ANY);
+      if (n) { c.handleFw(p, n->fw); }
+      return requests::ANY;
+    };
+    h[COMM_GET_VALUES] = [](controller &c, packet_view &p) { return c.handleGetValues(p); };
+    h[COMM_GET_VALUES_SELECTIVE] = [](controller &c, packet_view &p) {
+      // The reply starts with the mask that was asked for
+      if (!p.has(sizeof(uint32_t))) { return requests::ANY; }
+      return c.handleGetValuesSelective(p, p.get<uint32_t>(), COMM_GET_VALUES_SELECTIVE);
+    };
+    h[COMM_GET_MCCONF] = [](controller &c, packet_view &p) {
+      if (auto *n = c.route(COMM_GET_MCCONF, requests::ANY)) {
+        // From firmware with a different layout
+        if (!n->mcconf.read(p, n->version())) {
+          VESC_LOG("Unexpected mcconf length: %u\n", static_cast<unsigned>(p.len()));
+        }
+      }
+      return requests::ANY;
+    };
+    h[COMM_GET_APPCONF] = [](controller &c, packet_view &p) {
+      if (auto *n = c.route(COMM_GET_APPCONF, requests::ANY)) {
+        if (!n->appconf.read(p, n->version())) {
+          VESC_LOG("Unexpected appconf length: %u\n", static_cast<unsigned>(p.len()));
+        }
+      }
+      return requests::ANY;
+    };
+    h[COMM_PING_CAN] = [](controller &c, packet_view &p) {
+      // The id of every vesc that answered, a byte each
+      while (p.has(1u)) {
+        c.addNode(p.get<uint8_t>());
+      }
+      return requests::ANY;
+    };
+    return h;
+  }
+
+  void handleFw(packet_view &buf, fw_params &out) {
     if (buf.len() > 2u) {
       out.major = buf.get<uint8_t>();
       out.minor = buf.get<uint8_t>();
@@ -267,71 +744,33 @@ private:
     if (buf.len() > 1u) { out.customConfigNum = buf.get<uint8_t>(); }
   }
 
-  void handleGetValues(packet &p) { handleGetValuesSelective(p, 0xFFFFFFFF); }
+  int handleGetValues(packet_view &p) { return handleGetValuesSelective(p, 0xFFFFFFFF, COMM_GET_VALUES); }
 
   // TODO: Change to use std::bitset and define these shifted values
-  void handleGetValuesSelective(packet &p, uint32_t mask) {
-
-    // Need to check if this is the current vesc, or the forwarded vesc
-    vesc::mc_values vals;
-
-    std::bitset<32> m(mask);
-    auto &buf = p.data();
-    // mask locations
-    if (mask & values::TEMP_MOS) { vals.temp_mos = buf.getfp(2, 10.0f); }
-    if (mask & values::TEMP_MOTOR) { vals.temp_motor = buf.getfp(2, 10.0f); }
-    if (mask & values::CURRENT_MOTOR) { vals.current_motor = buf.getfp(4, 100.0f); }
-    if (mask & values::CURRENT_IN) { vals.current_in = buf.getfp(4, 100.0f); }
-    if (mask & values::ID) { vals.id = buf.getfp(4, 100.0f); }
-    if (mask & values::IQ) { vals.iq = buf.getfp(4, 100.0f); }
-    if (mask & values::DUTY_NOW) { vals.duty_now = buf.getfp(2, 1000.0f); }
-    if (mask & values::RPM) { vals.rpm = buf.getfp(4, 1.0f); }
-    if (mask & values::V_IN) { vals.v_in = buf.getfp(2, 10.0f); }
-    if (mask & values::AMP_HOURS) { vals.amp_hours = buf.getfp(4, 10000.0f); }
-    if (mask & values::AMP_HOURS_CHARGED) { vals.amp_hours_charged = buf.getfp(4, 10000.0f); }
-    if (mask & values::WATT_HOURS) { vals.watt_hours = buf.getfp(4, 10000.0f); }
-    if (mask & values::WATT_HOURS_CHARGED) { vals.watt_hours_charged = buf.getfp(4, 10000.0f); }
-    if (mask & values::TACHOMETER) { vals.tachometer = buf.get<int32_t>(); }
-    if (mask & values::TACHOMETER_ABS) { vals.tachometer_abs = buf.get<int32_t>(); }
-    if (mask & values::FAULT_CODE) { vals.fault_code = mc_fault_code(buf.get<uint8_t>()); }
-
-    if (buf.len() >= 4) {
-      if (mask & values::POSITION) { vals.position = buf.getfp(4, 1000000.0f); }
-    } else {
-      vals.position = -1.0;
-    }
-
-    if (buf.len() >= 1) {
-      if (mask & values::VESC_ID) { vals.vesc_id = buf.get<uint8_t>(); }
-    } else {
-      vals.vesc_id = 255u;
-    }
-
-    if (buf.len() >= 6) {
-      if (mask & values::TEMP_MOSX) {
-        vals.temp_mos1 = buf.getfp(2, 10.0f);
-        vals.temp_mos2 = buf.getfp(2, 10.0f);
-        vals.temp_mos3 = buf.getfp(2, 10.0f);
-      }
-    }
-
-    if (buf.len() >= 8) {
-      if (mask & values::VD) { vals.vd = buf.getfp(4, 1000.0f); }
-      if (mask & values::VQ) { vals.vq = buf.getfp(4, 1000.0f); }
-    }
-
-    // TODO need to check if the vals were received this time because we're going to blow away other
-    // values that may not have been retrieved this time
-    if (vals.vesc_id == _secondVescId)
-    {
-      // Serial.println("Got Second vesc values!");
-      _mc_values2 = vals;
-    } else if (vals.vesc_id == 28) {
-      // Serial.println("Got primary vesc values!");
-      _mc_values = vals;
-    } else {
-      // Serial.printf("Where did this come from? %i\n", vals.vesc_id);
+  int handleGetValuesSelective(packet_view &buf, uint32_t mask, uint8_t command) {
+    vesc::mc_values vals{};
+    // What's left when older firmware doesn't send the trailing fields
+    vals.position = -1.0;
+    vals.vesc_id = 255u;
+
+    // Everything up to the fault code has to be there, the rest is optional
+    if (!buf.has(messages::get_values::size_of(mask & messages::GET_VALUES_REQUIRED))) { return requests::ANY; }
+    uint32_t read = 0u;
+    messages::get_values::decode(buf, vals, mask, read);
+
+    // Older firmware doesn't say who it's from
+    const int from = vals.vesc_id == 255u ? requests::ANY : vals.vesc_id;
+    // Only the fields that came in are merged, a selective or short reply doesn't touch the rest
+    if (auto *n = route(command, from)) {
+      const auto now = micros_now();
+      n->record.update([&](values_record &r) {
+        messages::get_values::copy(r.values, vals, read);
+        r.valid |= read;
+        r.updated = read;
+        r.received_us = now;
+      });
     }
+    return from;
   }
 };
 }; // namespace vesc
\ No newline at end of file
@@ -38,8 +38,9 @@ void draw_joystick(Joystick &j) {
   static int last_x = -1;
   static int last_y = -1;
 
-  int x = JOY_SIZE / 2 * j.x();
-  int y = JOY_SIZE / 2 * -j.y();
+  const auto axes = j.read();
+  int x = JOY_SIZE / 2 * axes.x;
+  int y = JOY_SIZE / 2 * -axes.y;
 
   x += JOY_SIZE / 2.0f;
   y += JOY_SIZE / 2.0f;
@@ -16,13 +16,21 @@ const float calc_pos(int raw, int zero, float expo) {
 }
 
 float Joystick::x() {
-  return calc_pos(_x, _zx, _expo);
+  const auto p = _pos.load();
+  return calc_pos(p.x, p.zx, _expo);
 }
 
 float Joystick::y() {
-  return calc_pos(_y, _zy, _expo);
+  const auto p = _pos.load();
+  return calc_pos(p.y, p.zy, _expo);
 }
 
 float Joystick::z() {
-  return calc_pos(_z, _zz, _expo);
+  const auto p = _pos.load();
+  return calc_pos(p.z, p.zz, _expo);
+}
+
+Joystick::axes Joystick::read() {
+  const auto p = _pos.load();
+  return axes{calc_pos(p.x, p.zx, _expo), calc_pos(p.y, p.zy, _expo), calc_pos(p.z, p.zz, _expo)};
 }
\ No newline at end of file
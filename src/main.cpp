@@ -16,6 +16,7 @@
 #include <BluetoothSerial.h>
 #include <Button2.h>
 #include <array>
+#include <atomic>
 #include <Adafruit_ADS1X15.h>
 
 #define ADC_EN 14 // ADC_EN is the ADC detection enable port
@@ -34,6 +35,8 @@ Button2 btn2(BUTTON_2);
 Joystick joystick;
 
 constexpr int SCREEN_COUNT = 3;
+// Put on LittleFS with pio run -t uploadfs, uploaded to the vesc on a long press of button 2
+constexpr const char *FIRMWARE_PATH = "/vesc_fw.bin";
 int current_screen = 0;
 
 QueueHandle_t xBLEQueue;
@@ -48,7 +51,8 @@ void TaskAnalogReadVin(void *pvParameters);
 void TaskDisplay(void *pvParameters);
 void TaskRadio(void *pvParameters);
 
-float battery_voltage = 0.0f;
+// Written by the analog task and read by the display
+std::atomic<float> battery_voltage{0.0f};
 
 // the setup function runs once when you press reset or power the board
 void setup() {
@@ -117,6 +121,7 @@ void TaskButton(void *pvParameters) // This is a task.
   btn1.setLongClickHandler([](Button2 &b) {
     // Right Button
     Serial.println("Button 1 Long Press");
+    Serial.printf("Switching to ride mode %u\n", static_cast<unsigned>(radio_next_ride_mode()));
   });
   
   btn1.setDoubleClickHandler([](Button2 &b) {
@@ -135,6 +140,8 @@ void TaskButton(void *pvParameters) // This is a task.
   btn2.setLongClickHandler([](Button2 &b) {
     // Right Button
     Serial.println("Button 2 Long Press");
+    // Only does anything when there's an image to upload and the motors are stopped
+    if (!radio_upload_firmware(FIRMWARE_PATH)) { Serial.println("A firmware upload is already waiting"); }
   });
 
   btn2.setDoubleClickHandler([](Button2 &b) {
@@ -206,9 +213,10 @@ void TaskAnalogReadVin(void *pvParameters) // This is a task.
 
   for (;;) {
     uint16_t v = analogRead(ADC_VIN_PIN);
-    battery_voltage = (static_cast<float>(v) / 4095.0f) * 2.0f * 3.3f * (vref / 1000.0f);
+    const auto voltage = (static_cast<float>(v) / 4095.0f) * 2.0f * 3.3f * (vref / 1000.0f);
+    battery_voltage.store(voltage, std::memory_order_relaxed);
     //joystick.set_pos(analogRead(A4), analogRead(A5));
-    if (battery_voltage < 3.1f) {
+    if (voltage < 3.1f) {
       // Serial.println("Battery voltage low, entering sleep");
       // esp_deep_sleep_start();
     }
@@ -242,19 +250,19 @@ void TaskDisplay(void *pvParameters) // This is a task.
   std::array<screen, SCREEN_COUNT> screens = {
     screen([&](){
       draw_joystick(joystick);
-      draw_battery(battery_voltage);
+      draw_battery(battery_voltage.load(std::memory_order_relaxed));
       draw_ble_state();
       draw_controller_state(controller);
       return true;}), 
     screen([&](){
       draw_joystick(joystick);
-      draw_battery(battery_voltage);
+      draw_battery(battery_voltage.load(std::memory_order_relaxed));
       draw_ble_state();
       draw_controller2_state(controller);
       return true;}), 
     screen([&](){
       draw_joystick(joystick);
-      draw_battery(battery_voltage);
+      draw_battery(battery_voltage.load(std::memory_order_relaxed));
       draw_raw_joystick_values(joystick);
       return true;})};
 
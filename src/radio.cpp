@@ -1,9 +1,15 @@
 #include "radio.h"
+#include "framer.h"
+#include "telemetry.h"
+#include "upload.h"
 #include "vesc.h"
 #include <Arduino.h>
 #include <BLEDevice.h>
+#include <LittleFS.h>
 #include <array>
+#include <atomic>
 #include <cmath>
+#include <cstring>
 #include <memory>
 
 // The remote Nordic UART service service we wish to connect to.
@@ -38,6 +44,30 @@ vesc::controller controller;
 
 static vesc::buffer<vesc::PACKET_MAX_PL_LEN> rx_buffer;
 
+// How often the control loop runs and sends new setpoints
+constexpr const auto CONTROL_PERIOD_MS = 20u;
+// How often to ping the CAN bus again while the second vesc hasn't been found
+constexpr const auto RESCAN_PERIOD_MS = 1000u;
+
+// What to poll each vesc for and how often, the local one first and then each CAN node. See telemetry.h.
+static std::array<vesc::telemetry_scheduler<>, vesc::controller::MAX_NODES + 1u> telemetry;
+// Made in radio_init(), once PSRAM is up. Same order as telemetry.
+static std::array<std::unique_ptr<values_history>, HISTORY_NODES> history;
+
+// How much of the stored motor and battery current limits each ride mode allows
+constexpr std::array<float, 2> RIDE_MODE_SCALE = {1.0f, 0.5f};
+// Counted up from the button task, sent to the vescs from the radio task on the next control tick
+static std::atomic<std::size_t> ride_mode{0u};
+static std::size_t applied_mode = RIDE_MODE_SCALE.size();
+
+// A firmware image on LittleFS to upload, set from any task and uploaded from the radio task once it's paired
+static std::array<char, 32> upload_path;
+static bool upload_all_can;
+static std::atomic<bool> upload_requested{false};
+static vesc::firmware_upload<> upload;
+// Faster than this and the board is moving, so it isn't a time to stop controlling the motors
+constexpr const auto UPLOAD_MAX_ERPM = 100.0f;
+
 // Function prototypes
 void ble_init();
 void ble_reset();
@@ -101,20 +131,19 @@ static void notifyCallback(BLERemoteCharacteristic *pBLERemoteCharacteristic, ui
   }
   Serial.println(" <<");
 
-  // TODO this might need some additional error checking to clean up bad data
-  static vesc::packet p;
-  p.data().append(pData, length);
+  // Bad bytes are skipped by the framer, good frames behind them are kept
+  static vesc::framer rx;
+  rx.append(pData, length);
+  // Configurations can be bigger than a normal frame
+  rx.allow_large(controller.awaitingConfig());
 
-  Serial.printf("Current buffer len: %i\n", p.len());
+  Serial.printf("Current buffer len: %i\n", rx.len());
 
-  auto res = controller.parse_command(p);
-  if (res == vesc::packet::VALIDATE_RESULT::VALID) {
-    Serial.println(" We have a valid packet! ");
-  } else if (res == vesc::packet::VALIDATE_RESULT::INCOMPLETE) {
-    Serial.println("Incomplete packet");
-  } else {
-    Serial.printf("Bad packet: %i\n", static_cast<unsigned int>(res));
-    p.data().reset();
+  const auto resyncs = rx.stats().resyncs;
+  auto res = controller.parse_all(rx);
+  Serial.printf("Handled %u packets\n", static_cast<unsigned int>(res.frames));
+  if (rx.stats().resyncs != resyncs) {
+    Serial.printf("Resynced, %u bytes dropped so far\n", rx.stats().bytes_dropped);
   }
 }
 
@@ -137,6 +166,9 @@ std::unique_ptr<BLEClient> connectToServer(BLEAddress pAddress) {
   }
   Serial.println(" - Connected to server");
 
+  // Ask for a big enough MTU that a whole control tick goes out in one write
+  client->setMTU(vesc::controller::TX_BATCH_LEN + 3u);
+
   // Obtain a reference to the Nordic UART service on the remote BLE server.
   BLERemoteService *pRemoteService = client->getService(serviceUUID);
   if (pRemoteService == nullptr) {
@@ -168,8 +200,13 @@ std::unique_ptr<BLEClient> connectToServer(BLEAddress pAddress) {
     return nullptr;
   }
 
-  controller.setTX(
-      [&](uint8_t *data, std::size_t len, bool response) { pRXCharacteristic->writeValue(data, len, response); });
+  // writeValue doesn't modify the data, it just isn't const correct
+  controller.setTX([&](const uint8_t *data, std::size_t len, bool response) {
+    pRXCharacteristic->writeValue(const_cast<uint8_t *>(data), len, response);
+  });
+  // Less the ATT header
+  controller.setMTU(client->getMTU() - 3u);
+  Serial.printf(" - MTU is %u\n", client->getMTU());
   Serial.println(" - Remote BLE RX characteristic reference established");
 
   return client;
@@ -245,48 +282,226 @@ void ble_connected() {
   bleState = BLEState::READING_DEVICE_INFO;
 }
 
-void ble_get_device_info() {
-  static vesc::buffer<1u> fwp = {COMM_FW_VERSION};
-  static vesc::packet fwpacket(fwp);
-
+// Subscribed once before connecting, since replies keep coming in on the BLE task while the radio task runs
+static bool subscribed = false;
+static void ble_callbacks_init() {
   // TODO: Validate the hardware info
-  controller.setCallback(COMM_FW_VERSION, [&](vesc::packet &p) {
+  controller.setCallback(COMM_FW_VERSION, [](vesc::packet_view &p) {
     bleState = BLEState::PAIRED;
     Serial.println("Successfully read device info");
   });
-  // TODO: Block for reply using semaphore. Release semaphore if not the reply that we're waiting for
-  Serial.printf("Constructed packet, sending fw version request len:%i\n", fwpacket.len());
-  pRXCharacteristic->writeValue(fwpacket, fwpacket.len(), true);
+  subscribed = controller.setCallback(COMM_GET_VALUES, [](vesc::packet_view &p) { Serial.println("+"); });
+}
 
-  // TODO: Should block and verify device information before continuing
+void ble_get_device_info() {
+  Serial.println("Sending fw version request");
+  auto res = controller.wait(controller.getFW());
+  if (res.status == vesc::request_status::DONE) {
+    Serial.printf("Device info took %u us\n", res.rtt_us);
+    // Find everything else on the CAN bus
+    if (controller.wait(controller.scanCAN()).status == vesc::request_status::DONE) {
+      Serial.printf("Found %u vescs on the CAN bus\n", controller.nodes().size());
+    }
+    // Cache every vesc's motor configuration, so ride modes only have to send what changes
+    for (auto i = 0u; i <= controller.nodes().size(); i++) {
+      const auto id = i ? controller.nodes()[i - 1u].id : -1;
+      if (controller.wait(controller.getMcconf(id)).status != vesc::request_status::DONE || !controller.mcconf(id)) {
+        Serial.printf("Couldn't read the motor configuration of vesc %i\n", id);
+      }
+    }
+  } else {
+    // Try again after a bit
+    Serial.println("No reply to fw version request");
+    vTaskDelay(1000u / portTICK_PERIOD_MS);
+  }
+}
 
-  vTaskDelay(1000u / portTICK_PERIOD_MS);
+// Control wants fresh numbers, the display can wait for the slow ones
+static void telemetry_init() {
+  for (auto &t : telemetry) {
+    t.set_rate(vesc::profiles::DRIVE & ~vesc::values::VESC_ID, 50000u, 200000u);
+    t.set_rate(vesc::values::FAULT_CODE, 250000u, 1000000u);
+    t.set_rate(vesc::values::V_IN | vesc::values::AMP_HOURS, 1000000u, 5000000u);
+    t.set_rate(vesc::values::TEMP_MOS | vesc::values::TEMP_MOTOR, 2000000u, 10000000u);
+  }
 }
 
-void ble_paired(Joystick &j) {
+static void history_init() {
+  for (auto &h : history) {
+    h.reset(new values_history());
+    if (!*h) { Serial.println("No memory for the values history"); }
+  }
+}
+
+// Add the n'th vesc's latest values to its history, from the receiving task once a reply's been merged in
+static void record_history(std::size_t n) {
+  if (n >= history.size() || !history[n] || !*history[n]) { return; }
+  const auto &node = n ? controller.nodes()[n - 1u] : controller.local();
+  const auto record = node.record.load();
+  values_history::sample s;
+  for (auto i = 0u; i < HISTORY_FIELDS.size(); i++) {
+    s[i] = record.values.*HISTORY_FIELDS[i];
+  }
+  history[n]->add(record.received_us, s);
+}
+
+std::size_t radio_next_ride_mode() { return (ride_mode.fetch_add(1u) + 1u) % RIDE_MODE_SCALE.size(); }
+
+// Send the ride mode's current limits to every vesc whose configuration was read, a COMM_SET_MCCONF_TEMP each
+static void apply_ride_mode() {
+  const auto mode = ride_mode.load() % RIDE_MODE_SCALE.size();
+  if (mode == applied_mode) { return; }
+  auto sent = true;
+  for (auto i = 0u; i <= controller.nodes().size(); i++) {
+    const auto id = i ? controller.nodes()[i - 1u].id : -1;
+    const auto *saved = controller.savedMcconf(id);
+    if (!saved) { continue; }
+    auto want = *saved;
+    want.l_current_max *= RIDE_MODE_SCALE[mode];
+    want.l_in_current_max *= RIDE_MODE_SCALE[mode];
+    const auto w = controller.setMcconf(want, id);
+    // Out of request slots, the rest go next tick
+    if (w.change != vesc::config_change::NONE && !w.req) { sent = false; }
+  }
+  if (sent) {
+    applied_mode = mode;
+    Serial.printf("Ride mode %u\n", static_cast<unsigned>(mode));
+  }
+}
+
+// The upload's replies, subscribed once before connecting. Replies to chunks still in flight when an upload fails keep
+// coming on the BLE task, and reply() ignores them unless an upload is writing.
+static void upload_init() {
+  controller.setCallback(COMM_ERASE_NEW_APP, [](vesc::packet_view &p) { upload.reply(COMM_ERASE_NEW_APP, p); });
+  controller.setCallback(COMM_WRITE_NEW_APP_DATA,
+                         [](vesc::packet_view &p) { upload.reply(COMM_WRITE_NEW_APP_DATA, p); });
+}
 
-  static bool second = false;
-  static auto cb = controller.setCallback(COMM_GET_VALUES, [&](vesc::packet &p) { Serial.println("+"); });
+bool radio_upload_firmware(const char *path, bool all_can) {
+  if (upload_requested.load() || strlen(path) >= upload_path.size()) { return false; }
+  strcpy(upload_path.data(), path);
+  upload_all_can = all_can;
+  upload_requested.store(true);
+  return true;
+}
 
-  if (cb) {
-    // Read data from the controller for voltage and current
+// Upload the requested image and have the vesc flash it. Nothing else is sent until it's done, so the vesc's timeout
+// stops the motors while it goes.
+static void upload_firmware() {
+  auto turning = std::abs(controller.values().rpm) > UPLOAD_MAX_ERPM;
+  for (const auto &n : controller.nodes()) {
+    turning |= std::abs(n.record.load().values.rpm) > UPLOAD_MAX_ERPM;
+  }
+  if (turning) {
+    Serial.println("Not uploading firmware while the motors are turning");
+    return;
+  }
+  if (!LittleFS.begin()) {
+    Serial.println("Couldn't mount LittleFS for the firmware upload");
+    return;
+  }
+  auto f = LittleFS.open(upload_path.data(), "r");
+  if (!f) {
+    Serial.printf("No firmware image at %s\n", upload_path.data());
+    return;
+  }
+  auto read = [&f](uint32_t offset, uint8_t *data, std::size_t len) -> std::size_t {
+    return f.seek(offset) ? f.read(data, len) : 0u;
+  };
+  auto send = [](const uint8_t *data, std::size_t len) { return controller.sendPayload(data, len); };
+
+  Serial.printf("Uploading %s, %u bytes\n", upload_path.data(), static_cast<unsigned>(f.size()));
+  upload.start(f.size(), upload.chunk_for(controller.mtu()), upload_all_can);
+  // Replies come in on the BLE task, every tick sends whatever they made room for
+  while (upload.poll(read, send), upload.busy()) {
+    if (bleState != BLEState::PAIRED) { upload.cancel(); }
+    vTaskDelay(1);
+  }
+  f.close();
+
+  const auto stats = upload.stats();
+  Serial.printf("Upload %s: %u of %u bytes in %u ms, %u bytes/s, %u byte chunks, window %u, %u resent\n",
+                upload.state() == vesc::upload_state::DONE ? "done" : "failed", static_cast<unsigned>(stats.written),
+                static_cast<unsigned>(stats.size), static_cast<unsigned>(stats.elapsed_us / 1000u),
+                static_cast<unsigned>(stats.throughput()), static_cast<unsigned>(stats.chunk),
+                static_cast<unsigned>(stats.window), static_cast<unsigned>(stats.resent));
+  if (upload.state() == vesc::upload_state::DONE) {
+    const uint8_t jump = upload.jump_command(upload_all_can);
+    controller.sendPayload(&jump, 1u);
+  }
+}
+
+const values_history *radio_history(std::size_t n) {
+  return n < history.size() && history[n] && *history[n] ? history[n].get() : nullptr;
+}
 
-    // Read all the values.
-    // TODO: Change this to only retrieve what we need
-    if (second)
-    {
-      controller.getSecondValues();
-      second = false;
+// Ask the n'th vesc for whatever its scheduler says is due, and tell the scheduler how it went
+// The second motor is the first vesc found on the CAN bus. If the ping at connect was lost there isn't one, so keep
+// pinging until there is, then read the configuration of whatever turned up.
+static vesc::request rescan;
+static void find_can_nodes() {
+  static auto last = xTaskGetTickCount();
+  const auto &nodes = controller.nodes();
+  if (rescan && controller.result(rescan).status == vesc::request_status::DONE) {
+    rescan = vesc::request();
+    for (const auto &n : nodes) {
+      controller.getMcconf(n.id);
+    }
+    Serial.printf("Found %u vescs on the CAN bus\n", nodes.size());
+  }
+  if (nodes.size() || xTaskGetTickCount() - last < RESCAN_PERIOD_MS / portTICK_PERIOD_MS) { return; }
+  last = xTaskGetTickCount();
+  rescan = controller.scanCAN();
+}
+
+static void poll_values(std::size_t n, int id) {
+  auto &t = telemetry[n];
+  const auto mask = t.due(vesc::micros_now());
+  if (!mask) { return; }
+  auto done = [n, mask](vesc::request_result res) {
+    if (res.status == vesc::request_status::DONE) {
+      telemetry[n].reply(mask, res.rtt_us, vesc::micros_now());
+      record_history(n);
+    } else if (res.status == vesc::request_status::CANCELLED) {
+      telemetry[n].unsent(mask);
     } else {
-      controller.getValues();
-      second = true;
+      telemetry[n].timeout(mask);
     }
+  };
+  auto r = controller.getValues(mask, id, done);
+  // Too many requests waiting already, try again next tick
+  if (!r) { t.unsent(mask); }
+}
+
+void ble_paired(Joystick &j) {
+  if (upload_requested.load()) {
+    upload_firmware();
+    upload_requested.store(false);
+    return;
+  }
 
-    vTaskDelay(20u / portTICK_PERIOD_MS);
+  if (subscribed) {
+    // Read data from the controller for voltage and current. Replies come in while the loop carries on.
+    static auto last = xTaskGetTickCount();
+    // Every vesc gets a turn at going first, so when the request slots run out it isn't always the same one waiting
+    static auto turn = 0u;
+    controller.expireRequests();
+    // The requests and setpoints for this tick all go out together at the end
+    controller.beginBatch();
+    const auto &nodes = controller.nodes();
+    const auto count = nodes.size() + 1u;
+    for (auto i = 0u; i < count; i++) {
+      const auto n = (turn + i) % count;
+      poll_values(n, n ? nodes[n - 1u].id : -1);
+    }
+    turn++;
+    find_can_nodes();
+    apply_ride_mode();
 
     // Control the motors
-    auto x = j.x();
-    auto y = j.y();
+    const auto axes = j.read();
+    auto x = axes.x;
+    auto y = axes.y;
     // Clip any bad controls
     // TODO: Need to subtract the deadzone out of the control to prevent a jump
     constexpr auto low_cutoff = 0.02f;
@@ -308,8 +523,15 @@ void ble_paired(Joystick &j) {
     // controller.setCurrents(current_scale * m1, current_scale * m2);
     constexpr auto duty_scale = 100000.0f;
     constexpr auto control_scale = 1.0f;
-    controller.setDuties(duty_scale * m1 * control_scale, duty_scale * m2 * control_scale);
-    vTaskDelay(20u / portTICK_PERIOD_MS);
+    const auto both = controller.setDuties(duty_scale * m1 * control_scale, duty_scale * m2 * control_scale);
+    controller.flush();
+    // Said when it changes rather than every tick
+    static auto driving_both = true;
+    if (both != driving_both) {
+      Serial.println(both ? "Both motors are getting setpoints again" : "Motor 2 isn't getting setpoints");
+      driving_both = both;
+    }
+    vTaskDelayUntil(&last, CONTROL_PERIOD_MS / portTICK_PERIOD_MS);
   }
 }
 
@@ -321,11 +543,25 @@ void ble_reset() {
   BLEDevice::deinit();
   Serial.println("BLEDevice::deinit <<");
   controller.setTX(nullptr);
+  controller.clearRequests();
+  controller.clearNodes();
+  for (auto &t : telemetry) {
+    t.reset();
+  }
+  for (auto &h : history) {
+    if (h) { h->clear(); }
+  }
+  applied_mode = RIDE_MODE_SCALE.size();
+  rescan = vesc::request();
   ble_init();
 }
 
 // Set up our bluetooth connection
 void radio_init() {
+  telemetry_init();
+  history_init();
+  ble_callbacks_init();
+  upload_init();
   ble_init();
   vTaskDelay(300 / portTICK_PERIOD_MS);
 }
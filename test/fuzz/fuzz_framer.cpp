@@ -0,0 +1,12 @@
+// libFuzzer target for the receive path. Not a PlatformIO test, build it by hand on a host with clang:
+//
+// clang++ -std=gnu++17 -g -O1 -fsanitize=fuzzer,address,undefined -Ilib/vesccomm -Itest/fuzz \
+//   test/fuzz/fuzz_framer.cpp lib/vesccomm/crc.cpp lib/vesccomm/crc_accel.cpp -o fuzz_framer
+// ./fuzz_framer -max_len=8192
+
+#include "fuzz_framer.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  fuzz::framer_stream(data, size);
+  return 0;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// Feeds an arbitrary byte stream through the framer and the controller the way notifyCallback does. Used by the
+// libFuzzer target in fuzz_framer.cpp and by the benchmarks, which run it over random streams.
+//
+// The first byte picks the notification size, the second turns on large frames if it's odd, the rest is the stream.
+// Anything wrong aborts, which is what libFuzzer looks for.
+
+#include "framer.h"
+#include "vesc.h"
+#include <cstdlib>
+
+namespace fuzz {
+
+// Returns the number of frames that made it through
+inline unsigned int framer_stream(const uint8_t *data, size_t size) {
+  if (size < 2u) { return 0u; }
+  const size_t chunk = data[0] % 244u + 1u;
+  const bool large = data[1] & 1u;
+  data += 2;
+  size -= 2;
+
+  static vesc::controller controller;
+  static vesc::framer rx;
+  rx.reset();
+  rx.clear_stats();
+  rx.allow_large(large);
+
+  auto frames = 0u;
+  for (size_t i = 0u; i < size; i += chunk) {
+    const auto len = std::min(chunk, size - i);
+    rx.append(data + i, len);
+    frames += controller.parse_all(rx).frames;
+    if (rx.len() > vesc::RX_RING_LEN) { abort(); }
+  }
+
+  // Every frame the framer passed went to the controller, and nothing is left over that should have been a frame
+  const auto &stats = rx.stats();
+  if (stats.frames != frames) { abort(); }
+  if (rx.validate() == vesc::packet::VALIDATE_RESULT::VALID) { abort(); }
+  return frames;
+}
+
+}; // namespace fuzz
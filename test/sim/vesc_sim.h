@@ -0,0 +1,151 @@
+#pragma once
+
+// A vesc at the other end of a simulated link, for trying firmware uploads on the host. Time is simulated, so a
+// link with tens of milliseconds of latency runs as fast as the CPU can go and always comes out the same. Used by the
+// upload tests in test_packet and the throughput numbers in test_bench.
+//
+// Writes queue up behind each other at the link's bandwidth and arrive after its latency, then the vesc handles them in
+// order, taking flash_us for each write, and its replies take the latency back. Replies are small, so they don't wait
+// on the bandwidth.
+
+#include "framer.h"
+#include "upload.h"
+#include "vesc.h"
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+namespace sim {
+
+struct link_params {
+  uint32_t latency_us;    // One way
+  uint32_t bytes_per_s;   // Toward the vesc
+  uint32_t flash_us;      // Writing one chunk
+  uint32_t drop_every;    // Lose every n'th write on the way, 0 for none
+  uint32_t fail_offset;   // Have the first write to this offset fail, 0 for none
+  bool echo_offset;       // Newer firmware says which offset it's answering
+};
+
+class vesc_sim {
+public:
+  explicit vesc_sim(link_params p) : params{p} {}
+
+  link_params params;
+  std::vector<uint8_t> flash; // The new app space, erased to 0xFF
+  uint32_t writes = 0u;       // Writes from the controller
+  uint32_t dropped = 0u;
+  uint32_t frames = 0u; // Frames the vesc handled
+
+  // A write from the controller at now
+  void write(const uint8_t *data, std::size_t len, uint32_t now) {
+    _link_free = std::max(_link_free, now) + static_cast<uint32_t>(uint64_t(len) * 1000000u / params.bytes_per_s);
+    const auto arrival = _link_free + params.latency_us;
+    if (params.drop_every && ++writes % params.drop_every == 0u) {
+      dropped++;
+      return;
+    }
+    _rx.append(data, len);
+    while (_rx.validate() == vesc::packet::VALIDATE_RESULT::VALID) {
+      auto p = _rx.payload();
+      handle(p, arrival);
+      _rx.consume();
+    }
+  }
+
+  // When the next reply gets back, or never
+  uint32_t next_reply() const { return _replies.empty() ? UINT32_MAX : _replies.front().at; }
+
+  // Replies that are back by now, called as f(data, len)
+  template <class F> void deliver(uint32_t now, F &&f) {
+    while (!_replies.empty() && static_cast<int32_t>(_replies.front().at - now) <= 0) {
+      f(_replies.front().frame.data(), _replies.front().frame.size());
+      _replies.pop_front();
+    }
+  }
+
+private:
+  struct reply {
+    uint32_t at;
+    std::vector<uint8_t> frame;
+  };
+
+  vesc::framer _rx;
+  std::deque<reply> _replies;
+  uint32_t _link_free = 0u;
+  uint32_t _vesc_free = 0u;
+  bool _failed = false;
+
+  void handle(vesc::packet_view &p, uint32_t arrival) {
+    frames++;
+    const auto command = p.get<uint8_t>();
+    vesc::buffer<16> r;
+    auto done = std::max(_vesc_free, arrival);
+    switch (command) {
+    case COMM_ERASE_NEW_APP:
+    case COMM_ERASE_NEW_APP_ALL_CAN:
+      flash.assign(p.get<uint32_t>(), 0xFFu);
+      r.append<uint8_t>(COMM_ERASE_NEW_APP);
+      r.append<uint8_t>(1u);
+      done += 100000u;
+      break;
+    case COMM_WRITE_NEW_APP_DATA:
+    case COMM_WRITE_NEW_APP_DATA_ALL_CAN: {
+      const auto offset = p.get<uint32_t>();
+      const auto len = p.len();
+      auto ok = offset + len <= flash.size();
+      if (ok && offset == params.fail_offset && params.fail_offset && !_failed) {
+        ok = false;
+        _failed = true;
+      }
+      if (ok) { std::copy(p.begin(), p.begin() + len, flash.begin() + offset); }
+      r.append<uint8_t>(COMM_WRITE_NEW_APP_DATA);
+      r.append<uint8_t>(ok);
+      if (params.echo_offset) { r.append<uint32_t>(offset); }
+      done += params.flash_us;
+      break;
+    }
+    default: return;
+    }
+    _vesc_free = done;
+    vesc::packet frame(r);
+    _replies.push_back({done + params.latency_us, {frame.data().begin(), frame.data().begin() + frame.len()}});
+  }
+};
+
+struct upload_run {
+  vesc::upload_state state;
+  vesc::upload_stats stats;
+  std::vector<uint8_t> flash; // What the vesc ended up with
+};
+
+// Upload image through a controller to a simulated vesc at mtu, with up to max_window chunks in flight
+inline upload_run upload(const std::vector<uint8_t> &image, link_params params, std::size_t mtu,
+                         std::size_t max_window) {
+  vesc::controller c;
+  vesc::framer rx;
+  vesc_sim v(params);
+  vesc::firmware_upload<> up;
+  uint32_t now = 1u;
+  c.setTX([&](const uint8_t *data, std::size_t len, bool) { v.write(data, len, now); });
+  c.setMTU(mtu);
+  c.setCallback(COMM_ERASE_NEW_APP, [&](vesc::packet_view &p) { up.reply(COMM_ERASE_NEW_APP, p, now); });
+  c.setCallback(COMM_WRITE_NEW_APP_DATA, [&](vesc::packet_view &p) { up.reply(COMM_WRITE_NEW_APP_DATA, p, now); });
+
+  auto read = [&](uint32_t offset, uint8_t *data, std::size_t len) {
+    std::copy(image.begin() + offset, image.begin() + offset + len, data);
+    return len;
+  };
+  auto send = [&](const uint8_t *data, std::size_t len) { return c.sendPayload(data, len); };
+  up.start(image.size(), up.chunk_for(c.mtu()), false, max_window, now);
+  while (up.poll(read, send, now), up.busy()) {
+    // On to the next reply, checking for timeouts every few ms on the way like the radio task would
+    now = std::max(now, std::min(v.next_reply(), now + 5000u));
+    v.deliver(now, [&](const uint8_t *data, std::size_t len) {
+      rx.append(data, len);
+      c.parse_all(rx);
+    });
+  }
+  return {up.state(), up.stats(now), v.flash};
+}
+
+}; // namespace sim
@@ -0,0 +1,121 @@
+#pragma once
+
+// Small helpers for the benchmarks. Times are in CPU cycles where the target has a cycle counter (Xtensa ccount,
+// x86 TSC), otherwise in nanoseconds.
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdio.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <chrono>
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace bench {
+
+#if defined(ARDUINO) || defined(__x86_64__) || defined(__i386__)
+constexpr const char *UNIT = "cycle";
+#else
+constexpr const char *UNIT = "ns";
+#endif
+
+inline uint64_t now() {
+#ifdef ARDUINO
+  return ESP.getCycleCount();
+#elif defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+// Keeps the optimizer from throwing away a result that is never used
+template <class T> inline void keep(T const &val) { asm volatile("" : : "g"(&val) : "memory"); }
+
+// Calls f() iterations times per run and returns the average time of a single call from the fastest run.
+// The fastest run is the one least disturbed by interrupts and other tasks.
+template <class F> double measure(F f, unsigned int iterations = 1000u, unsigned int runs = 5u) {
+  auto best = std::numeric_limits<uint64_t>::max();
+  for (auto r = 0u; r < runs; r++) {
+    auto start = now();
+    for (auto i = 0u; i < iterations; i++) {
+      f();
+    }
+    // The Xtensa cycle counter is 32 bits and wraps every ~18s at 240MHz, so keep the runs short
+    best = std::min<uint64_t>(best, static_cast<uint32_t>(now() - start));
+  }
+  return static_cast<double>(best) / iterations;
+}
+
+// How many ns one UNIT is. The TSC rate isn't known up front, so it's measured against the clock once.
+inline double ns_per_unit() {
+#ifdef ARDUINO
+  return 1000.0 / getCpuFrequencyMhz();
+#elif defined(__x86_64__) || defined(__i386__)
+  static const double ns = []() {
+    const auto start = std::chrono::steady_clock::now();
+    const auto start_tsc = __rdtsc();
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(20)) {
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / (__rdtsc() - start_tsc);
+  }();
+  return ns;
+#else
+  return 1.0;
+#endif
+}
+
+// Results are kept as they're measured and printed as one JSON document at the end, so runs can be compared by a
+// script. bytes is how much data one operation covers, chunk the notification size it was fed in, if any.
+// Names built at run time go in a char[NAME_LEN] so they can't be cut short.
+constexpr const size_t NAME_LEN = 48u;
+
+struct result {
+  char name[NAME_LEN];
+  double units;
+  unsigned int bytes;
+  unsigned int chunk;
+};
+
+inline std::array<result, 96> &results() {
+  static std::array<result, 96> r;
+  return r;
+}
+
+inline size_t &result_count() {
+  static size_t count = 0u;
+  return count;
+}
+
+inline void record(const char *name, double units, size_t bytes, size_t chunk = 0u) {
+  if (result_count() >= results().size()) { return; }
+  auto &r = results()[result_count()++];
+  snprintf(r.name, sizeof(r.name), "%s", name);
+  r.units = units;
+  r.bytes = bytes;
+  r.chunk = chunk;
+}
+
+inline void print_json() {
+  const auto ns = ns_per_unit();
+  printf("{\"unit\": \"%s\", \"ns_per_unit\": %.4f, \"results\": [\n", UNIT, ns);
+  for (auto i = 0u; i < result_count(); i++) {
+    const auto &r = results()[i];
+    // Bytes per ns is GB/s, times 1000 for MB/s
+    printf("  {\"name\": \"%s\", \"bytes\": %u, \"chunk\": %u, \"%s\": %.2f, \"ns\": %.2f, \"mb_per_s\": %.2f}%s\n",
+           r.name, r.bytes, r.chunk, UNIT, r.units, r.units * ns, r.bytes ? r.bytes * 1000.0 / (r.units * ns) : 0.0,
+           i + 1u < result_count() ? "," : "");
+  }
+  printf("]}\n");
+}
+
+}; // namespace bench
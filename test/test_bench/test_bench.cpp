@@ -0,0 +1,568 @@
+// Benchmarks for the vesccomm library. These don't fail on speed, they print the numbers so they can be compared
+// between boards and between changes. Run natively with `pio test -e Benchmark -v` or on a board with
+// `pio test -e t-qt-N4R2-mac -f test_bench -v`. Everything measured is also printed as JSON at the end.
+
+#include "bench.h"
+#include "../fuzz/fuzz_framer.h"
+#include "../sim/vesc_sim.h"
+#include "crc.h"
+#include "datatypes.h"
+#include "dispatch.h"
+#include "framer.h"
+#include "message_frame.h"
+#include "packet.h"
+#include "packet_view.h"
+#include "vesc.h"
+#include <array>
+#include <functional>
+#include <map>
+#include <stdio.h>
+#include <unity.h>
+#include <vector>
+
+using crc_func = unsigned short (*)(unsigned short, const unsigned char *, unsigned int);
+
+struct crc_strategy {
+  const char *name;
+  crc_func f;
+};
+
+static const std::array<crc_strategy, 6> crc_strategies = {{
+    {"bytewise", crc16_bytewise},
+    {"generated", crc16_generated},
+    {"nibble", crc16_nibble},
+    {"slice4", crc16_slice4},
+    {"slice8", crc16_slice8},
+    {"fast", crc16_fast},
+}};
+
+#ifdef ARDUINO
+constexpr const auto PAYLOAD_SIZE = 8u * 1024u;
+#else
+constexpr const auto PAYLOAD_SIZE = 64u * 1024u;
+#endif
+static std::array<unsigned char, PAYLOAD_SIZE> payload;
+
+void bench_crc16() {
+  for (auto i = 0u; i < payload.size(); i++) {
+    payload[i] = i * 31u + 7u;
+  }
+
+  char line[120];
+  snprintf(line, sizeof(line), "crc16_fast is using %s", crc16_fast_name());
+  TEST_MESSAGE(line);
+
+  for (auto len : {8u, 64u, 512u}) {
+    for (const auto &s : crc_strategies) {
+      unsigned short crc = 0;
+      auto t = bench::measure([&]() {
+        crc = s.f(crc, payload.data(), len);
+        bench::keep(crc);
+      });
+      snprintf(line, sizeof(line), "crc16 %-10s %4u bytes: %8.1f %s/call, %6.3f bytes/%s", s.name, len, t,
+               bench::UNIT, len / t, bench::UNIT);
+      TEST_MESSAGE(line);
+      char name[bench::NAME_LEN];
+      snprintf(name, sizeof(name), "crc16_%s", s.name);
+      bench::record(name, t, len);
+    }
+  }
+}
+
+// Checking a captured traffic log on a host
+void bench_crc16_large() {
+  char line[120];
+  for (const auto &s : crc_strategies) {
+    unsigned short crc = 0;
+    auto t = bench::measure(
+        [&]() {
+          crc = s.f(crc, payload.data(), payload.size());
+          bench::keep(crc);
+        },
+        10u);
+    snprintf(line, sizeof(line), "crc16 %-10s %6u bytes: %6.3f bytes/%s", s.name, PAYLOAD_SIZE, PAYLOAD_SIZE / t,
+             bench::UNIT);
+    TEST_MESSAGE(line);
+    char name[bench::NAME_LEN];
+    snprintf(name, sizeof(name), "crc16_%s", s.name);
+    bench::record(name, t, PAYLOAD_SIZE);
+  }
+}
+
+// A COMM_GET_VALUES reply with every field, the most common thing coming back from the vesc
+std::vector<uint8_t> telemetry_frame() {
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> payload;
+  payload.append<uint8_t>(COMM_GET_VALUES);
+  payload.append<int16_t>(254);      // temp mos
+  payload.append<int16_t>(312);      // temp motor
+  payload.append<int32_t>(1520);     // current motor
+  payload.append<int32_t>(1210);     // current in
+  payload.append<int32_t>(-30);      // id
+  payload.append<int32_t>(1490);     // iq
+  payload.append<int16_t>(455);      // duty
+  payload.append<int32_t>(12345);    // rpm
+  payload.append<int16_t>(421);      // v in
+  payload.append<int32_t>(20000);    // amp hours
+  payload.append<int32_t>(100);      // amp hours charged
+  payload.append<int32_t>(900000);   // watt hours
+  payload.append<int32_t>(3000);     // watt hours charged
+  payload.append<int32_t>(1000000);  // tachometer
+  payload.append<int32_t>(2000000);  // tachometer abs
+  payload.append<uint8_t>(0);        // fault
+  payload.append<int32_t>(180000);   // position
+  payload.append<uint8_t>(28);       // vesc id
+  payload.append<int16_t>(250);      // temp mos 1
+  payload.append<int16_t>(251);      // temp mos 2
+  payload.append<int16_t>(252);      // temp mos 3
+  payload.append<int32_t>(12000);    // vd
+  payload.append<int32_t>(24000);    // vq
+  vesc::packet p(payload);
+  return std::vector<uint8_t>(p.data().begin(), p.data().end());
+}
+
+// Feed a stream of back to back frames in chunk sized pieces and consume every frame the way parse_command does
+template <class P> unsigned int consume_stream(P &p, const std::vector<uint8_t> &stream, size_t chunk) {
+  auto frames = 0u;
+  for (auto i = 0u; i < stream.size(); i += chunk) {
+    p.data().append(stream.data() + i, std::min(chunk, stream.size() - i));
+    while (p.validate() == vesc::packet::VALIDATE_RESULT::VALID) {
+      p.data().advance(p.valid_len() + 3u);
+      p.clean();
+      frames++;
+    }
+  }
+  return frames;
+}
+
+void bench_rx_storage() {
+  constexpr auto FRAME_COUNT = 64u;
+  auto frame = telemetry_frame();
+  std::vector<uint8_t> stream;
+  for (auto i = 0u; i < FRAME_COUNT; i++) {
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  char line[120];
+  for (auto chunk : {20u, 244u}) {
+    // Static so the 520 byte and 2 KB buffers don't end up on the stack of a board
+    static vesc::packet linear;
+    static vesc::rx_packet ring;
+    auto frames = 0u;
+    auto t_linear = bench::measure([&]() { frames = consume_stream(linear, stream, chunk); }, 20u);
+    TEST_ASSERT_EQUAL(FRAME_COUNT, frames);
+    auto t_ring = bench::measure([&]() { frames = consume_stream(ring, stream, chunk); }, 20u);
+    TEST_ASSERT_EQUAL(FRAME_COUNT, frames);
+
+    snprintf(line, sizeof(line), "rx %u byte frames, %3u byte chunks: buffer %7.1f, ring_buffer %7.1f %s/frame",
+             static_cast<unsigned int>(frame.size()), chunk, t_linear / FRAME_COUNT, t_ring / FRAME_COUNT, bench::UNIT);
+    TEST_MESSAGE(line);
+    bench::record("rx_buffer", t_linear / FRAME_COUNT, frame.size(), chunk);
+    bench::record("rx_ring_buffer", t_ring / FRAME_COUNT, frame.size(), chunk);
+  }
+}
+
+// The byte at a time reads buffer used before the big endian loads, kept here to compare against
+struct legacy_reader {
+  const uint8_t *head;
+  size_t len;
+
+  template <class T> T get() {
+    T val{};
+    for (int i = sizeof(T) - 1; i >= 0; i--, head++) {
+      val |= (static_cast<T>(*head) << (i * 8));
+      len--;
+    }
+    return val;
+  }
+
+  float getfp(size_t bytes, float scale) {
+    int32_t val{};
+    for (int i = bytes - 1; i >= 0; i--, head++) {
+      val |= (static_cast<uint32_t>(*head) << (i * 8ul));
+      len--;
+    }
+    return static_cast<float>(val) / scale;
+  }
+};
+
+struct decoded_values {
+  float temp_mos, temp_motor, current_motor, current_in, id, iq, duty_now, rpm, v_in;
+  float amp_hours, amp_hours_charged, watt_hours, watt_hours_charged;
+  int32_t tachometer, tachometer_abs;
+  uint8_t fault_code;
+  float position;
+  uint8_t vesc_id;
+  float temp_mos1, temp_mos2, temp_mos3, vd, vq;
+};
+
+// The same reads controller::handleGetValuesSelective does for a full COMM_GET_VALUES
+template <class R> void decode_values(R &buf, decoded_values &v) {
+  v.temp_mos = buf.getfp(2, 10.0f);
+  v.temp_motor = buf.getfp(2, 10.0f);
+  v.current_motor = buf.getfp(4, 100.0f);
+  v.current_in = buf.getfp(4, 100.0f);
+  v.id = buf.getfp(4, 100.0f);
+  v.iq = buf.getfp(4, 100.0f);
+  v.duty_now = buf.getfp(2, 1000.0f);
+  v.rpm = buf.getfp(4, 1.0f);
+  v.v_in = buf.getfp(2, 10.0f);
+  v.amp_hours = buf.getfp(4, 10000.0f);
+  v.amp_hours_charged = buf.getfp(4, 10000.0f);
+  v.watt_hours = buf.getfp(4, 10000.0f);
+  v.watt_hours_charged = buf.getfp(4, 10000.0f);
+  v.tachometer = buf.template get<int32_t>();
+  v.tachometer_abs = buf.template get<int32_t>();
+  v.fault_code = buf.template get<uint8_t>();
+  v.position = buf.getfp(4, 1000000.0f);
+  v.vesc_id = buf.template get<uint8_t>();
+  v.temp_mos1 = buf.getfp(2, 10.0f);
+  v.temp_mos2 = buf.getfp(2, 10.0f);
+  v.temp_mos3 = buf.getfp(2, 10.0f);
+  v.vd = buf.getfp(4, 1000.0f);
+  v.vq = buf.getfp(4, 1000.0f);
+}
+
+void bench_values_decode() {
+  auto frame = telemetry_frame();
+  // Skip the two byte header and the command byte, and leave off the CRC and end byte
+  const auto payload = frame.data() + 3u;
+  const auto len = frame.size() - 3u - 3u;
+  static vesc::buffer<vesc::PACKET_MAX_LEN> b;
+  decoded_values v{};
+
+  auto t_legacy = bench::measure([&]() {
+    legacy_reader r{payload, len};
+    decode_values(r, v);
+    bench::keep(v);
+  });
+  auto t_buffer = bench::measure([&]() {
+    b.reset();
+    b.append(payload, len);
+    decode_values(b, v);
+    bench::keep(v);
+  });
+  // The buffer version includes copying the payload in, so measure that on its own too
+  auto t_copy = bench::measure([&]() {
+    b.reset();
+    b.append(payload, len);
+    bench::keep(b);
+  });
+
+  // What the controller does now, no copy at all
+  auto t_view = bench::measure([&]() {
+    vesc::packet_view view(payload, len);
+    decode_values(view, v);
+    bench::keep(v);
+  });
+
+  // The generated decoder from the message schema
+  vesc::mc_values mv{};
+  auto t_schema = bench::measure([&]() {
+    vesc::packet_view view(payload, len);
+    vesc::messages::get_values::decode(view, mv);
+    bench::keep(mv);
+  });
+
+  // A selective reply with just the drive profile, what the control loop polls for
+  vesc::buffer<32u> drive;
+  vesc::messages::get_values::encode_fields(drive, mv, vesc::profiles::DRIVE);
+  auto t_drive = bench::measure([&]() {
+    vesc::packet_view view(drive.begin(), drive.len());
+    vesc::messages::get_values::decode(view, mv, vesc::profiles::DRIVE);
+    bench::keep(mv);
+  });
+
+  char line[160];
+  snprintf(line, sizeof(line), "COMM_GET_VALUES decode: byte at a time %6.1f, big endian loads %6.1f, copy + decode %6.1f, "
+           "packet_view %6.1f %s", t_legacy, t_buffer - t_copy, t_buffer, t_view, bench::UNIT);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "COMM_GET_VALUES decode: schema %6.1f, drive profile %6.1f %s", t_schema, t_drive,
+           bench::UNIT);
+  TEST_MESSAGE(line);
+  bench::record("values_decode_bytewise", t_legacy, len);
+  bench::record("values_decode_buffer", t_buffer - t_copy, len);
+  bench::record("values_decode_packet_view", t_view, len);
+  bench::record("values_decode_schema", t_schema, len);
+  bench::record("values_decode_drive_profile", t_drive, drive.len());
+}
+
+// What the control loop sends at 50Hz or more, a duty cycle forwarded to the second vesc
+void bench_setpoint() {
+  float duty = 0.0f;
+  auto t_packet = bench::measure([&]() {
+    duty += 0.001f;
+    vesc::buffer<7u> payload;
+    payload.append<uint8_t>(COMM_FORWARD_CAN);
+    payload.append<uint8_t>(73);
+    vesc::messages::set_duty::encode(payload, {duty});
+    vesc::packet p(payload);
+    bench::keep(p);
+  });
+
+  vesc::message_frame<vesc::messages::set_duty, 2u> frame({COMM_FORWARD_CAN, 73});
+  auto t_frame = bench::measure([&]() {
+    duty += 0.001f;
+    frame.set({duty});
+    bench::keep(frame);
+  });
+
+  char line[120];
+  snprintf(line, sizeof(line), "COMM_SET_DUTY frame: packet %6.1f, message_frame %6.1f %s", t_packet, t_frame,
+           bench::UNIT);
+  TEST_MESSAGE(line);
+  bench::record("set_duty_packet", t_packet, 7u);
+  bench::record("set_duty_message_frame", t_frame, 7u);
+}
+
+// Finding and calling the callback for a packet type, the way controller used to with a map of std::function
+void bench_dispatch() {
+  const uint8_t data[] = {1, 2, 3, 4};
+  const uint8_t types[] = {COMM_GET_VALUES, COMM_FW_VERSION, COMM_GET_VALUES_SELECTIVE, COMM_PING_CAN};
+  auto total = 0u;
+
+  std::map<uint8_t, std::function<void(vesc::packet_view &)>> map;
+  vesc::dispatch_table<vesc::packet_view, 16u> table;
+  for (auto type : types) {
+    map[type] = [&](vesc::packet_view &p) { total += p.peek<uint8_t>(); };
+    table.subscribe(type, [&](vesc::packet_view &p) { total += p.peek<uint8_t>(); });
+  }
+
+  auto i = 0u;
+  auto t_map = bench::measure([&]() {
+    auto it = map.find(types[i++ & 3u]);
+    vesc::packet_view v(data, sizeof(data));
+    if (it != map.end()) { it->second(v); }
+  });
+  auto t_table = bench::measure([&]() { table.dispatch(types[i++ & 3u], vesc::packet_view(data, sizeof(data))); });
+  bench::keep(total);
+
+  char line[120];
+  snprintf(line, sizeof(line), "Callback dispatch: std::map %6.1f, dispatch_table %6.1f %s", t_map, t_table,
+           bench::UNIT);
+  TEST_MESSAGE(line);
+  bench::record("dispatch_map_function", t_map, 0u);
+  bench::record("dispatch_table", t_table, 0u);
+}
+
+// Appending and reading back a payload of int32s, the bulk of most messages
+void bench_buffer() {
+  constexpr auto COUNT = 64u;
+  static vesc::buffer<vesc::PACKET_MAX_PL_LEN> b;
+  auto t_append = bench::measure([&]() {
+    b.reset();
+    for (auto i = 0u; i < COUNT; i++) {
+      b.append<int32_t>(i);
+    }
+    bench::keep(b);
+  });
+
+  int32_t sum = 0;
+  auto t_get = bench::measure([&]() {
+    b.reload();
+    for (auto i = 0u; i < COUNT; i++) {
+      sum += b.get<int32_t>();
+    }
+    bench::keep(sum);
+  });
+
+  char line[120];
+  snprintf(line, sizeof(line), "buffer %u int32: append %6.1f, get %6.1f %s", COUNT, t_append, t_get, bench::UNIT);
+  TEST_MESSAGE(line);
+  bench::record("buffer_append_int32", t_append, COUNT * 4u);
+  bench::record("buffer_get_int32", t_get, COUNT * 4u);
+}
+
+// The COMM_FW_VERSION reply from a VESC 6
+std::vector<uint8_t> fw_frame() {
+  return {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+          0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x23, 0x3};
+}
+
+// validate() on a whole frame sitting in a packet, CRC included
+void bench_validate() {
+  char line[120];
+  for (const auto &frame : {fw_frame(), telemetry_frame()}) {
+    static vesc::packet p;
+    auto t = bench::measure([&]() {
+      p.reset();
+      p.data().append(frame.data(), frame.size());
+      bench::keep(p.validate());
+    });
+    snprintf(line, sizeof(line), "packet::validate %3u byte frame: %6.1f %s", static_cast<unsigned int>(frame.size()),
+             t, bench::UNIT);
+    TEST_MESSAGE(line);
+    bench::record(frame.size() == fw_frame().size() ? "validate_fw_version" : "validate_get_values", t, frame.size());
+  }
+}
+
+// The whole receive path: notifications into the framer, frames out to the controller and its handlers
+void bench_parse() {
+  struct stream_case {
+    const char *name;
+    std::vector<uint8_t> frame;
+  };
+  const std::array<stream_case, 2> cases = {{{"parse_fw_version", fw_frame()}, {"parse_get_values", telemetry_frame()}}};
+
+  constexpr auto FRAME_COUNT = 64u;
+  static vesc::controller controller;
+  static vesc::framer rx;
+  char line[120];
+  for (const auto &c : cases) {
+    std::vector<uint8_t> stream;
+    for (auto i = 0u; i < FRAME_COUNT; i++) {
+      stream.insert(stream.end(), c.frame.begin(), c.frame.end());
+    }
+
+    for (auto chunk : {20u, 64u, 244u}) {
+      auto frames = 0u;
+      auto t = bench::measure(
+          [&]() {
+            frames = 0u;
+            for (auto i = 0u; i < stream.size(); i += chunk) {
+              rx.append(stream.data() + i, std::min<size_t>(chunk, stream.size() - i));
+              frames += controller.parse_all(rx).frames;
+            }
+          },
+          20u);
+      TEST_ASSERT_EQUAL(FRAME_COUNT, frames);
+
+      snprintf(line, sizeof(line), "%s %3u byte chunks: %7.1f %s/frame", c.name, chunk, t / FRAME_COUNT, bench::UNIT);
+      TEST_MESSAGE(line);
+      bench::record(c.name, t / FRAME_COUNT, c.frame.size(), chunk);
+    }
+  }
+}
+
+// Random streams through the fuzz harness: good frames, garbage and frames with bits flipped, all mixed together
+void bench_fuzz_framer() {
+  uint32_t state = 0x12345678u;
+  auto next = [&]() {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+  };
+
+  auto telemetry = telemetry_frame();
+  auto fw = fw_frame();
+  std::vector<uint8_t> stream;
+  auto good = 0u;
+  while (stream.size() < 32u * 1024u) {
+    const auto &frame = next() & 1u ? telemetry : fw;
+    switch (next() % 4u) {
+    case 0u:
+      for (auto i = next() % 40u; i > 0u; i--) {
+        stream.push_back(next());
+      }
+      break;
+    case 1u: {
+      auto broken = frame;
+      broken[next() % broken.size()] ^= 1u << (next() % 8u);
+      stream.insert(stream.end(), broken.begin(), broken.end());
+      break;
+    }
+    default:
+      stream.insert(stream.end(), frame.begin(), frame.end());
+      good++;
+    }
+  }
+
+  // Random inputs for robustness, then the big stream for speed. The first two bytes pick the notification size and
+  // whether large frames are allowed.
+  for (auto run = 0u; run < 2000u; run++) {
+    std::vector<uint8_t> input(next() % 4000u);
+    for (auto &b : input) {
+      b = next();
+    }
+    fuzz::framer_stream(input.data(), input.size());
+  }
+
+  // A broken frame right at the end can still be waiting on the bytes its length claims, and the good frames after it
+  // with it. Zeros can't start a frame, so enough of them settles everything.
+  stream.insert(stream.end(), vesc::PACKET_MAX_LEN, 0u);
+  stream.insert(stream.begin(), {243u, 0u});
+  auto frames = 0u;
+  auto t = bench::measure([&]() { frames = fuzz::framer_stream(stream.data(), stream.size()); }, 5u);
+  // Garbage can't take a good frame with it
+  TEST_ASSERT_EQUAL(good, frames);
+
+  char line[120];
+  snprintf(line, sizeof(line), "fuzz stream %u bytes, %u/%u frames: %8.3f bytes/%s",
+           static_cast<unsigned int>(stream.size()), frames, good, stream.size() / t, bench::UNIT);
+  TEST_MESSAGE(line);
+  bench::record("fuzz_framer_stream", t, stream.size(), 244u);
+}
+
+// Firmware upload to a simulated vesc, in simulated time, against what the link could carry if it never waited.
+// Stop and wait is one chunk per round trip, the window should get close to the link's bandwidth.
+void bench_upload() {
+  struct link {
+    const char *name;
+    sim::link_params params;
+    std::size_t mtu;
+  };
+  // The BLE module talks to the vesc over a 115200 baud UART, a direct link is faster than that
+  static const std::array<link, 3> links = {{
+      {"ble_uart", {20000u, 11520u, 1000u, 0u, 0u, true}, 244u},
+      {"ble_uart_mtu23", {20000u, 11520u, 500u, 0u, 0u, true}, 20u},
+      {"ble_fast", {10000u, 60000u, 1000u, 0u, 0u, true}, 244u},
+  }};
+  std::vector<uint8_t> image(PAYLOAD_SIZE);
+  for (auto i = 0u; i < image.size(); i++) {
+    image[i] = payload[i];
+  }
+
+  for (const auto &l : links) {
+    const auto chunk = vesc::firmware_upload<>::chunk_for(l.mtu);
+    const auto overhead = vesc::firmware_upload<>::CHUNK_OVERHEAD;
+    const auto raw = static_cast<double>(l.params.bytes_per_s) * chunk / (chunk + overhead);
+    const auto wait = sim::upload(image, l.params, l.mtu, 1u);
+    const auto window = sim::upload(image, l.params, l.mtu, vesc::firmware_upload<>::MAX_WINDOW);
+    TEST_ASSERT_EQUAL(vesc::upload_state::DONE, wait.state);
+    TEST_ASSERT_EQUAL(vesc::upload_state::DONE, window.state);
+
+    char line[160];
+    snprintf(line, sizeof(line),
+             "upload %-14s %3u byte chunks: stop and wait %6u, window of %u %6u, link %6.0f bytes/s (%.0f%%)", l.name,
+             static_cast<unsigned int>(chunk), wait.stats.throughput(), window.stats.window,
+             window.stats.throughput(), raw, 100.0 * window.stats.throughput() / raw);
+    TEST_MESSAGE(line);
+    // Within 10% of the link
+    TEST_ASSERT_GREATER_THAN(0.9 * raw, window.stats.throughput());
+    // The times are simulated, converted so the JSON's mb_per_s is the upload's
+    char name[bench::NAME_LEN];
+    snprintf(name, sizeof(name), "upload_%s_wait", l.name);
+    bench::record(name, wait.stats.elapsed_us * 1000.0 / bench::ns_per_unit(), image.size(), chunk);
+    snprintf(name, sizeof(name), "upload_%s_window", l.name);
+    bench::record(name, window.stats.elapsed_us * 1000.0 / bench::ns_per_unit(), image.size(), chunk);
+  }
+}
+
+int run_benchmarks() {
+  UNITY_BEGIN();
+  RUN_TEST(bench_crc16);
+  RUN_TEST(bench_crc16_large);
+  RUN_TEST(bench_rx_storage);
+  RUN_TEST(bench_values_decode);
+  RUN_TEST(bench_setpoint);
+  RUN_TEST(bench_dispatch);
+  RUN_TEST(bench_buffer);
+  RUN_TEST(bench_validate);
+  RUN_TEST(bench_parse);
+  RUN_TEST(bench_fuzz_framer);
+  RUN_TEST(bench_upload);
+  bench::print_json();
+  return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup() {
+  // Give the serial monitor a chance to connect
+  delay(2000);
+  run_benchmarks();
+}
+
+void loop() {}
+#else
+int main(int argc, char *argv[]) { return run_benchmarks(); }
+#endif
@@ -0,0 +1,2070 @@
+#include "crc.h"
+#include "datatypes.h"
+#include "frame.h"
+#include "framer.h"
+#include "history.h"
+#include "message_frame.h"
+#include "nodes.h"
+#include "packet.h"
+#include "packet_view.h"
+#include "pool.h"
+#include "ring_buffer.h"
+#include "snapshot.h"
+#include "telemetry.h"
+#include "tx_batch.h"
+#include "upload.h"
+#include "vesc.h"
+#include "../sim/vesc_sim.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unity.h>
+#include <vector>
+
+// Helper function
+
+std::string toString(vesc::packet p) {
+  std::stringstream ss;
+
+  for (const auto v : p.data()) {
+    ss << "0x" << std::hex << static_cast<unsigned int>(v) << " ";
+  }
+
+  return ss.str();
+}
+
+void test_buffer_init() {
+  vesc::buffer<1> p;
+  TEST_ASSERT_EQUAL(p.len(), 0);
+}
+
+void test_buffer_append_uint8_t() {
+  vesc::buffer<100> p;
+
+  p.append<uint8_t>(0x11);
+  TEST_ASSERT_EQUAL(p.len(), 1);
+  auto i = p.get<uint8_t>();
+  TEST_ASSERT_EQUAL(0x11, i);
+}
+
+void test_buffer_append_int8_t() {
+  vesc::buffer<100> p;
+
+  p.append<int8_t>(-5);
+  TEST_ASSERT_EQUAL(p.len(), 1);
+  auto i = p.get<int8_t>();
+  TEST_ASSERT_EQUAL(-5, i);
+}
+
+void test_buffer_append_uint16_t() {
+  vesc::buffer<100> p;
+
+  p.append<uint16_t>(0xF011);
+  TEST_ASSERT_EQUAL(p.len(), 2);
+  auto i = p.get<uint16_t>();
+  TEST_ASSERT_EQUAL(0xF011, i);
+}
+
+void test_buffer_append_int16_t() {
+  vesc::buffer<100> p;
+
+  p.append<int16_t>(-1022);
+  TEST_ASSERT_EQUAL(p.len(), 2);
+  auto i = p.get<int16_t>();
+  TEST_ASSERT_EQUAL(-1022, i);
+}
+
+void test_buffer_append_uint32_t() {
+  vesc::buffer<100> p;
+
+  p.append<uint32_t>(0xF01142AA);
+  TEST_ASSERT_EQUAL(p.len(), 4);
+  auto i = p.get<uint32_t>();
+  TEST_ASSERT_EQUAL(0xF01142AA, i);
+}
+
+void test_buffer_append_int32_t() {
+  vesc::buffer<100> p;
+
+  p.append<int32_t>(-10223932);
+  TEST_ASSERT_EQUAL(p.len(), 4);
+  auto i = p.get<int32_t>();
+  TEST_ASSERT_EQUAL(-10223932, i);
+}
+
+void test_buffer_append_float() {
+
+  TEST_ASSERT_EQUAL(4, sizeof(float));
+  vesc::buffer<100> p;
+
+  auto f = -3.2435234;
+  p.append(f);
+  TEST_ASSERT_EQUAL(4, p.len());
+  auto i = p.getf();
+  TEST_ASSERT_EQUAL_FLOAT(f, i);
+}
+
+void test_buffer_append_multiple() {
+  vesc::buffer<100> p;
+
+  std::vector<int32_t> values = {100, -20, 23290809, -20200392, 0, -1, 1, 0x7FFFFFFF, 0x700000};
+
+  for (auto v : values) {
+    p.append<int32_t>(v);
+  }
+
+  for (auto v : values) {
+    TEST_ASSERT_EQUAL(v, p.get<int32_t>());
+  }
+}
+
+void test_buffer_append_multiple_types() {
+  vesc::buffer<100> p;
+
+  p.append<int32_t>(23984);
+  p.append<uint32_t>(1);
+  p.append<int32_t>(0);
+  p.append<int16_t>(-23984);
+  p.append(3.1415926f);
+  p.append<int8_t>('\0');
+  p.append<int8_t>('a');
+  p.append<uint8_t>('!');
+  p.append(23984.0f);
+  p.append<int32_t>(0x112233);
+  TEST_ASSERT_EQUAL(23984, p.get<int32_t>());
+  TEST_ASSERT_EQUAL(1, p.get<uint32_t>());
+  TEST_ASSERT_EQUAL(0, p.get<int32_t>());
+  TEST_ASSERT_EQUAL(-23984, p.get<int16_t>());
+  TEST_ASSERT_EQUAL_FLOAT(3.1415926f, p.getf());
+  TEST_ASSERT_EQUAL('\0', p.get<int8_t>());
+  TEST_ASSERT_EQUAL('a', p.get<int8_t>());
+  TEST_ASSERT_EQUAL('!', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL_FLOAT(23984.0f, p.getf());
+  TEST_ASSERT_EQUAL(0x112233, p.get<int32_t>());
+}
+
+void test_buffer_append_buffer() {
+  vesc::buffer<100> p;
+
+  std::string str = "Hello!";
+
+  p.copy(str);
+
+  TEST_ASSERT_EQUAL(6, p.len());
+  TEST_ASSERT_EQUAL('H', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('e', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('o', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('!', p.get<uint8_t>());
+}
+
+void test_buffer_copy_buffer() {
+  vesc::buffer<6> p1 = {'H', 'e', 'l', 'l', 'o', '!'};
+  vesc::buffer<100> p2;
+
+  TEST_ASSERT_EQUAL_MESSAGE(6, p1.len(), "Initializer list failed");
+
+  p2.copy(p1);
+
+  TEST_ASSERT_EQUAL_MESSAGE(6, p2.len(), "Copy didn't increase length of p2");
+  TEST_ASSERT_EQUAL(p1.len(), p2.len());
+  TEST_ASSERT_EQUAL('H', p2.get<uint8_t>());
+  TEST_ASSERT_EQUAL('e', p2.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p2.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p2.get<uint8_t>());
+  TEST_ASSERT_EQUAL('o', p2.get<uint8_t>());
+  TEST_ASSERT_EQUAL('!', p2.get<uint8_t>());
+}
+
+void test_buffer_initializer_list() {
+  vesc::buffer<6> p = {'H', 'e', 'l', 'l', 'o', '!'};
+
+  TEST_ASSERT_EQUAL(6, p.len());
+  TEST_ASSERT_EQUAL('H', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('e', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('l', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('o', p.get<uint8_t>());
+  TEST_ASSERT_EQUAL('!', p.get<uint8_t>());
+}
+
+void test_buffer_reload() {
+  vesc::buffer<30> b = {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+                        0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x23, 0x3};
+
+  b.get<uint32_t>();
+  b.get<uint32_t>();
+  b.reload();
+
+  TEST_ASSERT_EQUAL(30, b.len());
+  TEST_ASSERT_EQUAL(0x2, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x19, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x0, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x5, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x2, b.get<uint8_t>());
+  b.reload();
+
+  b.advance(0x2);
+  TEST_ASSERT_EQUAL(0x0, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x5, b.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x2, b.get<uint8_t>());
+}
+
+void test_packet_from_buffer() {
+  vesc::buffer<6> p1 = {'H', 'e', 'l', 'l', 'o', '!'};
+
+  vesc::packet packet1(p1);
+
+  // Should be start byte + len + buffer + 16 bit crc + stop
+  TEST_ASSERT_EQUAL_MESSAGE(11, packet1.len(), toString(p1).c_str());
+
+  vesc::buffer<1u> p2 = {0};
+
+  vesc::packet packet2(p2);
+
+  TEST_ASSERT_EQUAL(6, packet2.len());
+
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> p3;
+  for (auto i = 0ul; i < vesc::PACKET_MAX_PL_LEN / 2; i++) {
+    p3.append<uint16_t>(i);
+  }
+
+  vesc::packet packet3(p3);
+
+  TEST_ASSERT_EQUAL(vesc::PACKET_MAX_PL_LEN + 6, packet3.len());
+}
+
+void test_buffer_getfp_signed() {
+  vesc::buffer<100> p;
+
+  p.append<int16_t>(-55);
+  p.append<int32_t>(-123456);
+  p.append<int8_t>(-3);
+  p.append<int16_t>(32767);
+  TEST_ASSERT_EQUAL_FLOAT(-5.5f, p.getfp(2, 10.0f));
+  TEST_ASSERT_EQUAL_FLOAT(-123.456f, p.getfp(4, 1000.0f));
+  TEST_ASSERT_EQUAL_FLOAT(-3.0f, p.getfp(1, 1.0f));
+  TEST_ASSERT_EQUAL_FLOAT(3276.7f, p.getfp(2, 10.0f));
+  TEST_ASSERT_FALSE(p.has(1));
+}
+
+void test_buffer_float_special_values() {
+  vesc::buffer<100> p;
+
+  // Normal numbers take the IEEE 754 shortcut, the rest go the long way. Both have to agree with the wire format.
+  std::vector<float> values = {0.0f, 1.0f, -1.0f, 1e-30f, -2.5e20f, 0.5f, 123456.789f};
+  for (auto v : values) {
+    p.append(v);
+  }
+  for (auto v : values) {
+    auto f = p.getf();
+    TEST_ASSERT_EQUAL_FLOAT(v, f);
+  }
+
+  // Subnormals are flushed to 0 like the vesc does
+  p.append(1e-40f);
+  TEST_ASSERT_EQUAL_HEX32(0, p.get<uint32_t>());
+
+  // 1.0 on the wire
+  p.reset();
+  p.append(1.0f);
+  TEST_ASSERT_EQUAL_HEX32(0x3F800000, p.get<uint32_t>());
+}
+
+void test_byte_order() {
+  auto i = 0x11223344;
+  vesc::buffer<4> p;
+  p.append<uint32_t>(i);
+
+  TEST_ASSERT_EQUAL(0x11, p.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x22, p.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x33, p.get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x44, p.get<uint8_t>());
+}
+
+void test_simple_packet() {
+  vesc::buffer<1> p1 = {0};
+  std::array<uint8_t, 6> p2 = {0x02, 0x01, 0x00, 0x00, 0x00, 0x03};
+  vesc::packet pack(p1);
+
+  for (auto i = 0; i < p2.size(); i++) {
+    TEST_ASSERT_EQUAL(p2[i], pack.data().data().at(i));
+  }
+}
+
+void test_packet_bad_start() {
+  vesc::packet pack;
+  pack.data() = {0x04, 0x01, 0x00, 0x00, 0x00, 0x03};
+
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::BAD_START, pack.validate());
+}
+
+void test_packet_bad_end() {
+  vesc::packet pack;
+  pack.data() = {0x02, 0x01, 0x00, 0x00, 0x00, 0xFF};
+
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::BAD_END, pack.validate());
+}
+
+void test_packet_bad_crc() {
+
+  vesc::packet pack;
+  pack.data() = {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+                 0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x24, 0x3};
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INVALID_CRC, pack.validate());
+}
+
+void test_fw_packet() {
+  vesc::packet pack;
+  pack.data() = {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+                 0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x23, 0x3};
+
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, pack.validate());
+  TEST_ASSERT_EQUAL(COMM_FW_VERSION, pack.data().get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x05, pack.data().get<uint8_t>());
+  TEST_ASSERT_EQUAL(0x02, pack.data().get<uint8_t>());
+  TEST_ASSERT_EQUAL_STRING("UNITY", pack.data().get_string().c_str());
+  TEST_ASSERT_EQUAL(0x23, pack.data().get<uint8_t>());
+}
+
+void test_packet_fragmented() {
+  // A frame with a payload long enough to need the two byte length
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> payload;
+  for (auto i = 0u; i < 300u; i++) {
+    payload.append<uint8_t>(i);
+  }
+  vesc::packet tx(payload);
+  std::vector<uint8_t> frame(tx.data().begin(), tx.data().end());
+
+  for (auto chunk : {1u, 2u, 3u, 20u, 64u, 244u}) {
+    vesc::packet rx;
+    auto res = vesc::packet::VALIDATE_RESULT::INCOMPLETE;
+    for (auto i = 0u; i < frame.size(); i += chunk) {
+      TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INCOMPLETE, res);
+      rx.data().append(frame.data() + i, std::min<size_t>(chunk, frame.size() - i));
+      res = rx.validate();
+    }
+    TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, res);
+    TEST_ASSERT_EQUAL(300, rx.valid_len());
+    TEST_ASSERT_EQUAL(0, rx.data().get<uint8_t>());
+    TEST_ASSERT_EQUAL(1, rx.data().get<uint8_t>());
+  }
+}
+
+void test_packet_fragmented_bad_crc() {
+  vesc::buffer<100> payload = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  vesc::packet tx(payload);
+  std::vector<uint8_t> frame(tx.data().begin(), tx.data().end());
+  frame[8] ^= 0x40;
+
+  vesc::packet rx;
+  rx.data().append(frame.data(), 6);
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INCOMPLETE, rx.validate());
+  rx.data().append(frame.data() + 6, frame.size() - 6);
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INVALID_CRC, rx.validate());
+
+  // Resetting mid frame must not carry the old CRC state into the next frame
+  rx.reset();
+  frame[8] ^= 0x40;
+  rx.data().append(frame.data(), 6);
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INCOMPLETE, rx.validate());
+  rx.reset();
+  rx.data().append(frame.data(), frame.size());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, rx.validate());
+}
+
+void test_constexpr_frame() {
+  static constexpr auto fw = vesc::make_frame(COMM_FW_VERSION);
+  static_assert(fw.size() == 6u, "One byte payload plus overhead");
+  static_assert(fw[0] == 0x02 && fw[1] == 0x01 && fw[2] == COMM_FW_VERSION && fw[5] == 0x03, "Frame layout");
+
+  // Must match what packet builds at runtime
+  vesc::buffer<1> p1 = {COMM_FW_VERSION};
+  vesc::packet pack(p1);
+  TEST_ASSERT_EQUAL(pack.len(), fw.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pack.data().data().data(), fw.data(), fw.size());
+
+  static constexpr auto forwarded = vesc::make_frame(COMM_FORWARD_CAN, 73, COMM_GET_VALUES);
+  vesc::buffer<3> p2 = {COMM_FORWARD_CAN, 73, COMM_GET_VALUES};
+  vesc::packet pack2(p2);
+  TEST_ASSERT_EQUAL(pack2.len(), forwarded.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(pack2.data().data().data(), forwarded.data(), forwarded.size());
+
+  // And validate like anything else off the wire
+  vesc::packet rx;
+  rx.data().append(forwarded.data(), forwarded.size());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, rx.validate());
+  TEST_ASSERT_EQUAL(3, rx.valid_len());
+}
+
+void test_constexpr_frame_long() {
+  std::array<uint8_t, 300> payload{};
+  for (auto i = 0u; i < payload.size(); i++) {
+    payload[i] = i;
+  }
+  auto f = vesc::make_frame(payload);
+  TEST_ASSERT_EQUAL(306, f.size());
+  TEST_ASSERT_EQUAL(0x03, f[0]);
+
+  vesc::packet rx;
+  rx.data().append(f.data(), f.size());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, rx.validate());
+  TEST_ASSERT_EQUAL(300, rx.valid_len());
+}
+
+// Either side of where the length takes two bytes, built at runtime, at compile time and sent by the controller
+template <std::size_t _len> void check_frame_length() {
+  std::array<uint8_t, _len> payload{};
+  for (auto i = 0u; i < payload.size(); i++) {
+    payload[i] = i * 7u;
+  }
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> b;
+  b.append(payload.data(), payload.size());
+  vesc::packet tx(b);
+  const auto f = vesc::make_frame(payload);
+  TEST_ASSERT_EQUAL(f.size(), tx.len());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(f.data(), tx.data().data().data(), f.size());
+  TEST_ASSERT_EQUAL(_len > 255u ? 0x03 : 0x02, f[0]);
+
+  vesc::controller c;
+  std::vector<uint8_t> sent;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.insert(sent.end(), data, data + len); });
+  c.setMTU(1024u);
+  TEST_ASSERT_TRUE(c.sendPayload(payload.data(), payload.size()));
+  TEST_ASSERT_EQUAL(f.size(), sent.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(f.data(), sent.data(), f.size());
+
+  vesc::packet rx;
+  rx.data().append(sent.data(), sent.size());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, rx.validate());
+  TEST_ASSERT_EQUAL(_len, rx.valid_len());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(payload.data(), rx.data().begin(), _len);
+}
+
+void test_packet_length_boundary() {
+  check_frame_length<255u>();
+  check_frame_length<256u>();
+}
+
+void test_ring_buffer_wrap() {
+  vesc::ring_buffer<16> r;
+
+  // Move the head close to the end so the next values straddle the wrap
+  for (auto i = 0u; i < 13u; i++) {
+    r.append<uint8_t>(0xEE);
+  }
+  r.advance(13);
+  TEST_ASSERT_EQUAL(0, r.len());
+
+  r.append<uint32_t>(0xF01142AA);
+  r.append<int16_t>(-1022);
+  r.append(3.1415926f);
+  TEST_ASSERT_EQUAL(10, r.len());
+  TEST_ASSERT_EQUAL_HEX16(crc16(r.begin(), r.len()), r.crc());
+  TEST_ASSERT_EQUAL(0xF0, r.peek<uint8_t>());
+  TEST_ASSERT_EQUAL(0xF01142AA, r.get<uint32_t>());
+  TEST_ASSERT_EQUAL(-1022, r.get<int16_t>());
+  TEST_ASSERT_EQUAL_FLOAT(3.1415926f, r.getf());
+  TEST_ASSERT_EQUAL(0, r.len());
+
+  // Full, anything more gets dropped
+  std::array<uint8_t, 20> bytes{};
+  TEST_ASSERT_EQUAL(16, r.append(bytes.data(), bytes.size()));
+  TEST_ASSERT_EQUAL(0, r.space());
+}
+
+void test_ring_buffer_matches_buffer() {
+  vesc::ring_buffer<64> r;
+  vesc::buffer<64> b;
+
+  r.advance(r.append(std::array<uint8_t, 50>{}.data(), 50));
+  for (auto v : {100, -20, 23290809, -20200392, 0, -1}) {
+    r.append<int32_t>(v);
+    b.append<int32_t>(v);
+  }
+  TEST_ASSERT_EQUAL(b.len(), r.len());
+  TEST_ASSERT_EQUAL_HEX16(b.crc(), r.crc());
+  TEST_ASSERT_EQUAL_HEX16(b.crc(3, 9), r.crc(3, 9));
+  while (b.len()) {
+    auto expected = b.getfp(4, 100.0f);
+    auto actual = r.getfp(4, 100.0f);
+    TEST_ASSERT_EQUAL_FLOAT(expected, actual);
+  }
+}
+
+void test_rx_packet_back_to_back() {
+  vesc::rx_packet rx;
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> payload;
+  for (auto i = 0u; i < 70u; i++) {
+    payload.append<uint8_t>(i);
+  }
+  vesc::packet tx(payload);
+  std::vector<uint8_t> frame(tx.data().begin(), tx.data().end());
+
+  // Enough frames to go around the ring several times, fed in BLE sized chunks
+  std::vector<uint8_t> stream;
+  for (auto i = 0u; i < 50u; i++) {
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  auto frames = 0u;
+  for (auto i = 0u; i < stream.size(); i += 20u) {
+    rx.data().append(stream.data() + i, std::min<size_t>(20u, stream.size() - i));
+    while (rx.validate() == vesc::packet::VALIDATE_RESULT::VALID) {
+      TEST_ASSERT_EQUAL(70, rx.valid_len());
+      TEST_ASSERT_EQUAL(0, rx.data().peek<uint8_t>());
+      TEST_ASSERT_EQUAL(69, rx.data().peek<uint8_t>(69));
+      rx.data().advance(rx.valid_len() + 3u);
+      frames++;
+    }
+  }
+  TEST_ASSERT_EQUAL(50, frames);
+  TEST_ASSERT_EQUAL(0, rx.len());
+}
+
+void test_packet_view_reads_in_place() {
+  vesc::buffer<100> b;
+  b.append<uint8_t>(0x11);
+  b.append<int16_t>(-1022);
+  b.append<int32_t>(-150);
+  b.append(1.5f);
+  b.append<uint8_t>('h');
+  b.append<uint8_t>('i');
+  b.append<uint8_t>(0);
+
+  vesc::packet_view v(b.begin(), b.len());
+  TEST_ASSERT_EQUAL(b.len(), v.len());
+  TEST_ASSERT_EQUAL(b.crc(0, b.len()), v.crc());
+  TEST_ASSERT_EQUAL(0x11, v.get<uint8_t>());
+  TEST_ASSERT_EQUAL(-1022, v.peek<int16_t>());
+  TEST_ASSERT_EQUAL(-1022, v.get<int16_t>());
+  TEST_ASSERT_TRUE(v.has(4));
+  float fp = v.getfp(4, 100.0f);
+  TEST_ASSERT_EQUAL_FLOAT(-1.5f, fp);
+  float f = v.getf();
+  TEST_ASSERT_EQUAL_FLOAT(1.5f, f);
+  TEST_ASSERT_EQUAL_STRING("hi", v.get_string().c_str());
+  TEST_ASSERT_EQUAL(0, v.len());
+  TEST_ASSERT_FALSE(v.has(1));
+
+  // Nothing was consumed from the buffer underneath
+  TEST_ASSERT_EQUAL(14, b.len());
+  TEST_ASSERT_EQUAL(0x11, b.peek<uint8_t>());
+}
+
+void test_controller_dispatches_view() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  const uint8_t fw[] = {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+                        0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x23, 0x3};
+
+  auto calls = 0u;
+  c.setCallback(COMM_FW_VERSION, [&](vesc::packet_view &p) {
+    // The callback sees the payload after the type byte, straight out of the receive buffer
+    TEST_ASSERT_EQUAL(0x05, p.get<uint8_t>());
+    TEST_ASSERT_EQUAL(0x02, p.get<uint8_t>());
+    TEST_ASSERT_EQUAL_STRING("UNITY", p.get_string().c_str());
+    calls++;
+  });
+
+  // Twice, to make sure the first frame was consumed after dispatch
+  rx.data().append(fw, sizeof(fw));
+  rx.data().append(fw, sizeof(fw));
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+  TEST_ASSERT_EQUAL(sizeof(fw), rx.len());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+  TEST_ASSERT_EQUAL(0, rx.len());
+  TEST_ASSERT_EQUAL(2, calls);
+  TEST_ASSERT_EQUAL_STRING("UNITY", c.getHW().c_str());
+}
+
+void test_delegate_calls() {
+  struct counter {
+    int total;
+    void add(int v) { total += v; }
+  } c{0};
+
+  vesc::delegate<void(int)> none;
+  TEST_ASSERT_FALSE(none);
+
+  int seen = 0;
+  vesc::delegate<void(int)> lambda([&](int v) { seen = v; });
+  TEST_ASSERT_TRUE(lambda);
+  lambda(7);
+  TEST_ASSERT_EQUAL(7, seen);
+
+  auto bound = vesc::delegate<void(int)>::bind<counter, &counter::add>(&c);
+  bound(2);
+  bound(3);
+  TEST_ASSERT_EQUAL(5, c.total);
+
+  // Copies call the same thing
+  auto copy = lambda;
+  copy(9);
+  TEST_ASSERT_EQUAL(9, seen);
+}
+
+void test_dispatch_table_subscribers() {
+  vesc::dispatch_table<vesc::packet_view, 3> table;
+  const uint8_t data[] = {1, 2};
+  std::vector<int> calls;
+
+  TEST_ASSERT_FALSE(table.has(COMM_GET_VALUES));
+  TEST_ASSERT_EQUAL(0, table.dispatch(COMM_GET_VALUES, vesc::packet_view(data, sizeof(data))));
+
+  // Called in the order they subscribed, each with the view from the start
+  TEST_ASSERT_TRUE(table.subscribe(COMM_GET_VALUES, [&](vesc::packet_view &p) { calls.push_back(p.get<uint8_t>()); }));
+  TEST_ASSERT_TRUE(
+      table.subscribe(COMM_GET_VALUES, [&](vesc::packet_view &p) { calls.push_back(10 + p.get<uint8_t>()); }));
+  TEST_ASSERT_TRUE(table.subscribe(COMM_FW_VERSION, [&](vesc::packet_view &p) { calls.push_back(100); }));
+  TEST_ASSERT_EQUAL(2, table.dispatch(COMM_GET_VALUES, vesc::packet_view(data, sizeof(data))));
+  TEST_ASSERT_EQUAL(2, calls.size());
+  TEST_ASSERT_EQUAL(1, calls[0]);
+  TEST_ASSERT_EQUAL(11, calls[1]);
+
+  // Full
+  TEST_ASSERT_FALSE(table.subscribe(COMM_SET_RPM, [&](vesc::packet_view &p) { calls.push_back(200); }));
+
+  // Clearing one type gives its slots back without touching the others
+  table.clear(COMM_GET_VALUES);
+  TEST_ASSERT_FALSE(table.has(COMM_GET_VALUES));
+  TEST_ASSERT_TRUE(table.subscribe(COMM_SET_RPM, [&](vesc::packet_view &p) { calls.push_back(200); }));
+  calls.clear();
+  TEST_ASSERT_EQUAL(0, table.dispatch(COMM_GET_VALUES, vesc::packet_view(data, sizeof(data))));
+  TEST_ASSERT_EQUAL(1, table.dispatch(COMM_FW_VERSION, vesc::packet_view(data, sizeof(data))));
+  TEST_ASSERT_EQUAL(1, table.dispatch(COMM_SET_RPM, vesc::packet_view(data, sizeof(data))));
+  TEST_ASSERT_EQUAL(2, calls.size());
+  TEST_ASSERT_EQUAL(100, calls[0]);
+  TEST_ASSERT_EQUAL(200, calls[1]);
+}
+
+void test_controller_callbacks() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  const uint8_t fw[] = {0x2,  0x19, 0x0,  0x5,  0x2,  0x55, 0x4e, 0x49, 0x54, 0x59, 0x0, 0x23, 0x0,  0x1d, 0x0,
+                        0x17, 0x47, 0x39, 0x34, 0x35, 0x38, 0x34, 0x38, 0x0,  0x0,  0x0, 0x0,  0x5b, 0x23, 0x3};
+  auto first = 0u, second = 0u;
+
+  // setCallback replaces, subscribe adds
+  c.setCallback(COMM_FW_VERSION, [&](vesc::packet_view &p) { first += 100; });
+  c.setCallback(COMM_FW_VERSION, [&](vesc::packet_view &p) { first++; });
+  c.subscribe(COMM_FW_VERSION, [&](vesc::packet_view &p) { second++; });
+  rx.data().append(fw, sizeof(fw));
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+  TEST_ASSERT_EQUAL(1, first);
+  TEST_ASSERT_EQUAL(1, second);
+  // The built in handler still ran
+  TEST_ASSERT_EQUAL_STRING("UNITY", c.getHW().c_str());
+
+  c.clearCallback(COMM_FW_VERSION);
+  rx.data().append(fw, sizeof(fw));
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+  TEST_ASSERT_EQUAL(1, first);
+  TEST_ASSERT_EQUAL(1, second);
+}
+
+void test_schema_sizes() {
+  static_assert(vesc::messages::get_values::size == 72u, "full COMM_GET_VALUES payload");
+  static_assert(vesc::messages::get_values::size_of(vesc::values::TEMP_MOS | vesc::values::RPM) == 6u, "");
+  static_assert(vesc::messages::get_values::size_of(vesc::values::TEMP_MOSX) == 6u, "");
+  static_assert(vesc::messages::set_current::size == 4u, "");
+  // What selective polling saves
+  static_assert(vesc::messages::get_values::size_of(vesc::profiles::DRIVE) == 11u, "");
+  static_assert(vesc::messages::get_values::size_of(vesc::profiles::HEALTH) == 8u, "");
+}
+
+void test_schema_encode_matches_hand_written() {
+  vesc::buffer<7u> expected;
+  expected.append<uint8_t>(COMM_FORWARD_CAN);
+  expected.append<uint8_t>(73);
+  expected.append<uint8_t>(COMM_SET_CURRENT);
+  expected.append<int32_t>(-12.5f * 1000.0f);
+  vesc::packet expected_frame(expected);
+
+  std::vector<uint8_t> sent;
+  vesc::controller c;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.assign(data, data + len); });
+  TEST_ASSERT_TRUE(c.setCurrent(-12.5f, 73));
+  TEST_ASSERT_EQUAL(expected_frame.len(), sent.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_frame.data().begin(), sent.data(), sent.size());
+}
+
+void test_schema_decode_values() {
+  vesc::mc_values in{};
+  in.temp_mos = 25.4f;
+  in.current_motor = -15.2f;
+  in.duty_now = 0.455f;
+  in.rpm = 12345.0f;
+  in.tachometer = -1000;
+  in.fault_code = FAULT_CODE_OVER_VOLTAGE;
+  in.position = 0.18f;
+  in.vesc_id = 73;
+  in.vq = 24.0f;
+
+  vesc::buffer<100> b;
+  vesc::messages::get_values::encode(b, in);
+  TEST_ASSERT_EQUAL(vesc::messages::get_values::size + 1u, b.len());
+  TEST_ASSERT_EQUAL(COMM_GET_VALUES, b.get<uint8_t>());
+
+  vesc::mc_values out{};
+  vesc::packet_view v(b.begin(), b.len());
+  TEST_ASSERT_TRUE(vesc::messages::get_values::decode(v, out));
+  TEST_ASSERT_EQUAL(0, v.len());
+  TEST_ASSERT_EQUAL_FLOAT(25.4f, out.temp_mos);
+  TEST_ASSERT_EQUAL_FLOAT(-15.2f, out.current_motor);
+  TEST_ASSERT_EQUAL_FLOAT(0.455f, out.duty_now);
+  TEST_ASSERT_EQUAL_FLOAT(12345.0f, out.rpm);
+  TEST_ASSERT_EQUAL(-1000, out.tachometer);
+  TEST_ASSERT_EQUAL(FAULT_CODE_OVER_VOLTAGE, out.fault_code);
+  TEST_ASSERT_EQUAL_FLOAT(0.18f, out.position);
+  TEST_ASSERT_EQUAL(73, out.vesc_id);
+  TEST_ASSERT_EQUAL_FLOAT(24.0f, out.vq);
+
+  // Older firmware that stops after the position, the rest is left alone
+  vesc::mc_values old{};
+  old.vesc_id = 255u;
+  vesc::packet_view truncated(b.begin(), vesc::messages::get_values::size_of(0xFFFFu | vesc::values::POSITION));
+  uint32_t read = 0u;
+  TEST_ASSERT_FALSE(vesc::messages::get_values::decode(truncated, old, 0xFFFFFFFF, read));
+  TEST_ASSERT_EQUAL_FLOAT(0.18f, old.position);
+  TEST_ASSERT_EQUAL(255, old.vesc_id);
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFu | vesc::values::POSITION, read);
+
+  // Everything there, only the bits that name fields
+  vesc::packet_view all(b.begin(), b.len());
+  TEST_ASSERT_TRUE(vesc::messages::get_values::decode(all, old, 0xFFFFFFFF, read));
+  TEST_ASSERT_EQUAL_HEX32(0x1FFFFFu, read);
+}
+
+// Frames numbered by their first payload byte, so the test can tell which ones made it through
+std::vector<uint8_t> numbered_frame(uint8_t n, size_t len) {
+  vesc::buffer<vesc::PACKET_MAX_PL_LEN> payload;
+  payload.append<uint8_t>(n);
+  for (auto i = 1u; i < len; i++) {
+    payload.append<uint8_t>(i);
+  }
+  vesc::packet p(payload);
+  return std::vector<uint8_t>(p.data().begin(), p.data().end());
+}
+
+std::vector<uint8_t> frames_from(vesc::framer &f) {
+  std::vector<uint8_t> found;
+  while (f.validate() == vesc::packet::VALIDATE_RESULT::VALID) {
+    found.push_back(f.payload().peek<uint8_t>());
+    f.consume();
+  }
+  return found;
+}
+
+void test_framer_skips_garbage() {
+  vesc::framer f;
+  std::vector<uint8_t> stream = {0x00, 0xFF, 0x55};
+  auto a = numbered_frame(1, 10);
+  stream.insert(stream.end(), a.begin(), a.end());
+  stream.insert(stream.end(), {0x02, 0x03, 0x11});
+  auto b = numbered_frame(2, 300);
+  stream.insert(stream.end(), b.begin(), b.end());
+
+  f.append(stream.data(), stream.size());
+  auto found = frames_from(f);
+  TEST_ASSERT_EQUAL(2, found.size());
+  TEST_ASSERT_EQUAL(1, found[0]);
+  TEST_ASSERT_EQUAL(2, found[1]);
+  TEST_ASSERT_EQUAL(0, f.len());
+  TEST_ASSERT_EQUAL(2, f.stats().frames);
+  TEST_ASSERT_EQUAL(6, f.stats().bytes_dropped);
+}
+
+void test_framer_loses_only_the_bad_frame() {
+  // A corrupted CRC, a missing end byte and a bit flip in the payload, with good frames around each of them
+  std::vector<uint8_t> stream;
+  for (uint8_t n = 1u; n <= 7u; n++) {
+    auto frame = numbered_frame(n, 20u * n);
+    if (n == 2u) { frame[frame.size() - 2] ^= 0x01u; }
+    if (n == 4u) { frame.back() = 0x00u; }
+    if (n == 6u) { frame[10] ^= 0x80u; }
+    stream.insert(stream.end(), frame.begin(), frame.end());
+  }
+
+  // Fed in BLE sized notifications, like notifyCallback does
+  for (auto chunk : {1u, 20u, 244u}) {
+    vesc::framer f;
+    std::vector<uint8_t> found;
+    for (auto i = 0u; i < stream.size(); i += chunk) {
+      f.append(stream.data() + i, std::min<size_t>(chunk, stream.size() - i));
+      auto more = frames_from(f);
+      found.insert(found.end(), more.begin(), more.end());
+    }
+    TEST_ASSERT_EQUAL(4, found.size());
+    TEST_ASSERT_EQUAL(1, found[0]);
+    TEST_ASSERT_EQUAL(3, found[1]);
+    TEST_ASSERT_EQUAL(5, found[2]);
+    TEST_ASSERT_EQUAL(7, found[3]);
+    TEST_ASSERT_EQUAL(4, f.stats().frames);
+    // Start bytes inside the broken frames look like frames too, so there can be more failures than broken frames
+    TEST_ASSERT_TRUE(f.stats().invalid_crc >= 2u);
+    TEST_ASSERT_TRUE(f.stats().bad_end >= 1u);
+  }
+}
+
+void test_framer_impossible_length() {
+  // A start byte in the garbage claiming more than the vesc ever sends shouldn't hold up the frame behind it
+  vesc::framer f;
+  std::vector<uint8_t> stream = {0x03, 0xFF, 0xFF};
+  auto a = numbered_frame(9, 5);
+  stream.insert(stream.end(), a.begin(), a.end());
+  f.append(stream.data(), stream.size());
+
+  auto found = frames_from(f);
+  TEST_ASSERT_EQUAL(1, found.size());
+  TEST_ASSERT_EQUAL(9, found[0]);
+  TEST_ASSERT_EQUAL(1, f.stats().bad_start);
+}
+
+void test_parse_all_drains_notification() {
+  vesc::controller c;
+  vesc::framer rx;
+  std::vector<uint8_t> seen;
+  c.setCallback(COMM_GET_VALUES, [&](vesc::packet_view &p) { seen.push_back(p.peek<uint8_t>()); });
+
+  // Three frames, split so the second notification finishes the first frame and carries the other two whole
+  std::vector<uint8_t> stream;
+  for (uint8_t n = 1u; n <= 3u; n++) {
+    vesc::buffer<10> payload;
+    payload.append<uint8_t>(COMM_GET_VALUES);
+    payload.append<uint8_t>(n);
+    vesc::packet p(payload);
+    stream.insert(stream.end(), p.data().begin(), p.data().end());
+  }
+
+  rx.append(stream.data(), 3u);
+  auto res = c.parse_all(rx);
+  TEST_ASSERT_EQUAL(0, res.frames);
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INCOMPLETE, res.status);
+
+  rx.append(stream.data() + 3u, stream.size() - 3u);
+  res = c.parse_all(rx);
+  TEST_ASSERT_EQUAL(3, res.frames);
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::INCOMPLETE, res.status);
+  TEST_ASSERT_EQUAL(0, rx.len());
+  TEST_ASSERT_EQUAL(3, seen.size());
+  TEST_ASSERT_EQUAL(3, seen[2]);
+}
+
+struct pooled {
+  int value = 0;
+  void reset() { value = 0; }
+};
+
+void test_pool_acquire_release() {
+  vesc::pool<pooled, 3> p;
+  {
+    auto a = p.acquire();
+    auto b = p.acquire();
+    auto c = p.acquire();
+    TEST_ASSERT_TRUE(a && b && c);
+    TEST_ASSERT_TRUE(&*a != &*b && &*b != &*c && &*a != &*c);
+    a->value = 5;
+
+    auto d = p.acquire();
+    TEST_ASSERT_FALSE(d);
+    TEST_ASSERT_EQUAL(3, p.stats().in_use);
+    TEST_ASSERT_EQUAL(1, p.stats().exhausted);
+
+    // Moving a handle doesn't give the slot back
+    auto moved = std::move(a);
+    TEST_ASSERT_FALSE(a);
+    TEST_ASSERT_EQUAL(5, moved->value);
+    TEST_ASSERT_EQUAL(3, p.stats().in_use);
+
+    moved.release();
+    auto e = p.acquire();
+    TEST_ASSERT_TRUE(e);
+    // Handed out as good as new
+    TEST_ASSERT_EQUAL(0, e->value);
+  }
+  TEST_ASSERT_EQUAL(0, p.stats().in_use);
+  TEST_ASSERT_EQUAL(3, p.stats().high_water);
+}
+
+void test_controller_sends_from_pool() {
+  vesc::controller c;
+  auto sent = 0u;
+  c.setTX([&](const uint8_t *, size_t, bool) {
+    // The packet being sent is borrowed from the pool until the transport is done with it
+    TEST_ASSERT_EQUAL(1, c.packetStats().in_use);
+    sent++;
+  });
+  // Ids without a prebuilt setpoint frame go through the pool
+  TEST_ASSERT_TRUE(c.setDuty(0.1f, 12));
+  TEST_ASSERT_TRUE(c.setRPM(1000.0f, 13));
+  TEST_ASSERT_EQUAL(2, sent);
+  TEST_ASSERT_EQUAL(0, c.packetStats().in_use);
+  TEST_ASSERT_EQUAL(1, c.packetStats().high_water);
+  TEST_ASSERT_EQUAL(0, c.packetStats().exhausted);
+}
+
+void test_message_frame_matches_packet() {
+  vesc::message_frame<vesc::messages::set_duty> direct;
+  vesc::message_frame<vesc::messages::set_current, 2u> forwarded({COMM_FORWARD_CAN, 12});
+
+  std::srand(7);
+  for (auto i = 0; i < 200; i++) {
+    const float value = (std::rand() % 200001 - 100000) / 10.0f;
+    direct.set({value});
+    forwarded.set({value});
+
+    vesc::buffer<7u> d;
+    vesc::messages::set_duty::encode(d, {value});
+    vesc::packet expected_direct(d);
+    TEST_ASSERT_EQUAL(expected_direct.len(), direct.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_direct.data().begin(), direct.data(), direct.size());
+
+    vesc::buffer<7u> f;
+    f.append<uint8_t>(COMM_FORWARD_CAN);
+    f.append<uint8_t>(12);
+    vesc::messages::set_current::encode(f, {value});
+    vesc::packet expected_forwarded(f);
+    TEST_ASSERT_EQUAL(expected_forwarded.len(), forwarded.size());
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_forwarded.data().begin(), forwarded.data(), forwarded.size());
+  }
+}
+
+// Built by hand, packet can't hold these. Start byte 3 takes a two byte length, 4 a three byte one.
+std::vector<uint8_t> large_frame(uint8_t start, uint8_t n, size_t len) {
+  std::vector<uint8_t> payload(len);
+  payload[0] = n;
+  for (auto i = 1u; i < len; i++) {
+    payload[i] = i * 7u;
+  }
+  std::vector<uint8_t> frame = {start};
+  if (start == 4u) { frame.push_back(len >> 16); }
+  frame.push_back(len >> 8);
+  frame.push_back(len);
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  auto crc = crc16(payload.data(), payload.size());
+  frame.push_back(crc >> 8);
+  frame.push_back(crc);
+  frame.push_back(0x03);
+  return frame;
+}
+
+void test_framer_large_frames() {
+  std::vector<uint8_t> stream;
+  auto add = [&](const std::vector<uint8_t> &f) { stream.insert(stream.end(), f.begin(), f.end()); };
+  add(numbered_frame(1, 30));
+  add(large_frame(3, COMM_GET_MCCONF, 2000));
+  add(numbered_frame(3, 30));
+  add(large_frame(4, COMM_GET_APPCONF, 5000));
+  auto bad = large_frame(3, COMM_GET_MCCONF_DEFAULT, 1500);
+  bad[700] ^= 0x01u;
+  add(bad);
+  add(numbered_frame(6, 30));
+
+  for (auto chunk : {20u, 244u}) {
+    vesc::framer f;
+    f.allow_large(true);
+    std::vector<uint8_t> found;
+    std::vector<size_t> lens;
+    for (auto i = 0u; i < stream.size(); i += chunk) {
+      TEST_ASSERT_EQUAL(std::min<size_t>(chunk, stream.size() - i),
+                        f.append(stream.data() + i, std::min<size_t>(chunk, stream.size() - i)));
+      while (f.validate() == vesc::packet::VALIDATE_RESULT::VALID) {
+        auto view = f.payload();
+        found.push_back(view.peek<uint8_t>());
+        lens.push_back(view.len());
+        if (view.len() > 1000u) { TEST_ASSERT_EQUAL(static_cast<uint8_t>(999u * 7u), view.peek<uint8_t>(999)); }
+        f.consume();
+      }
+    }
+    TEST_ASSERT_EQUAL(5, found.size());
+    TEST_ASSERT_EQUAL(1, found[0]);
+    TEST_ASSERT_EQUAL(COMM_GET_MCCONF, found[1]);
+    TEST_ASSERT_EQUAL(2000, lens[1]);
+    TEST_ASSERT_EQUAL(3, found[2]);
+    TEST_ASSERT_EQUAL(COMM_GET_APPCONF, found[3]);
+    TEST_ASSERT_EQUAL(5000, lens[3]);
+    TEST_ASSERT_EQUAL(6, found[4]);
+    TEST_ASSERT_EQUAL(3, f.stats().large_frames);
+    TEST_ASSERT_EQUAL(0, f.stats().bytes_lost);
+    TEST_ASSERT_EQUAL(0, f.len());
+  }
+}
+
+void test_framer_large_frame_not_allowed() {
+  vesc::framer f;
+  std::vector<uint8_t> stream = large_frame(3, COMM_GET_MCCONF, 2000);
+  auto a = numbered_frame(1, 30);
+  stream.insert(stream.end(), a.begin(), a.end());
+  f.append(stream.data(), 244u);
+  f.append(stream.data() + stream.size() - a.size(), a.size());
+
+  // Without allow_large the header is just a bad start, and the frame behind it still comes through
+  auto found = frames_from(f);
+  TEST_ASSERT_EQUAL(1, found.size());
+  TEST_ASSERT_EQUAL(1, found[0]);
+  TEST_ASSERT_EQUAL(0, f.stats().large_frames);
+}
+
+void test_controller_large_frame() {
+  vesc::controller c;
+  vesc::framer rx;
+  rx.allow_large(true);
+  size_t len = 0u;
+  c.setCallback(COMM_GET_MCCONF, [&](vesc::packet_view &p) { len = p.len(); });
+
+  auto frame = large_frame(3, COMM_GET_MCCONF, 3000);
+  for (auto i = 0u; i < frame.size(); i += 244u) {
+    rx.append(frame.data() + i, std::min<size_t>(244u, frame.size() - i));
+    c.parse_all(rx);
+  }
+  TEST_ASSERT_EQUAL(2999, len);
+  TEST_ASSERT_EQUAL(0, rx.len());
+}
+
+void test_request_tracker_rtt() {
+  vesc::request_tracker<4> t;
+  constexpr auto LOCAL = vesc::request_tracker<4>::LOCAL;
+
+  auto local = t.track(COMM_GET_VALUES, LOCAL, 100000u, nullptr, 1000u);
+  auto fw = t.track(COMM_FW_VERSION, LOCAL, 100000u, nullptr, 1500u);
+  auto second = t.track(COMM_GET_VALUES, 73, 100000u, nullptr, 2000u);
+  TEST_ASSERT_TRUE(local && fw && second);
+  TEST_ASSERT_EQUAL(3, t.in_flight());
+
+  // A reply that says where it's from answers the request to that id, the local vesc replies with its own id
+  TEST_ASSERT_TRUE(t.complete(COMM_GET_VALUES, 73, 5000u));
+  TEST_ASSERT_EQUAL(vesc::request_status::PENDING, t.result(local).status);
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, t.result(second).status);
+  TEST_ASSERT_EQUAL(3000, t.result(second).rtt_us);
+  TEST_ASSERT_TRUE(t.complete(COMM_GET_VALUES, 28, 6000u));
+  TEST_ASSERT_EQUAL(5000, t.result(local).rtt_us);
+  TEST_ASSERT_FALSE(t.complete(COMM_GET_VALUES, 28, 7000u));
+
+  TEST_ASSERT_TRUE(t.complete(COMM_FW_VERSION, vesc::request_tracker<4>::ANY, 2500u));
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, t.result(fw).status);
+  TEST_ASSERT_EQUAL(0, t.in_flight());
+
+  auto values = t.stats(COMM_GET_VALUES);
+  TEST_ASSERT_EQUAL(2, values.count);
+  TEST_ASSERT_EQUAL(3000, values.min_us);
+  TEST_ASSERT_EQUAL(5000, values.max_us);
+  TEST_ASSERT_EQUAL(5000, values.last_us);
+  TEST_ASSERT_EQUAL(1, t.stats(COMM_FW_VERSION).count);
+  TEST_ASSERT_EQUAL(0, t.stats(COMM_SET_RPM).count);
+}
+
+void test_request_tracker_timeouts() {
+  vesc::request_tracker<2> t;
+  std::vector<vesc::request_status> finished;
+  auto done = [&](vesc::request_result r) { finished.push_back(r.status); };
+
+  auto first = t.track(COMM_GET_VALUES, -1, 1000u, done, 0u);
+  auto second = t.track(COMM_GET_VALUES, -1, 5000u, done, 0u);
+  // Full until one of them finishes
+  TEST_ASSERT_FALSE(t.track(COMM_GET_VALUES, -1, 1000u, done, 0u));
+
+  TEST_ASSERT_EQUAL(0, t.expire(999u));
+  TEST_ASSERT_EQUAL(1, t.expire(1000u));
+  TEST_ASSERT_EQUAL(1, finished.size());
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, finished[0]);
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, t.result(first).status);
+  TEST_ASSERT_EQUAL(1, t.stats(COMM_GET_VALUES).timeouts);
+
+  // A late reply goes to the request still waiting
+  TEST_ASSERT_TRUE(t.complete(COMM_GET_VALUES, -2, 1200u));
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, finished[1]);
+  TEST_ASSERT_EQUAL(1200, t.result(second).rtt_us);
+
+  // Once a slot is used again the old request is forgotten
+  auto third = t.track(COMM_FW_VERSION, -1, 1000u, done, 2000u);
+  auto fourth = t.track(COMM_FW_VERSION, -1, 1000u, done, 2000u);
+  TEST_ASSERT_TRUE(third && fourth);
+  TEST_ASSERT_EQUAL(vesc::request_status::UNKNOWN, t.result(first).status);
+  TEST_ASSERT_EQUAL(vesc::request_status::UNKNOWN, t.result(vesc::request()).status);
+
+  t.cancel(third);
+  TEST_ASSERT_EQUAL(vesc::request_status::CANCELLED, t.result(third).status);
+  t.clear();
+  TEST_ASSERT_EQUAL(0, t.in_flight());
+  TEST_ASSERT_EQUAL(4, finished.size());
+  TEST_ASSERT_EQUAL(vesc::request_status::CANCELLED, finished[3]);
+  TEST_ASSERT_EQUAL(vesc::request_status::CANCELLED, t.result(fourth).status);
+  TEST_ASSERT_EQUAL(0, t.stats(COMM_FW_VERSION).timeouts);
+}
+
+void test_controller_request_reply() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  auto sent = 0u;
+
+  TEST_ASSERT_FALSE(c.getValues());
+  c.setTX([&](const uint8_t *, size_t, bool response) {
+    TEST_ASSERT_TRUE(response);
+    sent++;
+  });
+
+  vesc::request_result finished{};
+  auto r = c.getValues(0xFFFFFFFF, 73, [&](vesc::request_result res) { finished = res; });
+  TEST_ASSERT_TRUE(r);
+  TEST_ASSERT_EQUAL(1, sent);
+  TEST_ASSERT_EQUAL(1, c.inFlight());
+  TEST_ASSERT_EQUAL(vesc::request_status::PENDING, c.result(r).status);
+
+  // The second vesc's reply, which says it's from 73
+  vesc::mc_values vals{};
+  vals.vesc_id = 73;
+  vals.v_in = 42.0f;
+  vesc::buffer<100> b;
+  vesc::messages::get_values::encode(b, vals);
+  vesc::packet reply(b);
+  rx.data().append(reply.data().begin(), reply.len());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, finished.status);
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.wait(r).status);
+  TEST_ASSERT_EQUAL(0, c.inFlight());
+  TEST_ASSERT_EQUAL(1, c.rtt(COMM_GET_VALUES).count);
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, c.values2().v_in);
+
+  // Nothing answers this one, so waiting gives up at the deadline
+  c.setRequestTimeout(1000u);
+  auto fw = c.getFW();
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, c.wait(fw).status);
+  TEST_ASSERT_EQUAL(1, c.rtt(COMM_FW_VERSION).timeouts);
+}
+
+void test_controller_selective_values() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  std::vector<uint8_t> sent;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.assign(data, data + len); });
+
+  // Forwarded to the second vesc with the whole 32 bit mask
+  TEST_ASSERT_FALSE(c.getSecondValues(vesc::profiles::DRIVE));
+  TEST_ASSERT_TRUE(c.addNode(73));
+  vesc::buffer<7u> expected;
+  expected.append<uint8_t>(COMM_FORWARD_CAN);
+  expected.append<uint8_t>(73);
+  expected.append<uint8_t>(COMM_GET_VALUES_SELECTIVE);
+  expected.append<uint32_t>(vesc::profiles::DRIVE);
+  vesc::packet expected_frame(expected);
+  auto r = c.getSecondValues(vesc::profiles::DRIVE);
+  TEST_ASSERT_TRUE(r);
+  TEST_ASSERT_EQUAL(expected_frame.len(), sent.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected_frame.data().begin(), sent.data(), sent.size());
+
+  // The vesc id is always asked for, so the reply can be told apart
+  TEST_ASSERT_TRUE(c.getValues(vesc::values::V_IN));
+  vesc::buffer<6u> local;
+  local.append<uint8_t>(COMM_GET_VALUES_SELECTIVE);
+  local.append<uint32_t>(vesc::values::V_IN | vesc::values::VESC_ID);
+  vesc::packet local_frame(local);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(local_frame.data().begin(), sent.data(), sent.size());
+
+  // A full reply first, then a drive reply that only changes what it carries
+  vesc::mc_values vals{};
+  vals.vesc_id = 73;
+  vals.v_in = 42.0f;
+  vals.rpm = 1000.0f;
+  vesc::buffer<100> full;
+  vesc::messages::get_values::encode(full, vals);
+  vesc::packet full_frame(full);
+  rx.data().append(full_frame.data().begin(), full_frame.len());
+
+  vals.v_in = 0.0f;
+  vals.rpm = 2500.0f;
+  vals.duty_now = 0.5f;
+  vesc::buffer<32> drive;
+  drive.append<uint8_t>(COMM_GET_VALUES_SELECTIVE);
+  drive.append<uint32_t>(vesc::profiles::DRIVE);
+  vesc::messages::get_values::encode_fields(drive, vals, vesc::profiles::DRIVE);
+  TEST_ASSERT_EQUAL(16, drive.len());
+  vesc::packet drive_frame(drive);
+  rx.data().append(drive_frame.data().begin(), drive_frame.len());
+
+  TEST_ASSERT_EQUAL(2, c.parse_all(rx).frames);
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, c.values2().v_in);
+  TEST_ASSERT_EQUAL_FLOAT(2500.0f, c.values2().rpm);
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, c.values2().duty_now);
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.result(r).status);
+}
+
+void test_controller_merges_partial_values() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  c.setTX([](const uint8_t *, size_t, bool) {});
+  TEST_ASSERT_EQUAL(0, c.record().valid);
+
+  // Older firmware that stops after the position, so it can't say who it's from
+  vesc::mc_values vals{};
+  vals.v_in = 42.0f;
+  vals.rpm = 1000.0f;
+  vals.position = 0.5f;
+  vesc::buffer<100> full;
+  vesc::messages::get_values::encode(full, vals);
+  const auto old_len = 1u + vesc::messages::get_values::size_of(0xFFFFu | vesc::values::POSITION);
+  vesc::buffer<100> old;
+  old.append(full.begin(), old_len);
+  vesc::packet old_frame(old);
+  rx.data().append(old_frame.data().begin(), old_frame.len());
+  TEST_ASSERT_EQUAL(1, c.parse_all(rx).frames);
+
+  // What it didn't send isn't made up
+  auto rec = c.record();
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFu | vesc::values::POSITION, rec.valid);
+  TEST_ASSERT_EQUAL_HEX32(rec.valid, rec.updated);
+  TEST_ASSERT_EQUAL(0, rec.values.vesc_id);
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, rec.values.position);
+  const auto first = rec.received_us;
+
+  // A selective reply only updates what it carries, and is newer
+  vals.v_in = 0.0f;
+  vals.rpm = 2500.0f;
+  vals.vq = 3.0f;
+  const auto mask = vesc::values::RPM | vesc::values::VQ;
+  vesc::buffer<32> partial;
+  partial.append<uint8_t>(COMM_GET_VALUES_SELECTIVE);
+  partial.append<uint32_t>(mask);
+  vesc::messages::get_values::encode_fields(partial, vals, mask);
+  vesc::packet partial_frame(partial);
+  rx.data().append(partial_frame.data().begin(), partial_frame.len());
+  TEST_ASSERT_EQUAL(1, c.parse_all(rx).frames);
+
+  rec = c.record();
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, rec.values.v_in);
+  TEST_ASSERT_EQUAL_FLOAT(2500.0f, rec.values.rpm);
+  TEST_ASSERT_EQUAL_FLOAT(3.0f, rec.values.vq);
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFu | vesc::values::POSITION | vesc::values::VQ, rec.valid);
+  TEST_ASSERT_EQUAL_HEX32(mask, rec.updated);
+  TEST_ASSERT_TRUE(rec.received_us - first < 1000000u);
+}
+
+// A reply from a vesc the way it comes over the link
+vesc::packet values_reply(uint8_t id, float v_in) {
+  vesc::mc_values vals{};
+  vals.vesc_id = id;
+  vals.v_in = v_in;
+  vesc::buffer<100> b;
+  vesc::messages::get_values::encode(b, vals);
+  return vesc::packet(b);
+}
+
+void test_controller_can_nodes() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  std::vector<uint8_t> sent;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.assign(data, data + len); });
+  TEST_ASSERT_EQUAL(0, c.nodes().size());
+
+  // The local vesc says which ids answered the ping
+  auto ping = c.scanCAN();
+  TEST_ASSERT_TRUE(ping);
+  TEST_ASSERT_EQUAL(COMM_PING_CAN, sent[2]);
+  vesc::buffer<4u> ids;
+  for (uint8_t b : {static_cast<int>(COMM_PING_CAN), 12, 73, 101}) {
+    ids.append(b);
+  }
+  vesc::packet pong(ids);
+  rx.data().append(pong.data().begin(), pong.len());
+  TEST_ASSERT_EQUAL(vesc::packet::VALIDATE_RESULT::VALID, c.parse_command(rx));
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.result(ping).status);
+  TEST_ASSERT_EQUAL(3, c.nodes().size());
+  TEST_ASSERT_EQUAL(12, c.nodes()[0].id);
+  TEST_ASSERT_EQUAL(101, c.nodes()[2].id);
+
+  // The local vesc's id comes from the reply to a request sent to it
+  TEST_ASSERT_EQUAL(-1, c.local().id);
+  TEST_ASSERT_TRUE(c.getValues());
+  TEST_ASSERT_TRUE(c.getValues(vesc::profiles::ALL, 101));
+  auto reply = values_reply(101, 48.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  reply = values_reply(28, 36.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  // And one nobody asked for
+  reply = values_reply(73, 24.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  TEST_ASSERT_EQUAL(3, c.parse_all(rx).frames);
+  TEST_ASSERT_EQUAL(28, c.local().id);
+  TEST_ASSERT_EQUAL_FLOAT(36.0f, c.values().v_in);
+  TEST_ASSERT_EQUAL_FLOAT(48.0f, c.node(101)->record.load().values.v_in);
+  TEST_ASSERT_EQUAL_FLOAT(24.0f, c.node(73)->record.load().values.v_in);
+  TEST_ASSERT_EQUAL(c.node(28), &c.local());
+  TEST_ASSERT_EQUAL(1, c.node(101)->health.replies);
+  TEST_ASSERT_EQUAL(0, c.node(73)->health.replies);
+  // The ping and the values
+  TEST_ASSERT_EQUAL(2, c.local().health.replies);
+
+  // A node's setpoints come from its own frames, the same bytes as one built from scratch
+  TEST_ASSERT_TRUE(c.setDuty(0.25f, 12));
+  auto from_node = sent;
+  vesc::controller other;
+  other.setTX([&](const uint8_t *data, size_t len, bool) { sent.assign(data, data + len); });
+  TEST_ASSERT_TRUE(other.setDuty(0.25f, 12));
+  TEST_ASSERT_EQUAL(from_node.size(), sent.size());
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(from_node.data(), sent.data(), sent.size());
+  TEST_ASSERT_EQUAL(0, c.packetStats().high_water);
+
+  // setDuties() goes to the first node, and fails when there isn't one
+  TEST_ASSERT_TRUE(c.setDuties(0.1f, 0.2f));
+  TEST_ASSERT_EQUAL(12, sent[3]);
+  TEST_ASSERT_FALSE(other.setDuties(0.1f, 0.2f));
+
+  // Unanswered requests count against the node
+  c.setRequestTimeout(1u);
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, c.wait(c.getFW(73)).status);
+  TEST_ASSERT_EQUAL(1, c.node(73)->health.timeouts);
+}
+
+void test_controller_late_node_reply() {
+  vesc::controller c;
+  vesc::rx_packet rx;
+  std::vector<uint8_t> sent;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.assign(data, data + len); });
+  TEST_ASSERT_TRUE(c.addNode(12));
+
+  // A node's reply that comes in after its request timed out, while one to the local vesc is waiting
+  c.setRequestTimeout(1u);
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, c.wait(c.getValues(vesc::profiles::ALL, 12)).status);
+  c.setRequestTimeout(vesc::controller::DEFAULT_REQUEST_TIMEOUT_US);
+  auto local = c.getValues();
+  TEST_ASSERT_TRUE(local);
+  auto reply = values_reply(12, 40.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  TEST_ASSERT_EQUAL(1, c.parse_all(rx).frames);
+
+  // It's still the node's, and doesn't answer for the local vesc or give it the node's id
+  TEST_ASSERT_EQUAL(-1, c.local().id);
+  TEST_ASSERT_EQUAL(vesc::request_status::PENDING, c.result(local).status);
+  TEST_ASSERT_EQUAL_FLOAT(40.0f, c.node(12)->record.load().values.v_in);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, c.values().v_in);
+
+  reply = values_reply(28, 36.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  TEST_ASSERT_EQUAL(1, c.parse_all(rx).frames);
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.result(local).status);
+  TEST_ASSERT_EQUAL(28, c.local().id);
+  TEST_ASSERT_EQUAL_FLOAT(36.0f, c.values().v_in);
+
+  // The local vesc's id is only learned once, and the second motor is still forwarded to
+  TEST_ASSERT_TRUE(c.getValues());
+  reply = values_reply(55, 41.0f);
+  rx.data().append(reply.data().begin(), reply.len());
+  TEST_ASSERT_EQUAL(1, c.parse_all(rx).frames);
+  TEST_ASSERT_EQUAL(28, c.local().id);
+  TEST_ASSERT_TRUE(c.setDuties(0.1f, 0.2f));
+  TEST_ASSERT_EQUAL(COMM_FORWARD_CAN, sent[2]);
+  TEST_ASSERT_EQUAL(12, sent[3]);
+}
+
+void test_tx_batch_packs_frames() {
+  vesc::tx_batch<64u> batch;
+  std::vector<std::vector<uint8_t>> writes;
+  std::vector<bool> responses;
+  auto write = [&](const uint8_t *data, size_t len, bool response) {
+    writes.emplace_back(data, data + len);
+    responses.push_back(response);
+  };
+  const uint8_t a[12] = {1}, b[10] = {2}, big[30] = {3};
+
+  // At the default MTU two setpoints don't fit in one write
+  TEST_ASSERT_EQUAL(20, batch.mtu());
+  batch.add(a, sizeof(a), false, write);
+  batch.add(b, sizeof(b), false, write);
+  batch.flush(write);
+  TEST_ASSERT_EQUAL(2, writes.size());
+
+  writes.clear();
+  responses.clear();
+  batch.set_mtu(244u);
+  TEST_ASSERT_EQUAL(64, batch.mtu());
+  batch.add(a, sizeof(a), false, write);
+  batch.add(b, sizeof(b), true, write);
+  TEST_ASSERT_EQUAL(0, writes.size());
+  batch.flush(write);
+  TEST_ASSERT_EQUAL(1, writes.size());
+  TEST_ASSERT_EQUAL(22, writes[0].size());
+  TEST_ASSERT_EQUAL(1, writes[0][0]);
+  TEST_ASSERT_EQUAL(2, writes[0][12]);
+  TEST_ASSERT_TRUE(responses[0]);
+
+  // Frames aren't split, what doesn't fit goes in the next write
+  writes.clear();
+  batch.set_mtu(40u);
+  batch.add(a, sizeof(a), false, write);
+  batch.add(big, sizeof(big), false, write);
+  batch.add(b, sizeof(b), false, write);
+  batch.flush(write);
+  TEST_ASSERT_EQUAL(2, writes.size());
+  TEST_ASSERT_EQUAL(12, writes[0].size());
+  TEST_ASSERT_EQUAL(40, writes[1].size());
+  batch.flush(write);
+  TEST_ASSERT_EQUAL(2, writes.size());
+}
+
+void test_controller_batches_setpoints() {
+  vesc::controller c;
+  std::vector<std::vector<uint8_t>> writes;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { writes.emplace_back(data, data + len); });
+  c.addNode(73);
+  c.setMTU(244u);
+
+  // Both motors in one write
+  TEST_ASSERT_TRUE(c.setDuties(0.1f, 0.2f));
+  TEST_ASSERT_EQUAL(1, writes.size());
+  TEST_ASSERT_EQUAL(22, writes[0].size());
+  TEST_ASSERT_EQUAL(COMM_SET_DUTY, writes[0][2]);
+  TEST_ASSERT_EQUAL(COMM_FORWARD_CAN, writes[0][12]);
+  TEST_ASSERT_EQUAL(73, writes[0][13]);
+
+  // A whole control tick, requests and all
+  writes.clear();
+  c.beginBatch();
+  TEST_ASSERT_TRUE(c.getValues(vesc::profiles::DRIVE));
+  TEST_ASSERT_TRUE(c.getValues(vesc::profiles::DRIVE, 73));
+  TEST_ASSERT_TRUE(c.setDuties(0.1f, 0.2f));
+  TEST_ASSERT_EQUAL(0, writes.size());
+  c.flush();
+  TEST_ASSERT_EQUAL(1, writes.size());
+  TEST_ASSERT_EQUAL(10 + 12 + 10 + 12, writes[0].size());
+  TEST_ASSERT_EQUAL(6, c.txStats().frames);
+  TEST_ASSERT_EQUAL(2, c.txStats().writes);
+}
+
+void test_snapshot_load_store() {
+  vesc::snapshot<vesc::mc_values> s;
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, s.load().v_in);
+
+  vesc::mc_values v{};
+  v.v_in = 42.0f;
+  v.rpm = 1000.0f;
+  s.store(v);
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, s.load().v_in);
+
+  // update() only changes what it's given
+  s.update([](vesc::mc_values &v) { v.rpm = 2000.0f; });
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, s.load().v_in);
+  TEST_ASSERT_EQUAL_FLOAT(2000.0f, s.load().rpm);
+
+  auto copy = s;
+  s.update([](vesc::mc_values &v) { v.v_in = 36.0f; });
+  TEST_ASSERT_EQUAL_FLOAT(42.0f, copy.load().v_in);
+  TEST_ASSERT_EQUAL_FLOAT(36.0f, s.load().v_in);
+}
+
+// Every field of a sample is the same number, so a torn read has two different ones in it
+struct sample {
+  uint32_t n[24];
+};
+
+void test_snapshot_threads_never_tear() {
+  constexpr auto STORES = 1000000u;
+  vesc::snapshot<sample> s;
+  std::atomic<bool> done{false};
+  std::atomic<uint32_t> torn{0u}, backwards{0u}, reads{0u};
+
+  auto reader = [&]() {
+    uint32_t last = 0u;
+    while (!done.load()) {
+      const auto v = s.load();
+      for (const auto n : v.n) {
+        if (n != v.n[0]) {
+          torn++;
+          break;
+        }
+      }
+      if (v.n[0] < last) { backwards++; }
+      last = v.n[0];
+      reads++;
+    }
+  };
+  std::thread r1(reader), r2(reader);
+
+  for (auto i = 1u; i <= STORES; i++) {
+    sample v;
+    std::fill(std::begin(v.n), std::end(v.n), i);
+    s.store(v);
+  }
+  done = true;
+  r1.join();
+  r2.join();
+
+  TEST_ASSERT_EQUAL(0, torn.load());
+  TEST_ASSERT_EQUAL(0, backwards.load());
+  TEST_ASSERT_TRUE(reads.load() > 0u);
+  TEST_ASSERT_EQUAL(STORES, s.load().n[0]);
+}
+
+struct test_node {
+  test_node() : id{-1} {}
+  explicit test_node(int id) : id{id} {}
+  int id;
+};
+
+void test_node_table_threads_add() {
+  constexpr auto ROUNDS = 2000u;
+  vesc::node_table<test_node, 16u> t;
+  std::atomic<uint32_t> lost{0u};
+
+  // Both tasks add the same ids at once, each should end up in the table exactly once
+  for (auto round = 0u; round < ROUNDS; round++) {
+    t.clear();
+    auto adder = [&](int first) {
+      for (auto i = 0; i < 16; i++) {
+        const auto id = (first + i) % 16 + 16 * (round % 4u);
+        auto *n = t.add(id);
+        if (!n || n->id != id) { lost++; }
+      }
+    };
+    std::thread a(adder, 0), b(adder, 8);
+    a.join();
+    b.join();
+    TEST_ASSERT_EQUAL(16, t.size());
+    for (auto i = 0; i < 16; i++) {
+      const auto id = i + 16 * static_cast<int>(round % 4u);
+      TEST_ASSERT_NOT_NULL(t.find(id));
+      TEST_ASSERT_EQUAL(id, t.find(id)->id);
+    }
+  }
+  TEST_ASSERT_EQUAL(0, lost.load());
+}
+
+using test_history = vesc::history<2u, 16u, 8u, 4u>;
+
+// Sample i is i and -i, every 100ms from base
+void fill_history(test_history &h, uint32_t base, uint32_t samples) {
+  for (auto i = 0u; i < samples; i++) {
+    h.add(base + i * 100000u, {static_cast<float>(i), -static_cast<float>(i)});
+  }
+}
+
+void test_history_rollups() {
+  test_history h;
+  TEST_ASSERT_TRUE(h);
+  fill_history(h, 0u, 250u);
+  TEST_ASSERT_EQUAL(250, h.count(vesc::resolution::RAW));
+
+  // Raw samples are their own min, max and mean, and only the newest fit
+  auto raw = h.last(vesc::resolution::RAW, 100u);
+  TEST_ASSERT_EQUAL(15, raw.size());
+  TEST_ASSERT_EQUAL(23500000u, raw.time()[0]);
+  TEST_ASSERT_EQUAL_FLOAT(249.0f, raw.min(0)[14]);
+  TEST_ASSERT_EQUAL_FLOAT(-249.0f, raw.mean(1)[14]);
+  TEST_ASSERT_TRUE(raw.min(0) == raw.max(0));
+
+  // The second that's still going isn't rolled up yet
+  TEST_ASSERT_EQUAL(24, h.count(vesc::resolution::SECOND));
+  auto secs = h.last(vesc::resolution::SECOND, 2u);
+  TEST_ASSERT_EQUAL(2, secs.size());
+  TEST_ASSERT_EQUAL(23000000u, secs.time()[1]);
+  TEST_ASSERT_EQUAL_FLOAT(230.0f, secs.min(0)[1]);
+  TEST_ASSERT_EQUAL_FLOAT(239.0f, secs.max(0)[1]);
+  TEST_ASSERT_EQUAL_FLOAT(234.5f, secs.mean(0)[1]);
+  TEST_ASSERT_EQUAL_FLOAT(-239.0f, secs.min(1)[1]);
+
+  // Ten seconds at a time, made from whole seconds
+  TEST_ASSERT_EQUAL(2, h.count(vesc::resolution::TEN_SECONDS));
+  auto tens = h.last(vesc::resolution::TEN_SECONDS, 10u);
+  TEST_ASSERT_EQUAL(2, tens.size());
+  TEST_ASSERT_EQUAL(0u, tens.time()[0]);
+  TEST_ASSERT_EQUAL(10000000u, tens.time()[1]);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, tens.min(0)[0]);
+  TEST_ASSERT_EQUAL_FLOAT(99.0f, tens.max(0)[0]);
+  TEST_ASSERT_EQUAL_FLOAT(49.5f, tens.mean(0)[0]);
+  TEST_ASSERT_EQUAL_FLOAT(149.5f, tens.mean(0)[1]);
+  TEST_ASSERT_EQUAL_FLOAT(-100.0f, tens.max(1)[1]);
+}
+
+void test_history_range_and_overwrite() {
+  // Times wrap part way through
+  const auto base = 0u - 1000000u;
+  test_history h;
+  fill_history(h, base, 20u);
+
+  // Samples 0 to 4 have been overwritten already
+  auto w = h.range(vesc::resolution::RAW, base + 300000u, base + 1200000u);
+  TEST_ASSERT_EQUAL(8, w.size());
+  TEST_ASSERT_EQUAL(base + 500000u, w.time()[0]);
+  for (auto i = 0u; i < w.size(); i++) {
+    TEST_ASSERT_EQUAL_FLOAT(5.0f + i, w.mean(0)[i]);
+  }
+  TEST_ASSERT_EQUAL(0, h.range(vesc::resolution::RAW, base + 2500000u, base + 3000000u).size());
+
+  // A window is good until the next sample could land on its oldest
+  w = h.range(vesc::resolution::RAW, base + 800000u, base + 1200000u);
+  TEST_ASSERT_EQUAL(5, w.size());
+  TEST_ASSERT_TRUE(h.intact(w));
+  for (auto i = 20u; i < 23u; i++) {
+    h.add(base + i * 100000u, {static_cast<float>(i), -static_cast<float>(i)});
+  }
+  TEST_ASSERT_TRUE(h.intact(w));
+  TEST_ASSERT_EQUAL_FLOAT(8.0f, w.mean(0)[0]);
+  h.add(base + 2300000u, {23.0f, -23.0f});
+  TEST_ASSERT_FALSE(h.intact(w));
+
+  h.clear();
+  TEST_ASSERT_TRUE(h.last(vesc::resolution::RAW, 5u).empty());
+}
+
+void test_schema_config_roundtrip() {
+  mc_configuration mc{};
+  mc.pwm_mode = PWM_MODE_SYNCHRONOUS;
+  mc.motor_type = MOTOR_TYPE_FOC;
+  mc.l_current_max = 60.0f;
+  mc.l_current_min = -40.0f;
+  mc.hall_table[2] = -1;
+  mc.foc_motor_r = 0.05f;
+  mc.m_fault_stop_time_ms = -5;
+  mc.m_out_aux_mode = OUT_AUX_MODE_ON_AFTER_5S;
+  vesc::buffer<vesc::messages::mcconf::size + 1u> b;
+  vesc::messages::mcconf::encode(b, mc);
+  TEST_ASSERT_EQUAL(vesc::messages::mcconf::size + 1u, b.len());
+  TEST_ASSERT_EQUAL(COMM_SET_MCCONF, b.get<uint8_t>());
+
+  mc_configuration out{};
+  vesc::packet_view v(b.begin(), b.len());
+  TEST_ASSERT_TRUE(vesc::messages::mcconf::decode(v, out));
+  TEST_ASSERT_EQUAL(0, v.len());
+  TEST_ASSERT_TRUE(vesc::messages::mcconf::equal(mc, out));
+  TEST_ASSERT_EQUAL(-1, out.hall_table[2]);
+  TEST_ASSERT_EQUAL_FLOAT(0.05f, out.foc_motor_r);
+  TEST_ASSERT_EQUAL(OUT_AUX_MODE_ON_AFTER_5S, out.m_out_aux_mode);
+
+  // Runtime limits don't count when only the setup is compared
+  out.l_current_max = 30.0f;
+  TEST_ASSERT_FALSE(vesc::messages::mcconf::equal(mc, out));
+  TEST_ASSERT_TRUE(vesc::messages::mcconf::equal(mc, out, vesc::conf::SETUP));
+  out.hall_table[5] = 3;
+  TEST_ASSERT_FALSE(vesc::messages::mcconf::equal(mc, out, vesc::conf::SETUP));
+
+  // Groups are encoded in place
+  app_configuration app{};
+  app.controller_id = 7;
+  app.send_can_status_rate_hz = 50;
+  app.app_adc_conf.update_rate_hz = 500;
+  app.app_nrf_conf.address[1] = 0xA5;
+  app.app_nrf_conf.send_crc_ack = true;
+  vesc::buffer<vesc::messages::appconf::size + 1u> a;
+  vesc::messages::appconf::encode(a, app);
+  TEST_ASSERT_EQUAL(vesc::messages::appconf::size + 1u, a.len());
+  TEST_ASSERT_EQUAL(0xA5, a.begin()[a.len() - 3u]);
+  a.get<uint8_t>();
+  app_configuration app_out{};
+  vesc::packet_view av(a.begin(), a.len());
+  TEST_ASSERT_TRUE(vesc::messages::appconf::decode(av, app_out));
+  TEST_ASSERT_TRUE(vesc::messages::appconf::equal(app, app_out));
+  TEST_ASSERT_EQUAL(500, app_out.app_adc_conf.update_rate_hz);
+  app_out.app_nrf_conf.address[1] = 0;
+  TEST_ASSERT_FALSE(vesc::messages::appconf::equal(app, app_out, vesc::conf::SETUP));
+}
+
+void test_controller_config_cache() {
+  vesc::controller c;
+  vesc::framer rx;
+  std::vector<std::vector<uint8_t>> sent;
+  c.setTX([&](const uint8_t *data, size_t len, bool) { sent.emplace_back(data, data + len); });
+  auto reply = [&](vesc::packet p) {
+    rx.append(p.data().begin(), p.len());
+    return c.parse_all(rx).frames;
+  };
+
+  mc_configuration mc{};
+  mc.l_current_max = 60.0f;
+  mc.l_current_min = -40.0f;
+  mc.l_in_current_max = 30.0f;
+  mc.foc_motor_r = 0.05f;
+
+  // Nothing to compare against yet, so the whole thing goes
+  TEST_ASSERT_NULL(c.mcconf());
+  auto w = c.setMcconf(mc);
+  TEST_ASSERT_EQUAL(vesc::config_change::FULL, w.change);
+  TEST_ASSERT_EQUAL(3u + vesc::messages::mcconf::size + 1u + 3u, sent.back().size());
+  TEST_ASSERT_EQUAL(COMM_SET_MCCONF, sent.back()[3]);
+  vesc::buffer<4> ack;
+  ack.append<uint8_t>(COMM_SET_MCCONF);
+  TEST_ASSERT_EQUAL(1, reply(vesc::packet(ack)));
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.result(w.req).status);
+
+  // Read back, it's cached
+  auto r = c.getMcconf();
+  TEST_ASSERT_TRUE(r);
+  TEST_ASSERT_TRUE(c.awaitingConfig());
+  vesc::buffer<vesc::messages::mcconf::size + 1u> conf;
+  vesc::messages::mcconf::encode(conf, mc);
+  conf.begin()[0] = COMM_GET_MCCONF;
+  TEST_ASSERT_EQUAL(1, reply(vesc::packet(conf)));
+  TEST_ASSERT_EQUAL(vesc::request_status::DONE, c.result(r).status);
+  TEST_ASSERT_FALSE(c.awaitingConfig());
+  TEST_ASSERT_NOT_NULL(c.mcconf());
+  TEST_ASSERT_EQUAL_FLOAT(60.0f, c.mcconf()->l_current_max);
+
+  // Writing what it already has sends nothing
+  sent.clear();
+  TEST_ASSERT_EQUAL(vesc::config_change::NONE, c.setMcconf(mc).change);
+  TEST_ASSERT_EQUAL(0, sent.size());
+
+  // Only the runtime limits is a COMM_SET_MCCONF_TEMP, with the current as a scale of what's stored
+  auto half = mc;
+  half.l_current_max = 30.0f;
+  half.l_in_current_max = 15.0f;
+  w = c.setMcconf(half);
+  TEST_ASSERT_EQUAL(vesc::config_change::RUNTIME, w.change);
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_EQUAL(2u + vesc::messages::mcconf_temp::size + 1u + 3u, sent[0].size());
+  vesc::packet_view t(sent[0].data() + 2, vesc::messages::mcconf_temp::size + 1u);
+  TEST_ASSERT_EQUAL(COMM_SET_MCCONF_TEMP, t.get<uint8_t>());
+  vesc::mcconf_temp temp{};
+  TEST_ASSERT_TRUE(vesc::messages::mcconf_temp::decode(t, temp));
+  TEST_ASSERT_FALSE(temp.store);
+  TEST_ASSERT_TRUE(temp.ack);
+  TEST_ASSERT_EQUAL_FLOAT(0.5f, temp.current_max_scale);
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, temp.current_min_scale);
+  TEST_ASSERT_EQUAL_FLOAT(15.0f, temp.in_current_max);
+  TEST_ASSERT_EQUAL_FLOAT(30.0f, c.mcconf()->l_current_max);
+  TEST_ASSERT_EQUAL_FLOAT(60.0f, c.savedMcconf()->l_current_max);
+  TEST_ASSERT_EQUAL(vesc::config_change::NONE, c.setMcconf(half).change);
+
+  // Going back only takes another one
+  TEST_ASSERT_EQUAL(vesc::config_change::RUNTIME, c.setMcconf(mc).change);
+
+  // Anything else is the whole thing
+  auto motor = mc;
+  motor.foc_motor_r = 0.06f;
+  TEST_ASSERT_EQUAL(vesc::config_change::FULL, c.setMcconf(motor).change);
+  TEST_ASSERT_EQUAL(COMM_SET_MCCONF, sent.back()[3]);
+  TEST_ASSERT_EQUAL_FLOAT(0.06f, c.savedMcconf()->foc_motor_r);
+
+  // Dropped with the link, it isn't counted against the vesc and the cache stays
+  c.clearRequests();
+  TEST_ASSERT_NOT_NULL(c.mcconf());
+  TEST_ASSERT_EQUAL(0, c.local().health.timeouts);
+
+  // A write that's never acknowledged leaves the cache unknown
+  auto slower = motor;
+  slower.l_current_max = 30.0f;
+  w = c.setMcconf(slower);
+  TEST_ASSERT_EQUAL(vesc::config_change::RUNTIME, w.change);
+  TEST_ASSERT_EQUAL(1, c.expireRequests(vesc::micros_now() + 2u * vesc::controller::CONFIG_TIMEOUT_US));
+  TEST_ASSERT_EQUAL(vesc::request_status::TIMED_OUT, c.result(w.req).status);
+  TEST_ASSERT_EQUAL(1, c.local().health.timeouts);
+  TEST_ASSERT_NULL(c.mcconf());
+
+  // A reply with a different layout isn't read
+  c.getMcconf();
+  vesc::buffer<vesc::messages::mcconf::size + 5u> other;
+  other.append<uint8_t>(COMM_GET_MCCONF);
+  other.append(conf.begin() + 1, vesc::messages::mcconf::size);
+  other.append<uint32_t>(0u);
+  TEST_ASSERT_EQUAL(1, reply(vesc::packet(other)));
+  TEST_ASSERT_NULL(c.mcconf());
+}
+
+static std::vector<uint8_t> firmware_image(std::size_t size) {
+  std::vector<uint8_t> image(size);
+  uint32_t state = 0x2545F491u;
+  for (auto &b : image) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    b = state;
+  }
+  return image;
+}
+
+// What the bootloader checks before flashing: the size and CRC of the image in front of it
+static void check_uploaded(const std::vector<uint8_t> &image, const sim::upload_run &run) {
+  TEST_ASSERT_EQUAL(vesc::upload_state::DONE, run.state);
+  TEST_ASSERT_EQUAL(image.size() + 6u, run.flash.size());
+  TEST_ASSERT_EQUAL(image.size(), vesc::endian::load<uint32_t>(run.flash.data()));
+  auto copy = image;
+  TEST_ASSERT_EQUAL_HEX16(crc16(copy.data(), copy.size()), vesc::endian::load<uint16_t>(run.flash.data() + 4));
+  TEST_ASSERT_TRUE(std::equal(image.begin(), image.end(), run.flash.begin() + 6));
+  TEST_ASSERT_EQUAL(image.size(), run.stats.written);
+}
+
+void test_upload_writes_image() {
+  const auto image = firmware_image(10000u);
+  const sim::link_params link{20000u, 11520u, 1000u, 0u, 0u, true};
+  const auto run = sim::upload(image, link, 244u, 8u);
+  check_uploaded(image, run);
+  TEST_ASSERT_EQUAL(234, run.stats.chunk);
+  TEST_ASSERT_EQUAL(0, run.stats.resent);
+  // Enough in flight to cover a round trip
+  TEST_ASSERT_GREATER_THAN(2, run.stats.window);
+
+  // Stop and wait gets there too, just slower
+  const auto slow = sim::upload(image, link, 244u, 1u);
+  check_uploaded(image, slow);
+  TEST_ASSERT_EQUAL(1, slow.stats.window);
+  TEST_ASSERT_GREATER_THAN(2u * slow.stats.throughput(), run.stats.throughput());
+}
+
+void test_upload_recovers() {
+  const auto image = firmware_image(10000u);
+  // Lost writes and a failed one get sent again
+  auto run = sim::upload(image, {20000u, 11520u, 1000u, 7u, 6u + 234u, true}, 244u, 8u);
+  check_uploaded(image, run);
+  TEST_ASSERT_GREATER_THAN(0, run.stats.timeouts);
+  TEST_ASSERT_GREATER_THAN(1, run.stats.resent);
+
+  // Older firmware that doesn't say which chunk it's answering
+  run = sim::upload(image, {20000u, 11520u, 1000u, 0u, 6u + 2u * 234u, false}, 244u, 8u);
+  check_uploaded(image, run);
+  TEST_ASSERT_EQUAL(1, run.stats.resent);
+
+  // An image that reads back differently the second time isn't written
+  vesc::firmware_upload<> up;
+  std::vector<vesc::buffer<vesc::PACKET_MAX_PL_LEN>> sent;
+  auto reads = 0u;
+  auto read = [&](uint32_t, uint8_t *data, std::size_t len) {
+    std::fill(data, data + len, reads++);
+    return len;
+  };
+  auto send = [&](const uint8_t *data, std::size_t len) {
+    sent.emplace_back();
+    sent.back().append(data, len);
+    return true;
+  };
+  TEST_ASSERT_TRUE(up.start(1000u, 100u, false, 4u, 0u));
+  TEST_ASSERT_EQUAL(vesc::upload_state::ERASING, up.poll(read, send, 0u));
+  TEST_ASSERT_EQUAL(COMM_ERASE_NEW_APP, sent.back().get<uint8_t>());
+  TEST_ASSERT_EQUAL(1006, sent.back().get<uint32_t>());
+  const uint8_t ok[] = {1u};
+  vesc::packet_view erased(ok, sizeof(ok));
+  up.reply(COMM_ERASE_NEW_APP, erased, 1000u);
+  TEST_ASSERT_EQUAL(vesc::upload_state::WRITING, up.poll(read, send, 1000u));
+  TEST_ASSERT_EQUAL(3, sent.size());
+  TEST_ASSERT_EQUAL(vesc::upload_state::FAILED, up.poll(read, send, 1000u + up.WRITE_TIMEOUT_US + 1u));
+  TEST_ASSERT_EQUAL(3, sent.size());
+}
+
+void test_telemetry_scheduler_due() {
+  using namespace vesc::values;
+  vesc::telemetry_scheduler<> t;
+  t.set_rate(RPM | DUTY_NOW, 50000u, 200000u);
+  t.set_rate(V_IN, 1000000u, 5000000u);
+  t.set_rate(TEMP_MOS, 2000000u, 10000000u);
+
+  // Everything the first time
+  TEST_ASSERT_EQUAL_HEX32(RPM | DUTY_NOW | V_IN | TEMP_MOS, t.due(0u));
+  // Nothing while it's in flight
+  TEST_ASSERT_EQUAL_HEX32(0u, t.due(60000u));
+  t.reply(RPM | DUTY_NOW | V_IN | TEMP_MOS, 10000u, 10000u);
+  TEST_ASSERT_EQUAL_HEX32(0u, t.stale(10000u));
+
+  // Only the fast fields, until a slow one is close enough to ride along
+  TEST_ASSERT_EQUAL_HEX32(0u, t.due(40000u));
+  TEST_ASSERT_EQUAL_HEX32(RPM | DUTY_NOW, t.due(50000u));
+  t.reply(RPM | DUTY_NOW, 10000u, 60000u);
+  TEST_ASSERT_EQUAL_HEX32(RPM | DUTY_NOW | V_IN, t.due(600000u));
+  t.reply(RPM | DUTY_NOW | V_IN, 10000u, 610000u);
+
+  // Each against its own budget
+  TEST_ASSERT_EQUAL_HEX32(RPM | DUTY_NOW, t.stale(5000000u));
+  TEST_ASSERT_EQUAL_HEX32(RPM | DUTY_NOW | V_IN | TEMP_MOS, t.stale(10020000u));
+}
+
+void test_telemetry_scheduler_adapts() {
+  using namespace vesc::values;
+  vesc::telemetry_scheduler<> t;
+  t.set_rate(RPM, 50000u, 200000u);
+  t.set_rate(V_IN, 1000000u, 3000000u);
+
+  // Losing requests stretches the periods, up to the staleness budget
+  for (auto i = 0u; i < 3u; i++) {
+    TEST_ASSERT_TRUE(t.due(0u));
+    t.timeout(RPM | V_IN);
+  }
+  TEST_ASSERT_EQUAL(8u * vesc::telemetry_scheduler<>::BACKOFF_ONE, t.link().backoff);
+  TEST_ASSERT_EQUAL(200000u, t.period(7));
+  TEST_ASSERT_EQUAL(3000000u, t.period(8));
+  TEST_ASSERT_EQUAL(3, t.link().timeouts);
+
+  // One that couldn't be sent is due again, without counting against the link
+  TEST_ASSERT_EQUAL_HEX32(RPM | V_IN, t.due(0u));
+  t.unsent(RPM | V_IN);
+  TEST_ASSERT_EQUAL_HEX32(RPM | V_IN, t.due(0u));
+  t.unsent(RPM | V_IN);
+  TEST_ASSERT_EQUAL(8u * vesc::telemetry_scheduler<>::BACKOFF_ONE, t.link().backoff);
+  TEST_ASSERT_EQUAL(3, t.link().timeouts);
+
+  // And replies bring them back
+  for (auto i = 0u; i < 12u; i++) {
+    t.reply(RPM, 1000u, 0u);
+  }
+  TEST_ASSERT_EQUAL(vesc::telemetry_scheduler<>::BACKOFF_ONE, t.link().backoff);
+  TEST_ASSERT_EQUAL(50000u, t.period(7));
+
+  // Nothing is asked for faster than the link answers
+  for (auto i = 0u; i < 30u; i++) {
+    t.reply(RPM, 80000u, 0u);
+  }
+  TEST_ASSERT_GREATER_THAN(50000u, t.period(7));
+  TEST_ASSERT_EQUAL(1000000u, t.period(8));
+}
+
+void test_crc_check_value() {
+  std::string check = "123456789";
+  auto buf = reinterpret_cast<unsigned char *>(&check[0]);
+
+  // The standard check value for CRC16/XMODEM
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16(buf, check.size()));
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_bytewise(0, buf, check.size()));
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_generated(0, buf, check.size()));
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_nibble(0, buf, check.size()));
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_slice4(0, buf, check.size()));
+  TEST_ASSERT_EQUAL_HEX16(0x31C3, crc16_slice8(0, buf, check.size()));
+}
+
+void test_crc_strategies_match() {
+  std::vector<unsigned char> data(1031);
+  srand(1234);
+  for (auto &d : data) {
+    d = rand();
+  }
+
+  // Every length up to a few blocks, plus odd offsets to catch any alignment assumptions
+  for (auto offset = 0u; offset < 3u; offset++) {
+    for (auto len = 0u; len < 100u; len++) {
+      auto ref = crc16_bytewise(0, data.data() + offset, len);
+      TEST_ASSERT_EQUAL_HEX16(ref, crc16_generated(0, data.data() + offset, len));
+      TEST_ASSERT_EQUAL_HEX16(ref, crc16_nibble(0, data.data() + offset, len));
+      TEST_ASSERT_EQUAL_HEX16(ref, crc16_slice4(0, data.data() + offset, len));
+      TEST_ASSERT_EQUAL_HEX16(ref, crc16_slice8(0, data.data() + offset, len));
+      TEST_ASSERT_EQUAL_HEX16(ref, crc16_update(0, data.data() + offset, len));
+    }
+  }
+
+  auto ref = crc16(data.data(), data.size());
+  TEST_ASSERT_EQUAL_HEX16(ref, crc16_slice8(0, data.data(), data.size()));
+}
+
+void test_crc_update_chains() {
+  std::vector<unsigned char> data(300);
+  for (auto i = 0u; i < data.size(); i++) {
+    data[i] = i * 7;
+  }
+
+  auto ref = crc16(data.data(), data.size());
+  for (auto split = 0u; split <= data.size(); split += 13) {
+    auto crc = crc16_update(0, data.data(), split);
+    TEST_ASSERT_EQUAL_HEX16(ref, crc16_update(crc, data.data() + split, data.size() - split));
+    crc = crc16_slice8(0, data.data(), split);
+    TEST_ASSERT_EQUAL_HEX16(ref, crc16_nibble(crc, data.data() + split, data.size() - split));
+  }
+}
+
+void test_crc_fuzz_implementations() {
+  std::vector<unsigned char> data(4096 + 16);
+  srand(4321);
+  for (auto &d : data) {
+    d = rand();
+  }
+
+  // Random lengths, offsets and starting values through every implementation, checked against the reference
+  for (auto i = 0u; i < 2000u; i++) {
+    auto len = rand() % 4096u;
+    auto offset = rand() % 16u;
+    unsigned short seed = i < 1000u ? 0u : rand();
+    auto buf = data.data() + offset;
+
+    auto ref = crc16_bytewise(seed, buf, len);
+    TEST_ASSERT_EQUAL_HEX16(ref, crc16_slice4(seed, buf, len));
+    TEST_ASSERT_EQUAL_HEX16(ref, crc16_slice8(seed, buf, len));
+    TEST_ASSERT_EQUAL_HEX16(ref, crc16_fast(seed, buf, len));
+#if defined(__x86_64__) || defined(__i386__)
+    if (crc16_pclmul_supported()) { TEST_ASSERT_EQUAL_HEX16(ref, crc16_pclmul(seed, buf, len)); }
+#endif
+  }
+
+  // Everything around the fold boundaries
+  for (auto len = 0u; len < 300u; len++) {
+    TEST_ASSERT_EQUAL_HEX16(crc16(data.data(), len), crc16_fast(0u, data.data(), len));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  UNITY_BEGIN();
+
+  RUN_TEST(test_buffer_init);
+  RUN_TEST(test_buffer_append_uint8_t);
+  RUN_TEST(test_buffer_append_int8_t);
+  RUN_TEST(test_buffer_append_uint16_t);
+  RUN_TEST(test_buffer_append_int16_t);
+  RUN_TEST(test_buffer_append_uint32_t);
+  RUN_TEST(test_buffer_append_int32_t);
+  RUN_TEST(test_buffer_append_float);
+  RUN_TEST(test_buffer_append_multiple);
+  RUN_TEST(test_buffer_append_multiple_types);
+  RUN_TEST(test_buffer_append_buffer);
+  RUN_TEST(test_buffer_copy_buffer);
+  RUN_TEST(test_buffer_initializer_list);
+  RUN_TEST(test_buffer_reload);
+  RUN_TEST(test_byte_order);
+  RUN_TEST(test_buffer_getfp_signed);
+  RUN_TEST(test_buffer_float_special_values);
+
+  RUN_TEST(test_packet_from_buffer);
+  RUN_TEST(test_simple_packet);
+  RUN_TEST(test_packet_bad_start);
+  RUN_TEST(test_packet_bad_end);
+  RUN_TEST(test_packet_bad_crc);
+  RUN_TEST(test_fw_packet);
+  RUN_TEST(test_packet_fragmented);
+  RUN_TEST(test_packet_fragmented_bad_crc);
+  RUN_TEST(test_constexpr_frame);
+  RUN_TEST(test_constexpr_frame_long);
+  RUN_TEST(test_packet_length_boundary);
+  RUN_TEST(test_ring_buffer_wrap);
+  RUN_TEST(test_ring_buffer_matches_buffer);
+  RUN_TEST(test_rx_packet_back_to_back);
+  RUN_TEST(test_packet_view_reads_in_place);
+  RUN_TEST(test_controller_dispatches_view);
+  RUN_TEST(test_delegate_calls);
+  RUN_TEST(test_dispatch_table_subscribers);
+  RUN_TEST(test_controller_callbacks);
+  RUN_TEST(test_schema_sizes);
+  RUN_TEST(test_schema_encode_matches_hand_written);
+  RUN_TEST(test_schema_decode_values);
+  RUN_TEST(test_framer_skips_garbage);
+  RUN_TEST(test_framer_loses_only_the_bad_frame);
+  RUN_TEST(test_framer_impossible_length);
+  RUN_TEST(test_parse_all_drains_notification);
+  RUN_TEST(test_framer_large_frames);
+  RUN_TEST(test_framer_large_frame_not_allowed);
+  RUN_TEST(test_controller_large_frame);
+  RUN_TEST(test_request_tracker_rtt);
+  RUN_TEST(test_request_tracker_timeouts);
+  RUN_TEST(test_controller_request_reply);
+  RUN_TEST(test_controller_selective_values);
+  RUN_TEST(test_controller_merges_partial_values);
+  RUN_TEST(test_controller_can_nodes);
+  RUN_TEST(test_controller_late_node_reply);
+  RUN_TEST(test_tx_batch_packs_frames);
+  RUN_TEST(test_controller_batches_setpoints);
+  RUN_TEST(test_snapshot_load_store);
+  RUN_TEST(test_snapshot_threads_never_tear);
+  RUN_TEST(test_node_table_threads_add);
+  RUN_TEST(test_history_rollups);
+  RUN_TEST(test_history_range_and_overwrite);
+  RUN_TEST(test_schema_config_roundtrip);
+  RUN_TEST(test_controller_config_cache);
+  RUN_TEST(test_upload_writes_image);
+  RUN_TEST(test_upload_recovers);
+  RUN_TEST(test_telemetry_scheduler_due);
+  RUN_TEST(test_telemetry_scheduler_adapts);
+  RUN_TEST(test_pool_acquire_release);
+  RUN_TEST(test_controller_sends_from_pool);
+  RUN_TEST(test_message_frame_matches_packet);
+
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_crc_strategies_match);
+  RUN_TEST(test_crc_update_chains);
+  RUN_TEST(test_crc_fuzz_implementations);
+  UNITY_END();
+  return 0;
+}